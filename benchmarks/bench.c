@@ -0,0 +1,568 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS 5
+#define BENCH_THRESHOLD 5.0
+#define BENCH_ALPHA 0.05
+
+typedef enum
+{
+    METRIC_SECONDS,
+    METRIC_MAX_RSS,
+    METRIC_COLLECTIONS,
+    METRIC_PAUSE_TOTAL,
+    METRIC_PAUSE_MAX,
+    METRIC_COUNT,
+} Metric;
+
+// Every metric is better lower: wall clock seconds, peak resident bytes,
+// collections and milliseconds of collector pauses, as `--gc-stats` has them.
+static const char* metric_names[METRIC_COUNT] = {
+    "seconds", "max_rss", "collections", "gc_pause_total", "gc_pause_max",
+};
+
+typedef struct
+{
+    double median;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+} Summary;
+
+typedef struct
+{
+    const char* name;
+    int runs;
+    double* samples[METRIC_COUNT];
+    Summary summaries[METRIC_COUNT];
+} Benchmark;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: clox_bench [--runs count] [--output path] "
+            "[--baseline path] [--threshold percent] clox-path script...\n"
+            "Runs every script count times, 5 by default, and writes the "
+            "wall clock seconds,\n"
+            "peak RSS and collector statistics of the runs as JSON to path "
+            "or stdout.\n"
+            "With a baseline written the same way, exits with 1 when a "
+            "metric got worse by\n"
+            "more than percent, 5 by default, and the runs say so with 95%% "
+            "confidence.\n");
+}
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// The script file name without its directory and extension.
+static const char* bench_name(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    const char* start = slash == NULL ? path : slash + 1;
+    size_t length = strlen(start);
+
+    if (length > 4 && strcmp(start + length - 4, ".lox") == 0) length -= 4;
+
+    char* name = (char*)malloc(length + 1);
+    if (name == NULL) exit(1);
+
+    memcpy(name, start, length);
+    name[length] = '\0';
+    return name;
+}
+
+// Runs the script once with its output discarded and fills in one sample of
+// every metric. Returns false if it did not exit cleanly.
+static bool bench_run_once(const char* clox, const char* script,
+                           double metrics[METRIC_COUNT])
+{
+    int errors[2];
+    if (pipe(errors) != 0) return false;
+
+    double start = now_seconds();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(errors[0]);
+        close(errors[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        dup2(errors[1], STDERR_FILENO);
+        close(errors[0]);
+
+        execl(clox, clox, "--gc-stats", script, (char*)NULL);
+        _exit(127);
+    }
+
+    close(errors[1]);
+
+    // The statistics come last, so only the tail of stderr is kept.
+    char output[4096];
+    size_t length = 0;
+    ssize_t bytes;
+
+    while ((bytes = read(errors[0], output + length,
+                         sizeof(output) - 1 - length)) > 0)
+    {
+        length += (size_t)bytes;
+        if (length == sizeof(output) - 1)
+        {
+            memmove(output, output + length / 2, length - length / 2);
+            length -= length / 2;
+        }
+    }
+
+    output[length] = '\0';
+    close(errors[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) return false;
+
+    metrics[METRIC_SECONDS] = now_seconds() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fputs(output, stderr);
+        return false;
+    }
+
+    // ru_maxrss is in kilobytes.
+    metrics[METRIC_MAX_RSS] = (double)usage.ru_maxrss * 1024;
+
+    const char* stats = strstr(output, "gc: ");
+    unsigned long long collections, compactions;
+    double pause_total, pause_max;
+
+    if (stats == NULL ||
+        sscanf(stats,
+               "gc: %llu collections, %llu compactions, pause total %lfms, "
+               "max %lfms",
+               &collections, &compactions, &pause_total, &pause_max) != 4)
+        return false;
+
+    metrics[METRIC_COLLECTIONS] = (double)collections;
+    metrics[METRIC_PAUSE_TOTAL] = pause_total;
+    metrics[METRIC_PAUSE_MAX] = pause_max;
+    return true;
+}
+
+static int sample_compare(const void* a, const void* b)
+{
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static double samples_mean(const double* samples, int count)
+{
+    double sum = 0;
+    for (int i = 0; i < count; ++i) sum += samples[i];
+    return sum / count;
+}
+
+// Sample variance, zero for a single sample.
+static double samples_variance(const double* samples, int count)
+{
+    if (count < 2) return 0;
+
+    double mean = samples_mean(samples, count);
+    double squares = 0;
+    for (int i = 0; i < count; ++i)
+        squares += (samples[i] - mean) * (samples[i] - mean);
+
+    return squares / (count - 1);
+}
+
+static Summary samples_summarize(const double* samples, int count)
+{
+    double* sorted = (double*)malloc(sizeof(double) * count);
+    if (sorted == NULL) exit(1);
+
+    memcpy(sorted, samples, sizeof(double) * count);
+    qsort(sorted, count, sizeof(double), sample_compare);
+
+    Summary summary;
+    summary.median = count % 2 == 1
+                         ? sorted[count / 2]
+                         : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    summary.mean = samples_mean(sorted, count);
+    summary.stddev = sqrt(samples_variance(sorted, count));
+    summary.min = sorted[0];
+    summary.max = sorted[count - 1];
+
+    free(sorted);
+    return summary;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// WELCH'S T-TEST
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Continued fraction of the incomplete beta function, evaluated with the
+// modified Lentz method.
+static double beta_fraction(double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    if (fabs(d) < tiny) d = tiny;
+    d = 1 / d;
+    double result = d;
+
+    for (int m = 1; m <= 200; ++m)
+    {
+        double even = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1 + even * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1 + even / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        result *= d * c;
+
+        double odd =
+            -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + odd * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1 + odd / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+
+        double delta = d * c;
+        result *= delta;
+        if (fabs(delta - 1) < 1e-12) break;
+    }
+
+    return result;
+}
+
+// The regularized incomplete beta function I_x(a, b).
+static double beta_regularized(double a, double b, double x)
+{
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) +
+                       b * log(1 - x));
+
+    if (x < (a + 1) / (a + b + 2)) return front * beta_fraction(a, b, x) / a;
+    return 1 - front * beta_fraction(b, a, 1 - x) / b;
+}
+
+// Two sided p-value of the two sample sets having the same mean, without
+// assuming they have the same variance. Samples that do not vary, or too
+// few of them to tell, only have the same mean if their means are equal.
+static double welch_p_value(const double* left, int left_count,
+                            const double* right, int right_count)
+{
+    double left_mean = samples_mean(left, left_count);
+    double right_mean = samples_mean(right, right_count);
+    double left_error = samples_variance(left, left_count) / left_count;
+    double right_error = samples_variance(right, right_count) / right_count;
+    double error = left_error + right_error;
+
+    if (left_count < 2 || right_count < 2 || error == 0)
+        return left_mean == right_mean ? 1 : 0;
+
+    double t = (left_mean - right_mean) / sqrt(error);
+    double freedom =
+        error * error / (left_error * left_error / (left_count - 1) +
+                         right_error * right_error / (right_count - 1));
+
+    return beta_regularized(freedom / 2, 0.5, freedom / (freedom + t * t));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// RESULTS
+///////////////////////////////////////////////////////////////////////////////////////
+
+static void bench_print(FILE* out, const char* clox, Benchmark* benches,
+                        int count, int runs)
+{
+    fprintf(out, "{\n  \"clox\": \"%s\",\n  \"runs\": %d,\n", clox, runs);
+    fprintf(out, "  \"benchmarks\": [\n");
+
+    for (int i = 0; i < count; ++i)
+    {
+        Benchmark* bench = &benches[i];
+        fprintf(out, "    {\n      \"name\": \"%s\"", bench->name);
+
+        for (int metric = 0; metric < METRIC_COUNT; ++metric)
+        {
+            Summary* summary = &bench->summaries[metric];
+            fprintf(out,
+                    ",\n      \"%s\": {\"median\": %.6f, \"mean\": %.6f, "
+                    "\"stddev\": %.6f, \"min\": %.6f, \"max\": %.6f, "
+                    "\"samples\": [",
+                    metric_names[metric], summary->median, summary->mean,
+                    summary->stddev, summary->min, summary->max);
+
+            for (int run = 0; run < bench->runs; ++run)
+                fprintf(out, "%s%.6f", run > 0 ? ", " : "",
+                        bench->samples[metric][run]);
+
+            fputs("]}", out);
+        }
+
+        fprintf(out, "\n    }%s\n", i + 1 < count ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+static char* file_read(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0l, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = (char*)malloc(file_size + 1);
+    if (buffer == NULL) exit(1);
+
+    size_t byte_read = fread(buffer, sizeof(char), file_size, file);
+    buffer[byte_read] = '\0';
+
+    fclose(file);
+    return buffer;
+}
+
+// Finds the samples of one metric of a benchmark in results written by
+// bench_print. Returns the number of samples, zero if there are none.
+static int baseline_samples(const char* json, const char* name, Metric metric,
+                            double** out_samples)
+{
+    char key[256];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    const char* start = strstr(json, key);
+    if (start == NULL) return 0;
+
+    // A benchmark ends where the next one is named.
+    const char* end = strstr(start + 1, "\"name\": ");
+    if (end == NULL) end = start + strlen(start);
+
+    snprintf(key, sizeof(key), "\"%s\": {", metric_names[metric]);
+    const char* object = strstr(start, key);
+    if (object == NULL || object > end) return 0;
+
+    const char* list = strstr(object, "\"samples\": [");
+    if (list == NULL || list > end) return 0;
+
+    const char* cursor = list + strlen("\"samples\": [");
+    int count = 0;
+    int capacity = 8;
+    double* samples = (double*)malloc(sizeof(double) * capacity);
+    if (samples == NULL) exit(1);
+
+    while (*cursor != ']' && *cursor != '\0')
+    {
+        char* next;
+        double sample = strtod(cursor, &next);
+        if (next == cursor) break;
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            samples = (double*)realloc(samples, sizeof(double) * capacity);
+            if (samples == NULL) exit(1);
+        }
+
+        samples[count++] = sample;
+        cursor = next;
+        while (*cursor == ',' || *cursor == ' ') cursor++;
+    }
+
+    *out_samples = samples;
+    return count;
+}
+
+// Prints how every metric moved against the baseline. Returns how many got
+// worse by more than `threshold` percent with significance.
+static int bench_compare(const char* baseline, Benchmark* benches, int count,
+                         double threshold)
+{
+    int regressions = 0;
+
+    fprintf(stderr, "\n%-16s %-16s %14s %14s %8s %8s\n", "benchmark",
+            "metric", "baseline", "current", "change", "p");
+
+    for (int i = 0; i < count; ++i)
+    {
+        Benchmark* bench = &benches[i];
+
+        for (int metric = 0; metric < METRIC_COUNT; ++metric)
+        {
+            double* samples = NULL;
+            int samples_count =
+                baseline_samples(baseline, bench->name, metric, &samples);
+            if (samples_count == 0)
+            {
+                fprintf(stderr, "%-16s %-16s %14s\n", bench->name,
+                        metric_names[metric], "new");
+                continue;
+            }
+
+            double before = samples_mean(samples, samples_count);
+            double after = bench->summaries[metric].mean;
+            double change = before != 0 ? 100 * (after - before) / before
+                            : after != 0 ? 100
+                                         : 0;
+            double p = welch_p_value(samples, samples_count,
+                                     bench->samples[metric], bench->runs);
+
+            bool regressed = change > threshold && p < BENCH_ALPHA;
+            if (regressed) regressions++;
+
+            fprintf(stderr, "%-16s %-16s %14.6g %14.6g %+7.1f%% %8.4f%s\n",
+                    bench->name, metric_names[metric], before, after, change,
+                    p, regressed ? "  REGRESSED" : "");
+            free(samples);
+        }
+    }
+
+    return regressions;
+}
+
+int main(int argc, const char* argv[])
+{
+    long runs = BENCH_RUNS;
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    double threshold = BENCH_THRESHOLD;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-')
+    {
+        if (strcmp(argv[first], "--runs") == 0 && first + 1 < argc &&
+            (runs = strtol(argv[first + 1], NULL, 10)) > 0)
+            first += 2;
+        else if (strcmp(argv[first], "--output") == 0 && first + 1 < argc)
+        {
+            output_path = argv[first + 1];
+            first += 2;
+        }
+        else if (strcmp(argv[first], "--baseline") == 0 && first + 1 < argc)
+        {
+            baseline_path = argv[first + 1];
+            first += 2;
+        }
+        else if (strcmp(argv[first], "--threshold") == 0 &&
+                 first + 1 < argc &&
+                 (threshold = strtod(argv[first + 1], NULL)) >= 0)
+            first += 2;
+        else
+        {
+            usage();
+            return 64;
+        }
+    }
+
+    if (argc - first < 2)
+    {
+        usage();
+        return 64;
+    }
+
+    // Read up front, so a baseline can be overwritten by this run's output.
+    char* baseline = NULL;
+    if (baseline_path != NULL && (baseline = file_read(baseline_path)) == NULL)
+    {
+        fprintf(stderr, "Could not read baseline '%s'.\n", baseline_path);
+        return 74;
+    }
+
+    const char* clox = argv[first];
+    int count = argc - first - 1;
+
+    Benchmark* benches = (Benchmark*)calloc(count, sizeof(Benchmark));
+    if (benches == NULL) exit(1);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const char* script = argv[first + 1 + i];
+        Benchmark* bench = &benches[i];
+
+        bench->name = bench_name(script);
+        bench->runs = (int)runs;
+
+        for (int metric = 0; metric < METRIC_COUNT; ++metric)
+        {
+            bench->samples[metric] = (double*)malloc(sizeof(double) * runs);
+            if (bench->samples[metric] == NULL) exit(1);
+        }
+
+        for (int run = 0; run < runs; ++run)
+        {
+            double metrics[METRIC_COUNT];
+            if (!bench_run_once(clox, script, metrics))
+            {
+                fprintf(stderr, "Could not run '%s' with '%s'.\n", script,
+                        clox);
+                return 70;
+            }
+
+            for (int metric = 0; metric < METRIC_COUNT; ++metric)
+                bench->samples[metric][run] = metrics[metric];
+        }
+
+        for (int metric = 0; metric < METRIC_COUNT; ++metric)
+            bench->summaries[metric] =
+                samples_summarize(bench->samples[metric], (int)runs);
+
+        // Progress goes to stderr, stdout is kept for the results.
+        Summary* seconds = &bench->summaries[METRIC_SECONDS];
+        fprintf(stderr, "%-16s median %8.3fs  stddev %7.3fs\n", bench->name,
+                seconds->median, seconds->stddev);
+    }
+
+    FILE* out = output_path == NULL ? stdout : fopen(output_path, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open '%s'.\n", output_path);
+        return 74;
+    }
+
+    bench_print(out, clox, benches, count, (int)runs);
+    if (out != stdout) fclose(out);
+
+    int regressions = 0;
+    if (baseline != NULL)
+    {
+        regressions = bench_compare(baseline, benches, count, threshold);
+        fprintf(stderr, "%d regression%s past %.1f%%.\n", regressions,
+                regressions == 1 ? "" : "s", threshold);
+        free(baseline);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        free((char*)benches[i].name);
+        for (int metric = 0; metric < METRIC_COUNT; ++metric)
+            free(benches[i].samples[metric]);
+    }
+
+    free(benches);
+    return regressions > 0 ? 1 : 0;
+}
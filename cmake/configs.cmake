@@ -11,6 +11,8 @@ else()
     message(STATUS "Unknown compiler ('${CMAKE_C_COMPILER_ID}') - No compiler option is set")
 endif()
 
-set(CMAKE_RUNTIME_OUTPUT_DIRECTORY "${CMAKE_SOURCE_DIR}/out/${CMAKE_BUILD_TYPE}")
+if(NOT CMAKE_RUNTIME_OUTPUT_DIRECTORY)
+    set(CMAKE_RUNTIME_OUTPUT_DIRECTORY "${CMAKE_SOURCE_DIR}/out/${CMAKE_BUILD_TYPE}")
+endif()
 
 enable_testing()
\ No newline at end of file
@@ -34,7 +34,7 @@ endfunction()
 
 function(define_post_built_copy TARGET_NAME DESTINATION)
     set(FILES_TO_COPY ${ARGN})
-    set(DESTINATION_DIR "${CMAKE_SOURCE_DIR}/out/${CMAKE_BUILD_TYPE}/${DESTINATION}")
+    set(DESTINATION_DIR "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/${DESTINATION}")
 
     if(NOT DESTINATION STREQUAL "")
         set(COPY_TARGET_NAME ${DESTINATION}_${TARGET_NAME}_copy_files)
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocs.h"
+#include "memory.h"
+#include "vm.h"
+
+#define ALLOCS_KINDS (ALLOCS_BUFFER + 1)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t bytes;
+} AllocCounter;
+
+typedef struct
+{
+    // "name:line" of the site, NULL for an unused entry.
+    char* site;
+    uint32_t hash;
+    AllocCounter total;
+    AllocCounter kinds[ALLOCS_KINDS];
+} AllocSite;
+
+struct Allocs
+{
+    int every;
+    int countdown;
+
+    // Open addressing table of sites.
+    AllocSite* sites;
+    int count;
+    int capacity;
+};
+
+Allocs* allocs_new(int every)
+{
+    Allocs* allocs = (Allocs*)calloc(1, sizeof(Allocs));
+    if (allocs == NULL) exit(1);
+
+    allocs->every = every > 0 ? every : 1;
+    allocs->countdown = allocs->every;
+    return allocs;
+}
+
+void allocs_free(Allocs* allocs)
+{
+    for (int i = 0; i < allocs->capacity; ++i) free(allocs->sites[i].site);
+
+    free(allocs->sites);
+    free(allocs);
+}
+
+static uint32_t site_hash(const char* site, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (uint8_t)site[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static AllocSite* site_find(AllocSite* sites, int capacity, const char* site,
+                            uint32_t hash)
+{
+    uint32_t index = hash & (capacity - 1);
+
+    while (true)
+    {
+        AllocSite* entry = &sites[index];
+        if (entry->site == NULL) return entry;
+        if (entry->hash == hash && strcmp(entry->site, site) == 0) return entry;
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void sites_grow(Allocs* allocs)
+{
+    int capacity = capacity_grow(allocs->capacity);
+    AllocSite* sites = (AllocSite*)calloc(capacity, sizeof(AllocSite));
+    if (sites == NULL) exit(1);
+
+    for (int i = 0; i < allocs->capacity; ++i)
+    {
+        AllocSite* entry = &allocs->sites[i];
+        if (entry->site == NULL) continue;
+
+        *site_find(sites, capacity, entry->site, entry->hash) = *entry;
+    }
+
+    free(allocs->sites);
+    allocs->sites = sites;
+    allocs->capacity = capacity;
+}
+
+void allocs_record(Allocs* allocs, VM* vm, int kind, size_t bytes)
+{
+    if (--allocs->countdown > 0) return;
+    allocs->countdown = allocs->every;
+
+    char site[256];
+    ObjFiber* fiber = vm->fiber;
+
+    // Allocations before anything runs come from compiling or loading.
+    if (fiber == NULL || fiber->frame_count == 0)
+    {
+        strcpy(site, "(compiler)");
+    }
+    else
+    {
+        CallFrame* frame = &fiber->frames[fiber->frame_count - 1];
+        ObjFunction* function = frame->closure->function;
+
+        // A frame that did not start yet is still at its first line.
+        size_t instruction = frame->ip - function->chunk.code;
+        if (instruction > 0) instruction--;
+
+        snprintf(site, sizeof(site), "%s:%d",
+                 function->name == NULL ? "script" : function->name->chars,
+                 function->chunk.lines[instruction]);
+    }
+
+    if ((allocs->count + 1) * 4 > allocs->capacity * 3) sites_grow(allocs);
+
+    uint32_t hash = site_hash(site, strlen(site));
+    AllocSite* entry = site_find(allocs->sites, allocs->capacity, site, hash);
+
+    if (entry->site == NULL)
+    {
+        entry->site = strdup(site);
+        if (entry->site == NULL) exit(1);
+
+        entry->hash = hash;
+        allocs->count++;
+    }
+
+    uint64_t weighted = (uint64_t)bytes * allocs->every;
+    entry->total.count += allocs->every;
+    entry->total.bytes += weighted;
+    entry->kinds[kind].count += allocs->every;
+    entry->kinds[kind].bytes += weighted;
+}
+
+static int site_compare(const void* a, const void* b)
+{
+    uint64_t left = (*(const AllocSite**)a)->total.bytes;
+    uint64_t right = (*(const AllocSite**)b)->total.bytes;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void allocs_report(Allocs* allocs, FILE* out, int limit)
+{
+    AllocSite** sites = (AllocSite**)malloc(sizeof(AllocSite*) * allocs->count);
+    if (sites == NULL && allocs->count > 0) exit(1);
+
+    int count = 0;
+    AllocCounter total = {0, 0};
+
+    for (int i = 0; i < allocs->capacity; ++i)
+    {
+        AllocSite* entry = &allocs->sites[i];
+        if (entry->site == NULL) continue;
+
+        sites[count++] = entry;
+        total.count += entry->total.count;
+        total.bytes += entry->total.bytes;
+    }
+
+    qsort(sites, count, sizeof(AllocSite*), site_compare);
+
+    fprintf(out, "-- allocations: %llu, %llu bytes, every %d recorded\n",
+            (unsigned long long)total.count, (unsigned long long)total.bytes,
+            allocs->every);
+    fprintf(out, "%14s %16s  %s\n", "count", "bytes", "where");
+
+    for (int i = 0; i < count && i < limit; ++i)
+    {
+        AllocSite* entry = sites[i];
+        fprintf(out, "%14llu %16llu  %s\n",
+                (unsigned long long)entry->total.count,
+                (unsigned long long)entry->total.bytes, entry->site);
+
+        for (int kind = 0; kind < ALLOCS_KINDS; ++kind)
+        {
+            AllocCounter* counter = &entry->kinds[kind];
+            if (counter->count == 0) continue;
+
+            fprintf(out, "%14llu %16llu    %s\n",
+                    (unsigned long long)counter->count,
+                    (unsigned long long)counter->bytes,
+                    kind == ALLOCS_BUFFER ? "buffer"
+                                          : obj_type_name((ObjType)kind));
+        }
+    }
+
+    free(sites);
+}
@@ -0,0 +1,26 @@
+#ifndef CLOX_ALLOCS_H_
+#define CLOX_ALLOCS_H_
+
+#include <stdio.h>
+
+#include "general.h"
+#include "object.h"
+
+// Allocation profiler behind `--alloc-profile`. Every `every`th allocation
+// is charged, `every` times over, to the function and line of the running
+// Lox frame: objects by their type, and growing arrays, strings and tables
+// as buffers. Natives count towards the line calling them.
+typedef struct Allocs Allocs;
+
+// What allocs_record is told besides the ObjType of new objects.
+#define ALLOCS_BUFFER OBJ_TYPE_COUNT
+
+Allocs* allocs_new(int every);
+void allocs_free(Allocs* allocs);
+
+void allocs_record(Allocs* allocs, VM* vm, int kind, size_t bytes);
+
+// Prints the `limit` sites that allocated the most bytes.
+void allocs_report(Allocs* allocs, FILE* out, int limit);
+
+#endif // CLOX_ALLOCS_H_
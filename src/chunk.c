@@ -13,15 +13,15 @@ void chunk_init(Chunk* chunk)
     value_array_init(&chunk->constants);
 }
 
-void chunk_free(Chunk* chunk)
+void chunk_free(VM* vm, Chunk* chunk)
 {
-    array_free(uint8_t, chunk->code, chunk->capacity);
-    array_free(int, chunk->lines, chunk->capacity);
-    value_array_free(&chunk->constants);
+    array_free(vm, uint8_t, chunk->code, chunk->capacity);
+    array_free(vm, int, chunk->lines, chunk->capacity);
+    value_array_free(vm, &chunk->constants);
     chunk_init(chunk);
 }
 
-void chunk_write(Chunk* chunk, uint8_t byte, int line)
+void chunk_write(VM* vm, Chunk* chunk, uint8_t byte, int line)
 {
     if (chunk->capacity < chunk->count + 1)
     {
@@ -29,10 +29,10 @@ void chunk_write(Chunk* chunk, uint8_t byte, int line)
         chunk->capacity = capacity_grow(old_capacity);
 
         chunk->code =
-            array_grow(uint8_t, chunk->code, old_capacity, chunk->capacity);
+            array_grow(vm, uint8_t, chunk->code, old_capacity, chunk->capacity);
 
         chunk->lines =
-            array_grow(int, chunk->lines, old_capacity, chunk->capacity);
+            array_grow(vm, int, chunk->lines, old_capacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
@@ -40,10 +40,10 @@ void chunk_write(Chunk* chunk, uint8_t byte, int line)
     chunk->count++;
 }
 
-int chunk_constant_add(Chunk* chunk, Value value)
+int chunk_constant_add(VM* vm, Chunk* chunk, Value value)
 {
-    vm_stack_push(value);
-    value_array_write(&chunk->constants, value);
-    vm_stack_pop();
+    vm_stack_push(vm, value);
+    value_array_write(vm, &chunk->constants, value);
+    vm_stack_pop(vm);
     return chunk->constants.count - 1;
 }
@@ -44,9 +44,14 @@ typedef enum
     OP_LIST_GETIDX,
     OP_LIST_SETIDX,
     OP_RETURN,
+    OP_YIELD,
+    OP_RESUME,
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
+    OP_MAP_INIT,
+    OP_FOR_RANGE,
+    OP_ITER_NEXT,
 } OpCode;
 
 typedef struct
@@ -60,10 +65,10 @@ typedef struct
 
 void chunk_init(Chunk* chunk);
 
-void chunk_free(Chunk* chunk);
+void chunk_free(VM* vm, Chunk* chunk);
 
-void chunk_write(Chunk* chunk, uint8_t byte, int line);
+void chunk_write(VM* vm, Chunk* chunk, uint8_t byte, int line);
 
-int chunk_constant_add(Chunk* chunk, Value value);
+int chunk_constant_add(VM* vm, Chunk* chunk, Value value);
 
 #endif // CLOX_CHUNK_H_
@@ -11,14 +11,6 @@
 #include "debug.h"
 #endif
 
-typedef struct
-{
-    Token current;
-    Token previous;
-    bool had_error;
-    bool panic_mode;
-} Parser;
-
 typedef enum
 {
     PREC_NONE,
@@ -35,7 +27,9 @@ typedef enum
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool can_assign);
+typedef struct Parser Parser;
+
+typedef void (*ParseFn)(Parser* parser, bool can_assign);
 
 typedef struct
 {
@@ -83,99 +77,120 @@ typedef struct ClassCompiler
     bool has_super_class;
 } ClassCompiler;
 
-Parser parser;
-Compiler* current_compiler = NULL;
-ClassCompiler* current_class = NULL;
+struct Parser
+{
+    VM* vm;
+    Scanner scanner;
+    Token current;
+    Token previous;
+    bool had_error;
+    bool panic_mode;
+    Compiler* compiler;
+    ClassCompiler* class_compiler;
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // STATIC FUNCTIONS DECLARATIONS, MACROS AND PARSER RULES
 ///////////////////////////////////////////////////////////////////////////////////////
 
-#define current_token_is(TokenType) (parser.current.type == TokenType)
-
-static Chunk* current_chunk();
-static void compiler_init(Compiler* compiler, CodePlacement code_placement);
-static void compiler_scope_begin();
-static void compiler_scope_end();
-static void compiler_local_add(Token name);
-static int compiler_upvalue_add(Compiler* compiler, uint8_t index,
-                                bool is_local);
-static int compiler_local_resolve(Compiler* compiler, Token* name);
-static int compiler_upvalue_resolve(Compiler* compiler, Token* name);
-static void compiler_local_mark_initialized();
-static void compiler_define_variable();
-
-static void raise_error_at(Token* token, const char* message);
-static void raise_error(const char* message);
-static void raise_error_at_current(const char* message);
-static void move_to_next_token();
-static void sync_errors();
-static void expect_token_or_fail(TokenType type, const char* message);
-static bool expect_token(TokenType type);
+#define current_token_is(TokenType) (parser->current.type == TokenType)
+
+static Chunk* current_chunk(Parser* parser);
+static void compiler_init(Parser* parser, Compiler* compiler,
+                          CodePlacement code_placement);
+static void compiler_scope_begin(Parser* parser);
+static void compiler_scope_end(Parser* parser);
+static void compiler_local_add(Parser* parser, Token name);
+static int compiler_upvalue_add(Parser* parser, Compiler* compiler,
+                                uint8_t index, bool is_local);
+static int compiler_local_resolve(Parser* parser, Compiler* compiler,
+                                  Token* name);
+static int compiler_upvalue_resolve(Parser* parser, Compiler* compiler,
+                                    Token* name);
+static void compiler_local_mark_initialized(Parser* parser);
+static void compiler_define_variable(Parser* parser);
+
+static void raise_error_at(Parser* parser, Token* token, const char* message);
+static void raise_error(Parser* parser, const char* message);
+static void raise_error_at_current(Parser* parser, const char* message);
+static void move_to_next_token(Parser* parser);
+static void sync_errors(Parser* parser);
+static void expect_token_or_fail(Parser* parser, TokenType type,
+                                 const char* message);
+static bool expect_token(Parser* parser, TokenType type);
 static ParseRule* get_rule(TokenType type);
 
-static uint8_t constant_make(Value value);
-static uint8_t constant_identifier(Token* name);
+static uint8_t constant_make(Parser* parser, Value value);
+static uint8_t constant_identifier(Parser* parser, Token* name);
 static bool token_identifiers_equal(Token* a, Token* b);
-static void byte_emit(uint8_t byte);
-static void byte_emit_duo(uint8_t byte1, uint8_t byte2);
-static void byte_emit_var_def(uint8_t global);
-static void byte_emit_named_variable(Token name, bool can_assign);
-static void byte_emit_variable(bool can_assign);
-static int byte_emit_jump(uint8_t instruction);
-static void byte_emit_patch_jump(int offset);
-static void byte_emit_loop(int loop_start);
-static void byte_emit_return();
-static void byte_emit_constant(Value value);
-
-static void parse_precedence(Precedence precedence);
-static void parse_grouping(bool can_assign);
-static void parse_binary(bool can_assign);
-static void parse_unary(bool can_assign);
-static void parse_number(bool can_assign);
-static void parse_string(bool can_assign);
-static void parse_literal(bool can_assign);
-static void parse_call(bool can_assign);
-static void parse_dot(bool can_assign);
-static void parse_this(bool can_assign);
-static void parse_super(bool can_assign);
-static void parse_list(bool can_assign);
-static void parse_subscript(bool can_assign);
-
-static void parse_expression();
+static void byte_emit(Parser* parser, uint8_t byte);
+static void byte_emit_duo(Parser* parser, uint8_t byte1, uint8_t byte2);
+static void byte_emit_var_def(Parser* parser, uint8_t global);
+static void byte_emit_named_variable(Parser* parser, Token name,
+                                     bool can_assign);
+static void byte_emit_variable(Parser* parser, bool can_assign);
+static int byte_emit_jump(Parser* parser, uint8_t instruction);
+static void byte_emit_patch_jump(Parser* parser, int offset);
+static void byte_emit_loop(Parser* parser, int loop_start);
+static void byte_emit_return(Parser* parser);
+static void byte_emit_constant(Parser* parser, Value value);
+
+static void parse_precedence(Parser* parser, Precedence precedence);
+static void parse_grouping(Parser* parser, bool can_assign);
+static void parse_binary(Parser* parser, bool can_assign);
+static void parse_unary(Parser* parser, bool can_assign);
+static void parse_number(Parser* parser, bool can_assign);
+static void parse_string(Parser* parser, bool can_assign);
+static void parse_literal(Parser* parser, bool can_assign);
+static void parse_call(Parser* parser, bool can_assign);
+static void parse_dot(Parser* parser, bool can_assign);
+static void parse_this(Parser* parser, bool can_assign);
+static void parse_super(Parser* parser, bool can_assign);
+static void parse_list(Parser* parser, bool can_assign);
+static void parse_map(Parser* parser, bool can_assign);
+static void parse_subscript(Parser* parser, bool can_assign);
+static void parse_yield(Parser* parser, bool can_assign);
+static void parse_resume(Parser* parser, bool can_assign);
+
+static void parse_expression(Parser* parser);
 
 static Token token_make_synthetic(const char* text);
-static uint8_t parse_variable(const char* error_message);
-static uint8_t parse_argument_list();
-static void parse_fun_declaration();
-static void parse_class_method();
-static void parse_class_declaration();
-static void parse_var_declaration();
-static void parse_declaration();
-
-static void parse_and(bool can_assign);
-static void parse_or(bool can_assign);
-
-static void parse_print_statement(bool new_line);
-static void parse_if_statement();
-static void parse_return_statement();
-static void parse_while_statement();
-static void parse_for_statement();
-static void parse_expression_statement();
-static void parse_block();
-static void parse_function(CodePlacement code_placement);
-static void parse_statement();
-
-static ObjFunction* compiler_finalize();
+static uint8_t parse_variable(Parser* parser, const char* error_message);
+static uint8_t parse_argument_list(Parser* parser);
+static void parse_fun_declaration(Parser* parser);
+static void parse_class_method(Parser* parser);
+static void parse_class_declaration(Parser* parser);
+static void parse_var_declaration(Parser* parser);
+static void parse_declaration(Parser* parser);
+
+static void parse_and(Parser* parser, bool can_assign);
+static void parse_or(Parser* parser, bool can_assign);
+
+static void parse_print_statement(Parser* parser, bool new_line);
+static void parse_if_statement(Parser* parser);
+static void parse_return_statement(Parser* parser);
+static void parse_while_statement(Parser* parser);
+static void parse_for_range_body(Parser* parser, uint8_t counter,
+                                 uint8_t limit);
+static bool parse_for_counted(Parser* parser);
+static void parse_for_in(Parser* parser);
+static void parse_for_statement(Parser* parser);
+static void parse_expression_statement(Parser* parser);
+static void parse_block(Parser* parser);
+static void parse_function(Parser* parser, CodePlacement code_placement);
+static void parse_statement(Parser* parser);
+
+static ObjFunction* compiler_finalize(Parser* parser);
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {parse_grouping, parse_call, PREC_CALL},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {parse_map, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
     [TOKEN_LEFT_BRACKET] = {parse_list, parse_subscript, PREC_SUBSCRIPT},
     [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, parse_dot, PREC_CALL},
     [TOKEN_MINUS] = {parse_unary, parse_binary, PREC_TERM},
     [TOKEN_PLUS] = {NULL, parse_binary, PREC_TERM},
@@ -190,6 +205,7 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, parse_binary, PREC_COMPARISON},
     [TOKEN_LESS] = {NULL, parse_binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL] = {NULL, parse_binary, PREC_COMPARISON},
+    [TOKEN_DOT_DOT] = {NULL, NULL, PREC_NONE},
     [TOKEN_IDENTIFIER] = {byte_emit_variable, NULL, PREC_NONE},
     [TOKEN_STRING] = {parse_string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {parse_number, NULL, PREC_NONE},
@@ -200,15 +216,18 @@ ParseRule rules[] = {
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
     [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
     [TOKEN_IF] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IN] = {NULL, NULL, PREC_NONE},
     [TOKEN_NIL] = {parse_literal, NULL, PREC_NONE},
     [TOKEN_OR] = {NULL, parse_or, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RESUME] = {parse_resume, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
     [TOKEN_SUPER] = {parse_super, NULL, PREC_NONE},
     [TOKEN_THIS] = {parse_this, NULL, PREC_NONE},
     [TOKEN_TRUE] = {parse_literal, NULL, PREC_NONE},
     [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_YIELD] = {parse_yield, NULL, PREC_NONE},
     [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
@@ -217,28 +236,30 @@ ParseRule rules[] = {
 // HELPERS
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static Chunk* current_chunk()
+static Chunk* current_chunk(Parser* parser)
 {
-    return &current_compiler->function->chunk;
+    return &parser->compiler->function->chunk;
 }
 
-static void compiler_init(Compiler* compiler, CodePlacement code_placement)
+static void compiler_init(Parser* parser, Compiler* compiler,
+                          CodePlacement code_placement)
 {
-    compiler->enclosing = current_compiler;
+    compiler->enclosing = parser->compiler;
     compiler->function = NULL;
     compiler->code_placement = code_placement;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->function = obj_function_new();
-    current_compiler = compiler;
+    compiler->function = obj_function_new(parser->vm);
+    parser->compiler = compiler;
 
     if (code_placement != CP_MAIN_SCRIPT)
     {
-        current_compiler->function->name =
-            obj_string_cpy(parser.previous.start, parser.previous.length);
+        parser->compiler->function->name =
+            obj_string_cpy(parser->vm, parser->previous.start,
+                           parser->previous.length);
     }
 
-    Local* local = &current_compiler->locals[current_compiler->local_count++];
+    Local* local = &parser->compiler->locals[parser->compiler->local_count++];
     local->depth = 0;
     local->is_captured = false;
 
@@ -254,49 +275,49 @@ static void compiler_init(Compiler* compiler, CodePlacement code_placement)
     }
 }
 
-static void compiler_scope_begin()
+static void compiler_scope_begin(Parser* parser)
 {
-    current_compiler->scope_depth++;
+    parser->compiler->scope_depth++;
 }
 
-static void compiler_scope_end()
+static void compiler_scope_end(Parser* parser)
 {
-    current_compiler->scope_depth--;
+    parser->compiler->scope_depth--;
 
-    while (current_compiler->local_count > 0 &&
-           current_compiler->locals[current_compiler->local_count - 1].depth >
-               current_compiler->scope_depth)
+    while (parser->compiler->local_count > 0 &&
+           parser->compiler->locals[parser->compiler->local_count - 1].depth >
+               parser->compiler->scope_depth)
     {
-        if (current_compiler->locals[current_compiler->local_count - 1]
+        if (parser->compiler->locals[parser->compiler->local_count - 1]
                 .is_captured)
         {
-            byte_emit(OP_CLOSE_UPVALUE);
+            byte_emit(parser, OP_CLOSE_UPVALUE);
         }
         else
         {
-            byte_emit(OP_POP);
+            byte_emit(parser, OP_POP);
         }
 
-        current_compiler->local_count--;
+        parser->compiler->local_count--;
     }
 }
 
-static void compiler_local_add(Token name)
+static void compiler_local_add(Parser* parser, Token name)
 {
-    if (current_compiler->local_count == UINT8_COUNT)
+    if (parser->compiler->local_count == UINT8_COUNT)
     {
-        raise_error("Too many local variables in function.");
+        raise_error(parser, "Too many local variables in function.");
         return;
     }
 
-    Local* local = &current_compiler->locals[current_compiler->local_count++];
+    Local* local = &parser->compiler->locals[parser->compiler->local_count++];
     local->name = name;
     local->depth = -1;
     local->is_captured = false;
 }
 
-static int compiler_upvalue_add(Compiler* compiler, uint8_t index,
-                                bool is_local)
+static int compiler_upvalue_add(Parser* parser, Compiler* compiler,
+                                uint8_t index, bool is_local)
 {
     int upvalue_count = compiler->function->upvalue_count;
 
@@ -308,7 +329,7 @@ static int compiler_upvalue_add(Compiler* compiler, uint8_t index,
 
     if (upvalue_count == UINT8_COUNT)
     {
-        raise_error("Too many closure variables in function.");
+        raise_error(parser, "Too many closure variables in function.");
         return 0;
     }
 
@@ -318,7 +339,8 @@ static int compiler_upvalue_add(Compiler* compiler, uint8_t index,
     return compiler->function->upvalue_count++;
 }
 
-static int compiler_local_resolve(Compiler* compiler, Token* name)
+static int compiler_local_resolve(Parser* parser, Compiler* compiler,
+                                  Token* name)
 {
     for (int i = compiler->local_count - 1; i >= 0; --i)
     {
@@ -328,6 +350,7 @@ static int compiler_local_resolve(Compiler* compiler, Token* name)
             if (local->depth == -1)
             {
                 raise_error(
+                    parser,
                     "Can't read local variable in its own initializer.");
             }
 
@@ -338,64 +361,66 @@ static int compiler_local_resolve(Compiler* compiler, Token* name)
     return -1;
 }
 
-static int compiler_upvalue_resolve(Compiler* compiler, Token* name)
+static int compiler_upvalue_resolve(Parser* parser, Compiler* compiler,
+                                    Token* name)
 {
     if (compiler->enclosing == NULL) return -1;
 
-    int upvalue = compiler_upvalue_resolve(compiler->enclosing, name);
+    int upvalue = compiler_upvalue_resolve(parser, compiler->enclosing, name);
     if (upvalue != -1)
-        return compiler_upvalue_add(compiler, (uint8_t)upvalue, false);
+        return compiler_upvalue_add(parser, compiler, (uint8_t)upvalue, false);
 
-    int local = compiler_local_resolve(compiler->enclosing, name);
+    int local = compiler_local_resolve(parser, compiler->enclosing, name);
     if (local != -1)
 
     {
         compiler->enclosing->locals[local].is_captured = true;
-        return compiler_upvalue_add(compiler, (uint8_t)local, true);
+        return compiler_upvalue_add(parser, compiler, (uint8_t)local, true);
     }
 
     return -1;
 }
 
-static void compiler_local_mark_initialized()
+static void compiler_local_mark_initialized(Parser* parser)
 {
-    if (current_compiler->scope_depth == 0) return;
+    if (parser->compiler->scope_depth == 0) return;
 
-    current_compiler->locals[current_compiler->local_count - 1].depth =
-        current_compiler->scope_depth;
+    parser->compiler->locals[parser->compiler->local_count - 1].depth =
+        parser->compiler->scope_depth;
 }
 
-static void compiler_define_variable()
+static void compiler_define_variable(Parser* parser)
 {
-    if (current_compiler->scope_depth == 0) return;
+    if (parser->compiler->scope_depth == 0) return;
 
-    Token* name = &parser.previous;
+    Token* name = &parser->previous;
 
-    for (int i = current_compiler->local_count - 1; i >= 0; --i)
+    for (int i = parser->compiler->local_count - 1; i >= 0; --i)
     {
-        Local* local = &current_compiler->locals[i];
+        Local* local = &parser->compiler->locals[i];
 
-        if (local->depth != -1 && local->depth < current_compiler->scope_depth)
+        if (local->depth != -1 && local->depth < parser->compiler->scope_depth)
             break;
 
         if (token_identifiers_equal(name, &local->name))
-            raise_error("Already a variable with this name in this scope.");
+            raise_error(parser,
+                        "Already a variable with this name in this scope.");
     }
 
-    compiler_local_add(*name);
+    compiler_local_add(parser, *name);
 }
 
-static void raise_error_at(Token* token, const char* message)
+static void raise_error_at(Parser* parser, Token* token, const char* message)
 {
-    if (parser.panic_mode) return;
+    if (parser->panic_mode) return;
 
-    parser.panic_mode = true;
+    parser->panic_mode = true;
 
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(parser->vm->err, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF)
     {
-        fprintf(stderr, " at end");
+        fprintf(parser->vm->err, " at end");
     }
     else if (token->type == TOKEN_ERROR)
     {
@@ -403,44 +428,44 @@ static void raise_error_at(Token* token, const char* message)
     }
     else
     {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->vm->err, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.had_error = true;
+    fprintf(parser->vm->err, ": %s\n", message);
+    parser->had_error = true;
 }
 
-static void raise_error(const char* message)
+static void raise_error(Parser* parser, const char* message)
 {
-    raise_error_at(&parser.previous, message);
+    raise_error_at(parser, &parser->previous, message);
 }
 
-static void raise_error_at_current(const char* message)
+static void raise_error_at_current(Parser* parser, const char* message)
 {
-    raise_error_at(&parser.current, message);
+    raise_error_at(parser, &parser->current, message);
 }
 
-static void move_to_next_token()
+static void move_to_next_token(Parser* parser)
 {
-    parser.previous = parser.current;
+    parser->previous = parser->current;
 
     while (true)
     {
-        parser.current = scanner_scan_token();
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->current = scanner_scan_token(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
 
-        raise_error_at_current(parser.current.start);
+        raise_error_at_current(parser, parser->current.start);
     }
 }
 
-static void sync_errors()
+static void sync_errors(Parser* parser)
 {
-    parser.panic_mode = false;
+    parser->panic_mode = false;
 
-    while (parser.current.type != TOKEN_EOF)
+    while (parser->current.type != TOKEN_EOF)
     {
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
-        switch (parser.current.type)
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+        switch (parser->current.type)
         {
             case TOKEN_CLASS:
             case TOKEN_FUN:
@@ -455,26 +480,27 @@ static void sync_errors()
             default:; // Do nothing.
         }
 
-        move_to_next_token();
+        move_to_next_token(parser);
     }
 }
 
-static void expect_token_or_fail(TokenType type, const char* message)
+static void expect_token_or_fail(Parser* parser, TokenType type,
+                                 const char* message)
 {
-    if (parser.current.type == type)
+    if (parser->current.type == type)
     {
-        move_to_next_token();
+        move_to_next_token(parser);
         return;
     }
 
-    raise_error_at_current(message);
+    raise_error_at_current(parser, message);
 }
 
-static bool expect_token(TokenType type)
+static bool expect_token(Parser* parser, TokenType type)
 {
     if (!current_token_is(type)) return false;
 
-    move_to_next_token();
+    move_to_next_token(parser);
     return true;
 }
 
@@ -487,22 +513,24 @@ static ParseRule* get_rule(TokenType type)
 // EMITTERS
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static uint8_t constant_make(Value value)
+static uint8_t constant_make(Parser* parser, Value value)
 {
-    int constant = chunk_constant_add(current_chunk(), value);
+    int constant =
+        chunk_constant_add(parser->vm, current_chunk(parser), value);
     if (constant > UINT8_MAX)
     {
-        raise_error("Too many constants in one chunk.");
+        raise_error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
     return (uint8_t)constant;
 }
 
-static uint8_t constant_identifier(Token* name)
+static uint8_t constant_identifier(Parser* parser, Token* name)
 {
     return constant_make(
-        value_make_obj(obj_string_cpy(name->start, name->length)));
+        parser,
+        value_make_obj(obj_string_cpy(parser->vm, name->start, name->length)));
 }
 
 static bool token_identifiers_equal(Token* a, Token* b)
@@ -512,203 +540,206 @@ static bool token_identifiers_equal(Token* a, Token* b)
     return memcmp(a->start, b->start, a->length) == 0;
 }
 
-static void byte_emit(uint8_t byte)
+static void byte_emit(Parser* parser, uint8_t byte)
 {
-    chunk_write(current_chunk(), byte, parser.previous.line);
+    chunk_write(parser->vm, current_chunk(parser), byte, parser->previous.line);
 }
 
-static void byte_emit_duo(uint8_t byte1, uint8_t byte2)
+static void byte_emit_duo(Parser* parser, uint8_t byte1, uint8_t byte2)
 {
-    byte_emit(byte1);
-    byte_emit(byte2);
+    byte_emit(parser, byte1);
+    byte_emit(parser, byte2);
 }
 
-static void byte_emit_var_def(uint8_t global)
+static void byte_emit_var_def(Parser* parser, uint8_t global)
 {
-    if (current_compiler->scope_depth > 0)
+    if (parser->compiler->scope_depth > 0)
     {
-        compiler_local_mark_initialized();
+        compiler_local_mark_initialized(parser);
         return;
     }
 
-    byte_emit_duo(OP_DEFINE_GLOBAL, global);
+    byte_emit_duo(parser, OP_DEFINE_GLOBAL, global);
 }
 
-static void byte_emit_named_variable(Token name, bool can_assign)
+static void byte_emit_named_variable(Parser* parser, Token name,
+                                     bool can_assign)
 {
     uint8_t get_op, set_op;
-    int arg = compiler_local_resolve(current_compiler, &name);
+    int arg = compiler_local_resolve(parser, parser->compiler, &name);
 
     if (arg != -1)
     {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
     }
-    else if ((arg = compiler_upvalue_resolve(current_compiler, &name)) != -1)
+    else if ((arg = compiler_upvalue_resolve(parser, parser->compiler,
+                                             &name)) != -1)
     {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
     }
     else
     {
-        arg = constant_identifier(&name);
+        arg = constant_identifier(parser, &name);
         get_op = OP_GET_GLOBAL;
         set_op = OP_SET_GLOBAL;
     }
 
-    if (can_assign && expect_token(TOKEN_EQUAL))
+    if (can_assign && expect_token(parser, TOKEN_EQUAL))
     {
-        parse_expression();
+        parse_expression(parser);
 
-        byte_emit_duo(set_op, (uint8_t)arg);
+        byte_emit_duo(parser, set_op, (uint8_t)arg);
 
         return;
     }
 
-    byte_emit_duo(get_op, (uint8_t)arg);
+    byte_emit_duo(parser, get_op, (uint8_t)arg);
 }
 
-static void byte_emit_variable(bool can_assign)
+static void byte_emit_variable(Parser* parser, bool can_assign)
 {
-    byte_emit_named_variable(parser.previous, can_assign);
+    byte_emit_named_variable(parser, parser->previous, can_assign);
 }
 
-static int byte_emit_jump(uint8_t instruction)
+static int byte_emit_jump(Parser* parser, uint8_t instruction)
 {
-    byte_emit(instruction);
-    byte_emit(0xFF);
-    byte_emit(0xFF);
+    byte_emit(parser, instruction);
+    byte_emit(parser, 0xFF);
+    byte_emit(parser, 0xFF);
 
-    return current_chunk()->count - 2;
+    return current_chunk(parser)->count - 2;
 }
 
-static void byte_emit_patch_jump(int offset)
+static void byte_emit_patch_jump(Parser* parser, int offset)
 {
     // -2 to adjust for the bytecode for the jump offset itself.
-    int jump = current_chunk()->count - offset - 2;
+    int jump = current_chunk(parser)->count - offset - 2;
 
-    if (jump > UINT16_MAX) raise_error("Too much code to jump over.");
+    if (jump > UINT16_MAX) raise_error(parser, "Too much code to jump over.");
 
-    current_chunk()->code[offset] = (jump >> 8) & 0xFF;
-    current_chunk()->code[offset + 1] = jump & 0xFF;
+    current_chunk(parser)->code[offset] = (jump >> 8) & 0xFF;
+    current_chunk(parser)->code[offset + 1] = jump & 0xFF;
 }
 
-static void byte_emit_loop(int loop_start)
+static void byte_emit_loop(Parser* parser, int loop_start)
 {
-    byte_emit(OP_LOOP);
+    byte_emit(parser, OP_LOOP);
 
-    int offset = current_chunk()->count - loop_start + 2;
-    if (offset > UINT16_MAX) raise_error("Loop body too large.");
+    int offset = current_chunk(parser)->count - loop_start + 2;
+    if (offset > UINT16_MAX) raise_error(parser, "Loop body too large.");
 
-    byte_emit((offset >> 8) & 0xFF);
-    byte_emit(offset & 0xFF);
+    byte_emit(parser, (offset >> 8) & 0xFF);
+    byte_emit(parser, offset & 0xFF);
 }
 
-static void byte_emit_return()
+static void byte_emit_return(Parser* parser)
 {
-    if (current_compiler->code_placement == CP_INITIALIZER)
+    if (parser->compiler->code_placement == CP_INITIALIZER)
     {
-        byte_emit_duo(OP_GET_LOCAL, 0);
+        byte_emit_duo(parser, OP_GET_LOCAL, 0);
     }
     else
     {
-        byte_emit(OP_NIL);
+        byte_emit(parser, OP_NIL);
     }
 
-    byte_emit(OP_RETURN);
+    byte_emit(parser, OP_RETURN);
 }
 
-static void byte_emit_constant(Value value)
+static void byte_emit_constant(Parser* parser, Value value)
 {
-    byte_emit_duo(OP_CONSTANT, constant_make(value));
+    byte_emit_duo(parser, OP_CONSTANT, constant_make(parser, value));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // PARSING FUNCTIONS
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static void parse_precedence(Precedence precedence)
+static void parse_precedence(Parser* parser, Precedence precedence)
 {
-    move_to_next_token();
-    ParseFn parse_prefix = get_rule(parser.previous.type)->prefix;
+    move_to_next_token(parser);
+    ParseFn parse_prefix = get_rule(parser->previous.type)->prefix;
     if (parse_prefix == NULL)
     {
-        raise_error("Expect expression.");
+        raise_error(parser, "Expect expression.");
         return;
     }
 
     bool can_assign = precedence <= PREC_ASSIGNMENT;
-    parse_prefix(can_assign);
+    parse_prefix(parser, can_assign);
 
-    while (precedence <= get_rule(parser.current.type)->precedence)
+    while (precedence <= get_rule(parser->current.type)->precedence)
     {
-        move_to_next_token();
-        ParseFn parse_infix = get_rule(parser.previous.type)->infix;
-        parse_infix(can_assign);
+        move_to_next_token(parser);
+        ParseFn parse_infix = get_rule(parser->previous.type)->infix;
+        parse_infix(parser, can_assign);
     }
 
-    if (can_assign && expect_token(TOKEN_EQUAL))
+    if (can_assign && expect_token(parser, TOKEN_EQUAL))
     {
-        raise_error("Invalid assignment target.");
+        raise_error(parser, "Invalid assignment target.");
     }
 }
 
-static void parse_grouping(bool can_assign)
+static void parse_grouping(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    parse_expression();
-    expect_token_or_fail(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    parse_expression(parser);
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after expression.");
 }
 
-static void parse_binary(bool can_assign)
+static void parse_binary(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    TokenType operator_type = parser.previous.type;
+    TokenType operator_type = parser->previous.type;
     ParseRule* rule = get_rule(operator_type);
-    parse_precedence((Precedence)(rule->precedence + 1));
+    parse_precedence(parser, (Precedence)(rule->precedence + 1));
 
     switch (operator_type)
     {
         case TOKEN_BANG_EQUAL:
-            byte_emit_duo(OP_EQUAL, OP_NOT);
+            byte_emit_duo(parser, OP_EQUAL, OP_NOT);
             break;
 
         case TOKEN_EQUAL_EQUAL:
-            byte_emit(OP_EQUAL);
+            byte_emit(parser, OP_EQUAL);
             break;
 
         case TOKEN_GREATER:
-            byte_emit(OP_GREATER);
+            byte_emit(parser, OP_GREATER);
             break;
 
         case TOKEN_GREATER_EQUAL:
-            byte_emit_duo(OP_LESS, OP_NOT);
+            byte_emit_duo(parser, OP_LESS, OP_NOT);
             break;
 
         case TOKEN_LESS:
-            byte_emit(OP_LESS);
+            byte_emit(parser, OP_LESS);
             break;
 
         case TOKEN_LESS_EQUAL:
-            byte_emit_duo(OP_GREATER, OP_NOT);
+            byte_emit_duo(parser, OP_GREATER, OP_NOT);
             break;
 
         case TOKEN_PLUS:
-            byte_emit(OP_ADD);
+            byte_emit(parser, OP_ADD);
             break;
 
         case TOKEN_MINUS:
-            byte_emit(OP_SUBTRACT);
+            byte_emit(parser, OP_SUBTRACT);
             break;
 
         case TOKEN_STAR:
-            byte_emit(OP_MULTIPLY);
+            byte_emit(parser, OP_MULTIPLY);
             break;
 
         case TOKEN_SLASH:
-            byte_emit(OP_DIVIDE);
+            byte_emit(parser, OP_DIVIDE);
             break;
 
         default:
@@ -716,24 +747,24 @@ static void parse_binary(bool can_assign)
     }
 }
 
-static void parse_unary(bool can_assign)
+static void parse_unary(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    TokenType operator_type = parser.previous.type;
+    TokenType operator_type = parser->previous.type;
 
     // Compile the operand.
-    parse_precedence(PREC_UNARY);
+    parse_precedence(parser, PREC_UNARY);
 
     // Emit the operator instruction.
     switch (operator_type)
     {
         case TOKEN_BANG:
-            byte_emit(OP_NOT);
+            byte_emit(parser, OP_NOT);
             break;
 
         case TOKEN_MINUS:
-            byte_emit(OP_NEGATE);
+            byte_emit(parser, OP_NEGATE);
             break;
 
         default:
@@ -741,30 +772,30 @@ static void parse_unary(bool can_assign)
     }
 }
 
-static void parse_number(bool can_assign)
+static void parse_number(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    double value = strtod(parser.previous.start, NULL);
-    byte_emit_constant(value_make_number(value));
+    double value = strtod(parser->previous.start, NULL);
+    byte_emit_constant(parser, value_make_number(value));
 }
 
-static void parse_literal(bool can_assign)
+static void parse_literal(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    switch (parser.previous.type)
+    switch (parser->previous.type)
     {
         case TOKEN_FALSE:
-            byte_emit(OP_FALSE);
+            byte_emit(parser, OP_FALSE);
             break;
 
         case TOKEN_NIL:
-            byte_emit(OP_NIL);
+            byte_emit(parser, OP_NIL);
             break;
 
         case TOKEN_TRUE:
-            byte_emit(OP_TRUE);
+            byte_emit(parser, OP_TRUE);
             break;
 
         default:
@@ -772,91 +803,94 @@ static void parse_literal(bool can_assign)
     }
 }
 
-static void parse_string(bool can_assign)
+static void parse_string(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    byte_emit_constant(value_make_obj(
-        obj_string_cpy(parser.previous.start + 1, parser.previous.length - 2)));
+    byte_emit_constant(parser, value_make_obj(
+        obj_string_cpy(parser->vm, parser->previous.start + 1,
+                       parser->previous.length - 2)));
 }
 
-static void parse_call(bool can_assign)
+static void parse_call(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    uint8_t argc = parse_argument_list();
-    byte_emit_duo(OP_CALL, argc);
+    uint8_t argc = parse_argument_list(parser);
+    byte_emit_duo(parser, OP_CALL, argc);
 }
 
-static void parse_dot(bool can_assign)
+static void parse_dot(Parser* parser, bool can_assign)
 {
-    expect_token_or_fail(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = constant_identifier(&parser.previous);
+    expect_token_or_fail(parser, TOKEN_IDENTIFIER,
+                         "Expect property name after '.'.");
+    uint8_t name = constant_identifier(parser, &parser->previous);
 
-    if (can_assign && expect_token(TOKEN_EQUAL))
+    if (can_assign && expect_token(parser, TOKEN_EQUAL))
     {
-        parse_expression();
-        byte_emit_duo(OP_SET_PROPERTY, name);
+        parse_expression(parser);
+        byte_emit_duo(parser, OP_SET_PROPERTY, name);
     }
-    else if (expect_token(TOKEN_LEFT_PAREN))
+    else if (expect_token(parser, TOKEN_LEFT_PAREN))
     {
-        uint8_t argc = parse_argument_list();
-        byte_emit_duo(OP_INVOKE, name);
-        byte_emit(argc);
+        uint8_t argc = parse_argument_list(parser);
+        byte_emit_duo(parser, OP_INVOKE, name);
+        byte_emit(parser, argc);
     }
     else
     {
-        byte_emit_duo(OP_GET_PROPERTY, name);
+        byte_emit_duo(parser, OP_GET_PROPERTY, name);
     }
 }
 
-static void parse_this(bool can_assign)
+static void parse_this(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    if (current_class == NULL)
+    if (parser->class_compiler == NULL)
     {
-        raise_error("Can't use 'this' outside of a class method.");
+        raise_error(parser, "Can't use 'this' outside of a class method.");
         return;
     }
 
-    byte_emit_variable(false);
+    byte_emit_variable(parser, false);
 }
 
-static void parse_super(bool can_assign)
+static void parse_super(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    if (current_class == NULL)
+    if (parser->class_compiler == NULL)
     {
-        raise_error("Can't use 'super' outside of a class.");
+        raise_error(parser, "Can't use 'super' outside of a class.");
     }
-    else if (!current_class->has_super_class)
+    else if (!parser->class_compiler->has_super_class)
     {
-        raise_error("Can't use 'super' in a class with no superclass.");
+        raise_error(parser, "Can't use 'super' in a class with no superclass.");
     }
 
-    expect_token_or_fail(TOKEN_DOT, "Expect '.' after 'super'.");
-    expect_token_or_fail(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = constant_identifier(&parser.previous);
+    expect_token_or_fail(parser, TOKEN_DOT, "Expect '.' after 'super'.");
+    expect_token_or_fail(parser, TOKEN_IDENTIFIER,
+                         "Expect superclass method name.");
+    uint8_t name = constant_identifier(parser, &parser->previous);
 
-    byte_emit_named_variable(token_make_synthetic("this"), false);
+    byte_emit_named_variable(parser, token_make_synthetic("this"), false);
 
-    if (expect_token(TOKEN_LEFT_PAREN))
+    if (expect_token(parser, TOKEN_LEFT_PAREN))
     {
-        uint8_t argc = parse_argument_list();
-        byte_emit_named_variable(token_make_synthetic("super"), false);
-        byte_emit_duo(OP_SUPER_INVOKE, name);
-        byte_emit(argc);
+        uint8_t argc = parse_argument_list(parser);
+        byte_emit_named_variable(parser, token_make_synthetic("super"), false);
+        byte_emit_duo(parser, OP_SUPER_INVOKE, name);
+        byte_emit(parser, argc);
     }
     else
     {
-        byte_emit_named_variable(token_make_synthetic("super"), false);
-        byte_emit_duo(OP_GET_SUPER, name);
+        byte_emit_named_variable(parser, token_make_synthetic("super"), false);
+        byte_emit_duo(parser, OP_GET_SUPER, name);
     }
 }
 
-static void parse_list(bool can_assign)
+static void parse_list(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
@@ -868,39 +902,110 @@ static void parse_list(bool can_assign)
             // Trailing comma case
             if (current_token_is(TOKEN_RIGHT_BRACKET)) break;
 
-            parse_precedence(PREC_OR);
+            parse_precedence(parser, PREC_OR);
 
             if (item_count == UINT8_COUNT)
                 raise_error(
+                    parser,
                     "Cannot have more than 256 items in a list literal.");
 
             item_count++;
-        } while (expect_token(TOKEN_COMMA));
+        } while (expect_token(parser, TOKEN_COMMA));
+    }
+
+    expect_token_or_fail(parser, TOKEN_RIGHT_BRACKET,
+                         "Expect ']' after list literal.");
+
+    byte_emit_duo(parser, OP_LIST_INIT, item_count);
+}
+
+// `{key: value, ...}`, a brace opening a statement starts a block instead.
+static void parse_map(Parser* parser, bool can_assign)
+{
+    (void)can_assign;
+
+    int entry_count = 0;
+    if (!current_token_is(TOKEN_RIGHT_BRACE))
+    {
+        do
+        {
+            // Trailing comma case
+            if (current_token_is(TOKEN_RIGHT_BRACE)) break;
+
+            parse_precedence(parser, PREC_OR);
+            expect_token_or_fail(parser, TOKEN_COLON,
+                                 "Expect ':' after map key.");
+            parse_precedence(parser, PREC_OR);
+
+            if (entry_count == UINT8_MAX)
+                raise_error(
+                    parser,
+                    "Cannot have more than 255 entries in a map literal.");
+
+            entry_count++;
+        } while (expect_token(parser, TOKEN_COMMA));
     }
 
-    expect_token_or_fail(TOKEN_RIGHT_BRACKET, "Expect ']' after list literal.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_BRACE,
+                         "Expect '}' after map literal.");
 
-    byte_emit_duo(OP_LIST_INIT, item_count);
+    byte_emit_duo(parser, OP_MAP_INIT, entry_count);
 }
 
-static void parse_subscript(bool can_assign)
+static void parse_subscript(Parser* parser, bool can_assign)
 {
-    parse_precedence(PREC_OR);
-    expect_token_or_fail(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+    parse_precedence(parser, PREC_OR);
+    expect_token_or_fail(parser, TOKEN_RIGHT_BRACKET,
+                         "Expect ']' after index.");
 
-    if (can_assign && expect_token(TOKEN_EQUAL))
+    if (can_assign && expect_token(parser, TOKEN_EQUAL))
     {
-        parse_expression();
-        byte_emit(OP_LIST_SETIDX);
+        parse_expression(parser);
+        byte_emit(parser, OP_LIST_SETIDX);
         return;
     }
 
-    byte_emit(OP_LIST_GETIDX);
+    byte_emit(parser, OP_LIST_GETIDX);
+}
+
+static void parse_yield(Parser* parser, bool can_assign)
+{
+    (void)can_assign;
+
+    // A bare `yield` hands nil back to the resumer.
+    if (current_token_is(TOKEN_SEMICOLON) ||
+        current_token_is(TOKEN_RIGHT_PAREN) ||
+        current_token_is(TOKEN_RIGHT_BRACKET) ||
+        current_token_is(TOKEN_RIGHT_BRACE) || current_token_is(TOKEN_COMMA) ||
+        current_token_is(TOKEN_COLON))
+    {
+        byte_emit(parser, OP_NIL);
+    }
+    else
+    {
+        parse_expression(parser);
+    }
+
+    byte_emit(parser, OP_YIELD);
+}
+
+static void parse_resume(Parser* parser, bool can_assign)
+{
+    (void)can_assign;
+
+    expect_token_or_fail(parser, TOKEN_LEFT_PAREN,
+                         "Expect '(' after 'resume'.");
+    uint8_t argc = parse_argument_list(parser);
+
+    if (argc < 1 || argc > 2)
+        raise_error(parser, "Expect a fiber and an optional value to resume.");
+
+    byte_emit_duo(parser, OP_RESUME, argc);
 }
 
-static void parse_expression()
+static void parse_expression(Parser* parser)
 {
-    parse_precedence(PREC_ASSIGNMENT);
+    parse_precedence(parser, PREC_ASSIGNMENT);
 }
 
 static Token token_make_synthetic(const char* text)
@@ -912,17 +1017,17 @@ static Token token_make_synthetic(const char* text)
     return token;
 }
 
-static uint8_t parse_variable(const char* error_message)
+static uint8_t parse_variable(Parser* parser, const char* error_message)
 {
-    expect_token_or_fail(TOKEN_IDENTIFIER, error_message);
+    expect_token_or_fail(parser, TOKEN_IDENTIFIER, error_message);
 
-    compiler_define_variable();
-    if (current_compiler->scope_depth > 0) return 0;
+    compiler_define_variable(parser);
+    if (parser->compiler->scope_depth > 0) return 0;
 
-    return constant_identifier(&parser.previous);
+    return constant_identifier(parser, &parser->previous);
 }
 
-static uint8_t parse_argument_list()
+static uint8_t parse_argument_list(Parser* parser)
 {
     uint8_t argc = 0;
 
@@ -930,394 +1035,571 @@ static uint8_t parse_argument_list()
     {
         do
         {
-            parse_expression();
+            parse_expression(parser);
 
             if (argc == 255)
             {
-                raise_error("Can't have more than 255 arguments.");
+                raise_error(parser, "Can't have more than 255 arguments.");
             }
 
             argc++;
-        } while (expect_token(TOKEN_COMMA));
+        } while (expect_token(parser, TOKEN_COMMA));
     }
 
-    expect_token_or_fail(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after arguments.");
 
     return argc;
 }
 
-static void parse_fun_declaration()
+static void parse_fun_declaration(Parser* parser)
 {
-    uint8_t global = parse_variable("Expect function name.");
-    compiler_local_mark_initialized();
-    parse_function(CP_FUNCTION);
-    byte_emit_var_def(global);
+    uint8_t global = parse_variable(parser, "Expect function name.");
+    compiler_local_mark_initialized(parser);
+    parse_function(parser, CP_FUNCTION);
+    byte_emit_var_def(parser, global);
 }
 
-static void parse_class_method()
+static void parse_class_method(Parser* parser)
 {
-    expect_token_or_fail(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = constant_identifier(&parser.previous);
+    expect_token_or_fail(parser, TOKEN_IDENTIFIER, "Expect method name.");
+    uint8_t constant = constant_identifier(parser, &parser->previous);
 
     CodePlacement code_placement = CP_METHOD;
 
-    if (parser.previous.length == 4 &&
-        memcmp(parser.previous.start, "init", 4) == 0)
+    if (parser->previous.length == 4 &&
+        memcmp(parser->previous.start, "init", 4) == 0)
     {
         code_placement = CP_INITIALIZER;
     }
 
-    parse_function(code_placement);
-    byte_emit_duo(OP_METHOD, constant);
+    parse_function(parser, code_placement);
+    byte_emit_duo(parser, OP_METHOD, constant);
 }
 
-static void parse_class_declaration()
+static void parse_class_declaration(Parser* parser)
 {
-    expect_token_or_fail(TOKEN_IDENTIFIER, "Expect class name.");
-    Token class_name = parser.previous;
-    uint8_t name_constant = constant_identifier(&parser.previous);
-    compiler_define_variable();
+    expect_token_or_fail(parser, TOKEN_IDENTIFIER, "Expect class name.");
+    Token class_name = parser->previous;
+    uint8_t name_constant = constant_identifier(parser, &parser->previous);
+    compiler_define_variable(parser);
 
-    byte_emit_duo(OP_CLASS, name_constant);
-    byte_emit_var_def(name_constant);
+    byte_emit_duo(parser, OP_CLASS, name_constant);
+    byte_emit_var_def(parser, name_constant);
 
     ClassCompiler class_compiler;
     class_compiler.has_super_class = false;
-    class_compiler.enclosing = current_class;
-    current_class = &class_compiler;
+    class_compiler.enclosing = parser->class_compiler;
+    parser->class_compiler = &class_compiler;
 
-    if (expect_token(TOKEN_LESS))
+    if (expect_token(parser, TOKEN_LESS))
     {
-        expect_token_or_fail(TOKEN_IDENTIFIER, "Expect superclass name.");
-        byte_emit_variable(false);
+        expect_token_or_fail(parser, TOKEN_IDENTIFIER,
+                             "Expect superclass name.");
+        byte_emit_variable(parser, false);
 
-        if (token_identifiers_equal(&class_name, &parser.previous))
+        if (token_identifiers_equal(&class_name, &parser->previous))
         {
-            raise_error("A class can't inherit from itself.");
+            raise_error(parser, "A class can't inherit from itself.");
         }
 
-        compiler_scope_begin();
-        compiler_local_add(token_make_synthetic("super"));
-        byte_emit_var_def(0);
+        compiler_scope_begin(parser);
+        compiler_local_add(parser, token_make_synthetic("super"));
+        byte_emit_var_def(parser, 0);
 
-        byte_emit_named_variable(class_name, false);
-        byte_emit(OP_INHERIT);
+        byte_emit_named_variable(parser, class_name, false);
+        byte_emit(parser, OP_INHERIT);
         class_compiler.has_super_class = true;
     }
 
-    byte_emit_named_variable(class_name, false);
-    expect_token_or_fail(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    byte_emit_named_variable(parser, class_name, false);
+    expect_token_or_fail(parser, TOKEN_LEFT_BRACE,
+                         "Expect '{' before class body.");
 
     while (!current_token_is(TOKEN_RIGHT_BRACE) && !current_token_is(TOKEN_EOF))
-        parse_class_method();
+        parse_class_method(parser);
 
-    expect_token_or_fail(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
-    byte_emit(OP_POP);
+    expect_token_or_fail(parser, TOKEN_RIGHT_BRACE,
+                         "Expect '}' after class body.");
+    byte_emit(parser, OP_POP);
 
     if (class_compiler.has_super_class)
     {
-        compiler_scope_end();
+        compiler_scope_end(parser);
     }
 
-    current_class = current_class->enclosing;
+    parser->class_compiler = parser->class_compiler->enclosing;
 }
 
-static void parse_var_declaration()
+static void parse_var_declaration(Parser* parser)
 {
-    uint8_t global = parse_variable("Expect variable name.");
+    uint8_t global = parse_variable(parser, "Expect variable name.");
 
-    if (expect_token(TOKEN_EQUAL))
+    if (expect_token(parser, TOKEN_EQUAL))
     {
-        parse_expression();
+        parse_expression(parser);
     }
     else
     {
-        byte_emit(OP_NIL);
+        byte_emit(parser, OP_NIL);
     }
 
-    expect_token_or_fail(TOKEN_SEMICOLON,
+    expect_token_or_fail(parser, TOKEN_SEMICOLON,
                          "Expect ';' after variable declaration.");
 
-    byte_emit_var_def(global);
+    byte_emit_var_def(parser, global);
 }
 
-static void parse_declaration()
+static void parse_declaration(Parser* parser)
 {
-    if (expect_token(TOKEN_CLASS))
+    if (expect_token(parser, TOKEN_CLASS))
     {
-        parse_class_declaration();
+        parse_class_declaration(parser);
     }
-    else if (expect_token(TOKEN_FUN))
+    else if (expect_token(parser, TOKEN_FUN))
     {
-        parse_fun_declaration();
+        parse_fun_declaration(parser);
     }
-    else if (expect_token(TOKEN_VAR))
+    else if (expect_token(parser, TOKEN_VAR))
     {
-        parse_var_declaration();
+        parse_var_declaration(parser);
     }
     else
     {
-        parse_statement();
+        parse_statement(parser);
     }
 
-    if (parser.panic_mode) sync_errors();
+    if (parser->panic_mode) sync_errors(parser);
 }
 
-static void parse_and(bool can_assign)
+static void parse_and(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    int end_jump = byte_emit_jump(OP_JUMP_IF_FALSE);
+    int end_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
 
-    byte_emit(OP_POP);
+    byte_emit(parser, OP_POP);
 
-    parse_precedence(PREC_AND);
+    parse_precedence(parser, PREC_AND);
 
-    byte_emit((uint8_t)end_jump);
+    byte_emit(parser, (uint8_t)end_jump);
 }
 
-static void parse_or(bool can_assign)
+static void parse_or(Parser* parser, bool can_assign)
 {
     (void)can_assign;
 
-    int else_jump = byte_emit_jump(OP_JUMP_IF_FALSE);
-    int end_jump = byte_emit_jump(OP_JUMP);
+    int else_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
+    int end_jump = byte_emit_jump(parser, OP_JUMP);
 
-    byte_emit_patch_jump(else_jump);
-    byte_emit(OP_POP);
+    byte_emit_patch_jump(parser, else_jump);
+    byte_emit(parser, OP_POP);
 
-    parse_precedence(PREC_OR);
+    parse_precedence(parser, PREC_OR);
 
-    byte_emit_patch_jump(end_jump);
+    byte_emit_patch_jump(parser, end_jump);
 }
 
-static void parse_print_statement(bool new_line)
+static void parse_print_statement(Parser* parser, bool new_line)
 {
-    parse_expression();
-    expect_token_or_fail(TOKEN_SEMICOLON, "Expect ';' after value.");
+    parse_expression(parser);
+    expect_token_or_fail(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
 
-    byte_emit(new_line ? OP_PRINTLN : OP_PRINT);
+    byte_emit(parser, new_line ? OP_PRINTLN : OP_PRINT);
 }
 
-static void parse_if_statement()
+static void parse_if_statement(Parser* parser)
 {
-    expect_token_or_fail(TOKEN_LEFT_PAREN, " Expect '(' after 'if'.");
+    expect_token_or_fail(parser, TOKEN_LEFT_PAREN, " Expect '(' after 'if'.");
 
-    parse_expression();
+    parse_expression(parser);
 
-    expect_token_or_fail(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after condition.");
 
-    int then_jump = byte_emit_jump(OP_JUMP_IF_FALSE);
-    byte_emit(OP_POP);
+    int then_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
+    byte_emit(parser, OP_POP);
 
-    parse_statement();
+    parse_statement(parser);
 
-    int else_jump = byte_emit_jump(OP_JUMP);
+    int else_jump = byte_emit_jump(parser, OP_JUMP);
 
-    byte_emit_patch_jump(then_jump);
-    byte_emit(OP_POP);
+    byte_emit_patch_jump(parser, then_jump);
+    byte_emit(parser, OP_POP);
 
-    if (expect_token(TOKEN_ELSE)) parse_statement();
+    if (expect_token(parser, TOKEN_ELSE)) parse_statement(parser);
 
-    byte_emit_patch_jump(else_jump);
+    byte_emit_patch_jump(parser, else_jump);
 }
 
-static void parse_return_statement()
+static void parse_return_statement(Parser* parser)
 {
-    if (current_compiler->code_placement == CP_MAIN_SCRIPT)
+    if (parser->compiler->code_placement == CP_MAIN_SCRIPT)
     {
-        raise_error("Can't return from top-level code.");
+        raise_error(parser, "Can't return from top-level code.");
     }
 
-    if (expect_token(TOKEN_SEMICOLON))
+    if (expect_token(parser, TOKEN_SEMICOLON))
     {
-        byte_emit_return();
+        byte_emit_return(parser);
         return;
     }
 
-    if (current_compiler->code_placement == CP_INITIALIZER)
+    if (parser->compiler->code_placement == CP_INITIALIZER)
     {
-        raise_error("Can't return a value from an initializer.");
+        raise_error(parser, "Can't return a value from an initializer.");
     }
 
-    parse_expression();
-    expect_token_or_fail(TOKEN_SEMICOLON, "Expect ';' after return value.");
-    byte_emit(OP_RETURN);
+    parse_expression(parser);
+    expect_token_or_fail(parser, TOKEN_SEMICOLON,
+                         "Expect ';' after return value.");
+    byte_emit(parser, OP_RETURN);
 }
 
-static void parse_while_statement()
+static void parse_while_statement(Parser* parser)
 {
-    int loop_start = current_chunk()->count;
+    int loop_start = current_chunk(parser)->count;
 
-    expect_token_or_fail(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expect_token_or_fail(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
 
-    parse_expression();
+    parse_expression(parser);
 
-    expect_token_or_fail(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after condition.");
 
-    int exit_jump = byte_emit_jump(OP_JUMP_IF_FALSE);
-    byte_emit(OP_POP);
+    int exit_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
+    byte_emit(parser, OP_POP);
 
-    parse_statement();
+    parse_statement(parser);
 
-    byte_emit_loop(loop_start);
+    byte_emit_loop(parser, loop_start);
 
-    byte_emit_patch_jump(exit_jump);
-    byte_emit(OP_POP);
+    byte_emit_patch_jump(parser, exit_jump);
+    byte_emit(parser, OP_POP);
 }
 
-static void parse_for_statement()
+// Compiles the body of a loop counting the local at `counter` up by one for
+// as long as it stays below the local at `limit`. Only the first test is
+// compiled the usual way, each later increment, test and jump back is a
+// single OP_FOR_RANGE.
+static void parse_for_range_body(Parser* parser, uint8_t counter,
+                                 uint8_t limit)
 {
-    compiler_scope_begin();
+    byte_emit_duo(parser, OP_GET_LOCAL, counter);
+    byte_emit_duo(parser, OP_GET_LOCAL, limit);
+    byte_emit(parser, OP_LESS);
+
+    int exit_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
+    byte_emit(parser, OP_POP); // Condition.
+
+    int body_start = current_chunk(parser)->count;
+    parse_statement(parser);
+
+    byte_emit(parser, OP_FOR_RANGE);
+    byte_emit_duo(parser, counter, limit);
+
+    int offset = current_chunk(parser)->count - body_start + 2;
+    if (offset > UINT16_MAX) raise_error(parser, "Loop body too large.");
 
-    expect_token_or_fail(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    byte_emit(parser, (offset >> 8) & 0xFF);
+    byte_emit(parser, offset & 0xFF);
 
-    if (expect_token(TOKEN_SEMICOLON))
+    int end_jump = byte_emit_jump(parser, OP_JUMP);
+    byte_emit_patch_jump(parser, exit_jump);
+    byte_emit(parser, OP_POP); // Condition.
+    byte_emit_patch_jump(parser, end_jump);
+}
+
+// Right after `for (var i = start;`, takes `i < limit; i = i + 1)` with the
+// limit a number or another local and compiles the rest of the loop with
+// parse_for_range_body. Anything else is left alone for the general loop.
+static bool parse_for_counted(Parser* parser)
+{
+    Token tokens[10];
+    Scanner scanner = parser->scanner;
+
+    tokens[0] = parser->current;
+    for (int i = 1; i < 10; ++i) tokens[i] = scanner_scan_token(&scanner);
+
+    static const TokenType pattern[10] = {
+        TOKEN_IDENTIFIER, TOKEN_LESS,  TOKEN_NUMBER,     TOKEN_SEMICOLON,
+        TOKEN_IDENTIFIER, TOKEN_EQUAL, TOKEN_IDENTIFIER, TOKEN_PLUS,
+        TOKEN_NUMBER,     TOKEN_RIGHT_PAREN};
+
+    for (int i = 0; i < 10; ++i)
+    {
+        bool limit_local = i == 2 && tokens[i].type == TOKEN_IDENTIFIER;
+        if (tokens[i].type != pattern[i] && !limit_local) return false;
+    }
+
+    int counter = parser->compiler->local_count - 1;
+    Token* name = &parser->compiler->locals[counter].name;
+
+    if (!token_identifiers_equal(&tokens[0], name) ||
+        !token_identifiers_equal(&tokens[4], name) ||
+        !token_identifiers_equal(&tokens[6], name) ||
+        strtod(tokens[8].start, NULL) != 1)
+        return false;
+
+    int limit = -1;
+    if (tokens[2].type == TOKEN_IDENTIFIER)
+    {
+        limit = compiler_local_resolve(parser, parser->compiler, &tokens[2]);
+        if (limit == -1 || limit == counter) return false;
+    }
+
+    for (int i = 0; i < 10; ++i) move_to_next_token(parser);
+
+    if (limit == -1)
+    {
+        // A hidden local holds a constant limit.
+        double number = strtod(tokens[2].start, NULL);
+        byte_emit_constant(parser, value_make_number(number));
+        compiler_local_add(parser, token_make_synthetic(""));
+        compiler_local_mark_initialized(parser);
+        limit = parser->compiler->local_count - 1;
+    }
+
+    parse_for_range_body(parser, (uint8_t)counter, (uint8_t)limit);
+    return true;
+}
+
+// `for (i in start..end)` counts i from start up to but not including end,
+// both evaluated once before the loop. `for (x in iterable)` steps x through
+// the items of a list, the keys of a map, the characters of a string or the
+// values a fiber yields, with one OP_ITER_NEXT per item.
+static void parse_for_in(Parser* parser)
+{
+    move_to_next_token(parser);
+    Token name = parser->previous;
+    expect_token_or_fail(parser, TOKEN_IN, "Expect 'in' after loop variable.");
+
+    parse_expression(parser);
+
+    if (expect_token(parser, TOKEN_DOT_DOT))
+    {
+        parse_expression(parser);
+        expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                             "Expect ')' after for clauses.");
+
+        compiler_local_add(parser, name);
+        compiler_local_mark_initialized(parser);
+        uint8_t counter = (uint8_t)(parser->compiler->local_count - 1);
+
+        // The end, hidden from the body.
+        compiler_local_add(parser, token_make_synthetic(""));
+        compiler_local_mark_initialized(parser);
+        uint8_t limit = (uint8_t)(parser->compiler->local_count - 1);
+
+        parse_for_range_body(parser, counter, limit);
+        return;
+    }
+
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after for clauses.");
+
+    // The iterable and a cursor into it, hidden from the body, then x.
+    compiler_local_add(parser, token_make_synthetic(""));
+    compiler_local_mark_initialized(parser);
+    uint8_t iterator = (uint8_t)(parser->compiler->local_count - 1);
+
+    byte_emit_constant(parser, value_make_number(0));
+    compiler_local_add(parser, token_make_synthetic(""));
+    compiler_local_mark_initialized(parser);
+
+    byte_emit(parser, OP_NIL);
+    compiler_local_add(parser, name);
+    compiler_local_mark_initialized(parser);
+
+    // The test sits after the body so it also jumps back.
+    int next_jump = byte_emit_jump(parser, OP_JUMP);
+    int body_start = current_chunk(parser)->count;
+
+    parse_statement(parser);
+
+    byte_emit_patch_jump(parser, next_jump);
+    byte_emit_duo(parser, OP_ITER_NEXT, iterator);
+
+    int offset = current_chunk(parser)->count - body_start + 2;
+    if (offset > UINT16_MAX) raise_error(parser, "Loop body too large.");
+
+    byte_emit(parser, (offset >> 8) & 0xFF);
+    byte_emit(parser, offset & 0xFF);
+}
+
+static void parse_for_statement(Parser* parser)
+{
+    compiler_scope_begin(parser);
+
+    expect_token_or_fail(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+
+    Scanner ahead = parser->scanner;
+    if (current_token_is(TOKEN_IDENTIFIER) &&
+        scanner_scan_token(&ahead).type == TOKEN_IN)
+    {
+        parse_for_in(parser);
+        compiler_scope_end(parser);
+        return;
+    }
+
+    if (expect_token(parser, TOKEN_SEMICOLON))
     {
         // No initializer
     }
-    else if (expect_token(TOKEN_VAR))
+    else if (expect_token(parser, TOKEN_VAR))
     {
-        parse_var_declaration();
+        parse_var_declaration(parser);
+
+        if (parse_for_counted(parser))
+        {
+            compiler_scope_end(parser);
+            return;
+        }
     }
     else
     {
-        parse_expression_statement();
+        parse_expression_statement(parser);
     }
 
-    int loop_start = current_chunk()->count;
+    int loop_start = current_chunk(parser)->count;
 
     int exit_jump = -1;
-    if (!expect_token(TOKEN_SEMICOLON))
+    if (!expect_token(parser, TOKEN_SEMICOLON))
     {
-        parse_expression();
-        expect_token_or_fail(TOKEN_SEMICOLON,
+        parse_expression(parser);
+        expect_token_or_fail(parser, TOKEN_SEMICOLON,
                              "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        exit_jump = byte_emit_jump(OP_JUMP_IF_FALSE);
-        byte_emit(OP_POP); // Condition.
+        exit_jump = byte_emit_jump(parser, OP_JUMP_IF_FALSE);
+        byte_emit(parser, OP_POP); // Condition.
     }
 
-    if (!expect_token(TOKEN_RIGHT_PAREN))
+    if (!expect_token(parser, TOKEN_RIGHT_PAREN))
     {
-        int body_jump = byte_emit_jump(OP_JUMP);
-        int increment_start = current_chunk()->count;
+        int body_jump = byte_emit_jump(parser, OP_JUMP);
+        int increment_start = current_chunk(parser)->count;
 
-        parse_expression();
-        byte_emit(OP_POP);
+        parse_expression(parser);
+        byte_emit(parser, OP_POP);
 
-        expect_token_or_fail(TOKEN_RIGHT_PAREN,
+        expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
                              "Expect ')' after for clauses.");
 
-        byte_emit_loop(loop_start);
+        byte_emit_loop(parser, loop_start);
         loop_start = increment_start;
-        byte_emit_patch_jump(body_jump);
+        byte_emit_patch_jump(parser, body_jump);
     }
 
-    parse_statement();
-    byte_emit_loop(loop_start);
+    parse_statement(parser);
+    byte_emit_loop(parser, loop_start);
 
     if (exit_jump != -1)
     {
-        byte_emit_patch_jump(exit_jump);
-        byte_emit(OP_POP); // Condition.
+        byte_emit_patch_jump(parser, exit_jump);
+        byte_emit(parser, OP_POP); // Condition.
     }
 
-    compiler_scope_end();
+    compiler_scope_end(parser);
 }
 
-static void parse_expression_statement()
+static void parse_expression_statement(Parser* parser)
 {
-    parse_expression();
-    expect_token_or_fail(TOKEN_SEMICOLON, "Expect ';' after expression.");
+    parse_expression(parser);
+    expect_token_or_fail(parser, TOKEN_SEMICOLON,
+                         "Expect ';' after expression.");
 
-    byte_emit(OP_POP);
+    byte_emit(parser, OP_POP);
 }
 
-static void parse_block()
+static void parse_block(Parser* parser)
 {
     while (!current_token_is(TOKEN_RIGHT_BRACE) && !current_token_is(TOKEN_EOF))
-        parse_declaration();
+        parse_declaration(parser);
 
-    expect_token_or_fail(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void parse_function(CodePlacement code_placement)
+static void parse_function(Parser* parser, CodePlacement code_placement)
 {
     Compiler compiler;
-    compiler_init(&compiler, code_placement);
+    compiler_init(parser, &compiler, code_placement);
 
-    compiler_scope_begin();
+    compiler_scope_begin(parser);
 
-    expect_token_or_fail(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    expect_token_or_fail(parser, TOKEN_LEFT_PAREN,
+                         "Expect '(' after function name.");
 
     if (!current_token_is(TOKEN_RIGHT_PAREN))
     {
         do
         {
-            current_compiler->function->arity++;
-            if (current_compiler->function->arity > 255)
-                raise_error_at_current("Can't have more than 255 parameters.");
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255)
+                raise_error_at_current(parser,
+                                       "Can't have more than 255 parameters.");
 
-            uint8_t constant = parse_variable("Expect parameter name.");
-            byte_emit_var_def(constant);
+            uint8_t constant = parse_variable(parser, "Expect parameter name.");
+            byte_emit_var_def(parser, constant);
 
-        } while (expect_token(TOKEN_COMMA));
+        } while (expect_token(parser, TOKEN_COMMA));
     }
 
-    expect_token_or_fail(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
-    expect_token_or_fail(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    expect_token_or_fail(parser, TOKEN_RIGHT_PAREN,
+                         "Expect ')' after parameters.");
+    expect_token_or_fail(parser, TOKEN_LEFT_BRACE,
+                         "Expect '{' before function body.");
 
-    parse_block();
+    parse_block(parser);
 
-    ObjFunction* function = compiler_finalize();
-    byte_emit_duo(OP_CLOSURE, constant_make(value_make_obj(function)));
+    ObjFunction* function = compiler_finalize(parser);
+    byte_emit_duo(parser, OP_CLOSURE, constant_make(parser,
+                                                    value_make_obj(function)));
 
     for (int i = 0; i < function->upvalue_count; ++i)
     {
-        byte_emit(compiler.upvalues[i].is_local ? 1 : 0);
-        byte_emit(compiler.upvalues[i].index);
+        byte_emit(parser, compiler.upvalues[i].is_local ? 1 : 0);
+        byte_emit(parser, compiler.upvalues[i].index);
     }
 }
 
-static void parse_statement()
+static void parse_statement(Parser* parser)
 {
-    if (expect_token(TOKEN_PRINTLN))
+    if (expect_token(parser, TOKEN_PRINTLN))
     {
-        parse_print_statement(true);
+        parse_print_statement(parser, true);
     }
-    else if (expect_token(TOKEN_PRINT))
+    else if (expect_token(parser, TOKEN_PRINT))
     {
-        parse_print_statement(false);
+        parse_print_statement(parser, false);
     }
-    else if (expect_token(TOKEN_FOR))
+    else if (expect_token(parser, TOKEN_FOR))
     {
-        parse_for_statement();
+        parse_for_statement(parser);
     }
-    else if (expect_token(TOKEN_IF))
+    else if (expect_token(parser, TOKEN_IF))
     {
-        parse_if_statement();
+        parse_if_statement(parser);
     }
-    else if (expect_token(TOKEN_RETURN))
+    else if (expect_token(parser, TOKEN_RETURN))
     {
-        parse_return_statement();
+        parse_return_statement(parser);
     }
-    else if (expect_token(TOKEN_WHILE))
+    else if (expect_token(parser, TOKEN_WHILE))
     {
-        parse_while_statement();
+        parse_while_statement(parser);
     }
-    else if (expect_token(TOKEN_LEFT_BRACE))
+    else if (expect_token(parser, TOKEN_LEFT_BRACE))
     {
-        compiler_scope_begin();
+        compiler_scope_begin(parser);
 
-        parse_block();
+        parse_block(parser);
 
-        compiler_scope_end();
+        compiler_scope_end(parser);
     }
     else
     {
-        parse_expression_statement();
+        parse_expression_statement(parser);
     }
 }
 
@@ -1325,54 +1607,75 @@ static void parse_statement()
 // COMPILATION
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static ObjFunction* compiler_finalize()
+static ObjFunction* compiler_finalize(Parser* parser)
 {
-    byte_emit_return();
+    byte_emit_return(parser);
 
-    ObjFunction* function = current_compiler->function;
+    ObjFunction* function = parser->compiler->function;
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.had_error)
+    if (!parser->had_error)
     {
-        chunk_disassemble(current_chunk(), function->name != NULL
+        chunk_disassemble(current_chunk(parser), function->name != NULL
                                                ? function->name->chars
                                                : "<Main Body>");
     }
 #endif
 
-    current_compiler = current_compiler->enclosing;
+    parser->compiler = parser->compiler->enclosing;
 
     return function;
 }
 
-ObjFunction* compile(const char* source)
+ObjFunction* compile(VM* vm, const char* source)
 {
-    scanner_init(source);
-
-    Compiler compiler;
-    compiler_init(&compiler, CP_MAIN_SCRIPT);
-
+    Parser parser;
+    parser.vm = vm;
+    parser.compiler = NULL;
+    parser.class_compiler = NULL;
     parser.had_error = false;
     parser.panic_mode = false;
+    scanner_init(&parser.scanner, source);
 
-    move_to_next_token();
+    vm->parser = &parser;
 
-    while (!expect_token(TOKEN_EOF))
+    Compiler compiler;
+    compiler_init(&parser, &compiler, CP_MAIN_SCRIPT);
+
+    move_to_next_token(&parser);
+
+    while (!expect_token(&parser, TOKEN_EOF))
     {
-        parse_declaration();
+        parse_declaration(&parser);
     }
 
-    ObjFunction* function = compiler_finalize();
+    ObjFunction* function = compiler_finalize(&parser);
+
+    vm->parser = NULL;
 
     return parser.had_error ? NULL : function;
 }
 
-void gc_mark_compiler_roots()
+void gc_mark_compiler_roots(VM* vm)
 {
-    Compiler* compiler = current_compiler;
+    if (vm->parser == NULL) return;
+
+    Compiler* compiler = vm->parser->compiler;
     while (compiler != NULL)
     {
-        gc_mark_obj((Obj*)compiler->function);
+        gc_mark_obj(vm, (Obj*)compiler->function);
         compiler = compiler->enclosing;
     }
 }
+
+void gc_forward_compiler_roots(VM* vm)
+{
+    if (vm->parser == NULL) return;
+
+    for (Compiler* compiler = vm->parser->compiler; compiler != NULL;
+         compiler = compiler->enclosing)
+    {
+        compiler->function =
+            (ObjFunction*)heap_forward((Obj*)compiler->function);
+    }
+}
@@ -4,7 +4,8 @@
 #include "object.h"
 #include "vm.h"
 
-ObjFunction* compile(const char* source);
-void gc_mark_compiler_roots();
+ObjFunction* compile(VM* vm, const char* source);
+void gc_mark_compiler_roots(VM* vm);
+void gc_forward_compiler_roots(VM* vm);
 
 #endif // CLOX_COMPILER_H_
@@ -18,7 +18,7 @@ static int instruction_constant(const char* name, Chunk* chunk, int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
-    value_print(chunk->constants.values[constant]);
+    value_print(stdout, chunk->constants.values[constant]);
     puts("'");
 
     return offset + 2;
@@ -29,7 +29,7 @@ static int instruction_invoke(const char* name, Chunk* chunk, int offset)
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argc = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argc, constant);
-    value_print(chunk->constants.values[constant]);
+    value_print(stdout, chunk->constants.values[constant]);
     puts("'");
 
     return offset + 3;
@@ -58,6 +58,29 @@ static int instruction_jump(const char* name, int sign, Chunk* chunk,
     return offset + 3;
 }
 
+static int instruction_for_range(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t counter = chunk->code[offset + 1];
+    uint8_t limit = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+    jump |= chunk->code[offset + 4];
+
+    printf("%-16s %4d %4d %4d -> %d\n", name, counter, limit, offset,
+           offset + 5 - jump);
+    return offset + 5;
+}
+
+static int instruction_iter_next(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t iterator = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+
+    printf("%-16s %4d %4d -> %d\n", name, iterator, offset,
+           offset + 4 - jump);
+    return offset + 4;
+}
+
 int instruction_disassemble(Chunk* chunk, int offset)
 {
     printf("%04d ", offset);
@@ -175,7 +198,7 @@ int instruction_disassemble(Chunk* chunk, int offset)
             offset++;
             uint8_t constant = chunk->code[offset++];
             printf("%-16s %4d ", "OP_CLOSURE", constant);
-            value_print(chunk->constants.values[constant]);
+            value_print(stdout, chunk->constants.values[constant]);
             printf("\n");
 
             ObjFunction* function =
@@ -208,6 +231,12 @@ int instruction_disassemble(Chunk* chunk, int offset)
         case OP_RETURN:
             return instruction_simple("OP_RETURN", offset);
 
+        case OP_YIELD:
+            return instruction_simple("OP_YIELD", offset);
+
+        case OP_RESUME:
+            return instruction_byte("OP_RESUME", chunk, offset);
+
         case OP_CLASS:
             return instruction_constant("OP_CLASS", chunk, offset);
 
@@ -217,8 +246,163 @@ int instruction_disassemble(Chunk* chunk, int offset)
         case OP_METHOD:
             return instruction_constant("OP_METHOD", chunk, offset);
 
+        case OP_MAP_INIT:
+            return instruction_byte("OP_MAP_INIT", chunk, offset);
+
+        case OP_FOR_RANGE:
+            return instruction_for_range("OP_FOR_RANGE", chunk, offset);
+
+        case OP_ITER_NEXT:
+            return instruction_iter_next("OP_ITER_NEXT", chunk, offset);
+
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
-}
\ No newline at end of file
+}
+
+const char* opcode_name(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case OP_CONSTANT:
+            return "OP_CONSTANT";
+
+        case OP_NIL:
+            return "OP_NIL";
+
+        case OP_TRUE:
+            return "OP_TRUE";
+
+        case OP_FALSE:
+            return "OP_FALSE";
+
+        case OP_POP:
+            return "OP_POP";
+
+        case OP_GET_LOCAL:
+            return "OP_GET_LOCAL";
+
+        case OP_SET_LOCAL:
+            return "OP_SET_LOCAL";
+
+        case OP_GET_GLOBAL:
+            return "OP_GET_GLOBAL";
+
+        case OP_DEFINE_GLOBAL:
+            return "OP_DEFINE_GLOBAL";
+
+        case OP_SET_GLOBAL:
+            return "OP_SET_GLOBAL";
+
+        case OP_GET_UPVALUE:
+            return "OP_GET_UPVALUE";
+
+        case OP_SET_UPVALUE:
+            return "OP_SET_UPVALUE";
+
+        case OP_GET_PROPERTY:
+            return "OP_GET_PROPERTY";
+
+        case OP_SET_PROPERTY:
+            return "OP_SET_PROPERTY";
+
+        case OP_GET_SUPER:
+            return "OP_GET_SUPER";
+
+        case OP_EQUAL:
+            return "OP_EQUAL";
+
+        case OP_GREATER:
+            return "OP_GREATER";
+
+        case OP_LESS:
+            return "OP_LESS";
+
+        case OP_ADD:
+            return "OP_ADD";
+
+        case OP_SUBTRACT:
+            return "OP_SUBTRACT";
+
+        case OP_MULTIPLY:
+            return "OP_MULTIPLY";
+
+        case OP_DIVIDE:
+            return "OP_DIVIDE";
+
+        case OP_NOT:
+            return "OP_NOT";
+
+        case OP_NEGATE:
+            return "OP_NEGATE";
+
+        case OP_PRINT:
+            return "OP_PRINT";
+
+        case OP_PRINTLN:
+            return "OP_PRINTLN";
+
+        case OP_JUMP:
+            return "OP_JUMP";
+
+        case OP_JUMP_IF_FALSE:
+            return "OP_JUMP_IF_FALSE";
+
+        case OP_LOOP:
+            return "OP_LOOP";
+
+        case OP_CALL:
+            return "OP_CALL";
+
+        case OP_INVOKE:
+            return "OP_INVOKE";
+
+        case OP_SUPER_INVOKE:
+            return "OP_SUPER_INVOKE";
+
+        case OP_CLOSURE:
+            return "OP_CLOSURE";
+
+        case OP_CLOSE_UPVALUE:
+            return "OP_CLOSE_UPVALUE";
+
+        case OP_LIST_INIT:
+            return "OP_LIST_INIT";
+
+        case OP_LIST_GETIDX:
+            return "OP_LIST_GETIDX";
+
+        case OP_LIST_SETIDX:
+            return "OP_LIST_SETIDX";
+
+        case OP_RETURN:
+            return "OP_RETURN";
+
+        case OP_YIELD:
+            return "OP_YIELD";
+
+        case OP_RESUME:
+            return "OP_RESUME";
+
+        case OP_CLASS:
+            return "OP_CLASS";
+
+        case OP_INHERIT:
+            return "OP_INHERIT";
+
+        case OP_METHOD:
+            return "OP_METHOD";
+
+        case OP_MAP_INIT:
+            return "OP_MAP_INIT";
+
+        case OP_FOR_RANGE:
+            return "OP_FOR_RANGE";
+
+        case OP_ITER_NEXT:
+            return "OP_ITER_NEXT";
+    }
+
+    return "OP_UNKNOWN";
+}
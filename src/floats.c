@@ -0,0 +1,168 @@
+#include "floats.h"
+#include "simd.h"
+#include "vm.h"
+
+static bool args_count_check(VM* vm, int argc, int count)
+{
+    if (argc == count) return true;
+
+    vm_raise_runtime_error(vm, "insufficient arguments, need %d got=%d", count,
+                           argc);
+    return false;
+}
+
+static bool arg_float_array(VM* vm, Value value, ObjFloatArray** out_array)
+{
+    if (!obj_is_float_array(value))
+    {
+        vm_raise_runtime_error(vm, "argument must be a FloatArray.");
+        return false;
+    }
+
+    *out_array = obj_as_float_array(value);
+    return true;
+}
+
+static bool arg_number(VM* vm, Value value, double* out_number)
+{
+    if (!value_is_number(value))
+    {
+        vm_raise_runtime_error(vm, "argument must be a number.");
+        return false;
+    }
+
+    *out_number = value_as_number(value);
+    return true;
+}
+
+static bool same_length_check(VM* vm, ObjFloatArray* a, ObjFloatArray* b)
+{
+    if (a->count == b->count) return true;
+
+    vm_raise_runtime_error(vm, "FloatArray lengths differ, %d and %d.",
+                           a->count, b->count);
+    return false;
+}
+
+static bool not_empty_check(VM* vm, ObjFloatArray* array)
+{
+    if (array->count > 0) return true;
+
+    vm_raise_runtime_error(vm, "FloatArray is empty.");
+    return false;
+}
+
+static bool native_fn_float_array_new(VM* vm, int argc, Value* args)
+{
+    if (!args_count_check(vm, argc, 1)) return false;
+
+    if (obj_is_list(args[0]))
+    {
+        ObjList* list = obj_as_list(args[0]);
+        for (int i = 0; i < list->count; ++i)
+        {
+            if (value_is_number(list->items[i])) continue;
+
+            vm_raise_runtime_error(vm, "FloatArray items must be numbers.");
+            return false;
+        }
+
+        // The list stays on the stack in args[0] while the array allocates.
+        ObjFloatArray* array = obj_float_array_new(vm, list->count);
+        for (int i = 0; i < list->count; ++i)
+            array->items[i] = value_as_number(list->items[i]);
+
+        native_return(value_make_obj(array));
+    }
+
+    double count = 0;
+    if (!value_is_number(args[0]) || (count = value_as_number(args[0])) < 0 ||
+        count > INT32_MAX || count != (int)count)
+    {
+        vm_raise_runtime_error(
+            vm, "FloatArray needs a list or a non-negative integer length.");
+        return false;
+    }
+
+    native_return(value_make_obj(obj_float_array_new(vm, (int)count)));
+}
+
+static bool native_fn_sum(VM* vm, int argc, Value* args)
+{
+    ObjFloatArray* array;
+    if (!args_count_check(vm, argc, 1) || !arg_float_array(vm, args[0], &array))
+        return false;
+
+    native_return(value_make_number(simd_sum(array->items, array->count)));
+}
+
+static bool native_fn_dot(VM* vm, int argc, Value* args)
+{
+    ObjFloatArray* a;
+    ObjFloatArray* b;
+    if (!args_count_check(vm, argc, 2) || !arg_float_array(vm, args[0], &a) ||
+        !arg_float_array(vm, args[1], &b) || !same_length_check(vm, a, b))
+        return false;
+
+    native_return(value_make_number(simd_dot(a->items, b->items, a->count)));
+}
+
+// scale(array, factor) multiplies every item in place.
+static bool native_fn_scale(VM* vm, int argc, Value* args)
+{
+    ObjFloatArray* array;
+    double factor;
+    if (!args_count_check(vm, argc, 2) ||
+        !arg_float_array(vm, args[0], &array) ||
+        !arg_number(vm, args[1], &factor))
+        return false;
+
+    simd_scale(array->items, array->count, factor);
+    native_return(value_make_nil());
+}
+
+// axpy(alpha, x, y) adds alpha * x to y in place.
+static bool native_fn_axpy(VM* vm, int argc, Value* args)
+{
+    double alpha;
+    ObjFloatArray* x;
+    ObjFloatArray* y;
+    if (!args_count_check(vm, argc, 3) || !arg_number(vm, args[0], &alpha) ||
+        !arg_float_array(vm, args[1], &x) ||
+        !arg_float_array(vm, args[2], &y) || !same_length_check(vm, x, y))
+        return false;
+
+    simd_axpy(alpha, x->items, y->items, x->count);
+    native_return(value_make_nil());
+}
+
+static bool native_fn_min(VM* vm, int argc, Value* args)
+{
+    ObjFloatArray* array;
+    if (!args_count_check(vm, argc, 1) ||
+        !arg_float_array(vm, args[0], &array) || !not_empty_check(vm, array))
+        return false;
+
+    native_return(value_make_number(simd_min(array->items, array->count)));
+}
+
+static bool native_fn_max(VM* vm, int argc, Value* args)
+{
+    ObjFloatArray* array;
+    if (!args_count_check(vm, argc, 1) ||
+        !arg_float_array(vm, args[0], &array) || !not_empty_check(vm, array))
+        return false;
+
+    native_return(value_make_number(simd_max(array->items, array->count)));
+}
+
+void floats_define_natives(VM* vm)
+{
+    vm_define_native_fn(vm, "FloatArray", native_fn_float_array_new);
+    vm_define_native_fn(vm, "sum", native_fn_sum);
+    vm_define_native_fn(vm, "dot", native_fn_dot);
+    vm_define_native_fn(vm, "scale", native_fn_scale);
+    vm_define_native_fn(vm, "axpy", native_fn_axpy);
+    vm_define_native_fn(vm, "min", native_fn_min);
+    vm_define_native_fn(vm, "max", native_fn_max);
+}
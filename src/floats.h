@@ -0,0 +1,11 @@
+#ifndef CLOX_FLOATS_H_
+#define CLOX_FLOATS_H_
+
+#include "general.h"
+#include "object.h"
+
+// Natives creating FloatArrays and running the SIMD kernels over them:
+// FloatArray(count or list), sum, dot, scale, axpy, min and max.
+void floats_define_natives(VM* vm);
+
+#endif // CLOX_FLOATS_H_
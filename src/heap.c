@@ -0,0 +1,395 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap.h"
+
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)
+
+typedef struct Slot
+{
+    struct Slot* next;
+} Slot;
+
+struct Page
+{
+    Page* next;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    bool evacuated;
+    Slot* free;
+
+    uint64_t live[HEAP_BITMAP_WORDS];
+    atomic_uint_least64_t marks[HEAP_BITMAP_WORDS];
+};
+
+#define page_of(object)                                                        \
+    ((Page*)((uintptr_t)(object) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1)))
+
+#define PAGE_SLOTS_OFFSET                                                      \
+    ((sizeof(Page) + HEAP_GRANULE - 1) / HEAP_GRANULE * HEAP_GRANULE)
+
+#define page_slots(page) ((char*)(page) + PAGE_SLOTS_OFFSET)
+
+static int class_index_of(size_t size)
+{
+    int class_index = (int)((size + HEAP_GRANULE - 1) / HEAP_GRANULE) - 1;
+
+    if (class_index >= HEAP_CLASS_COUNT)
+    {
+        fprintf(stderr, "Objects of %zu bytes do not fit a heap slot.\n",
+                size);
+        exit(1);
+    }
+
+    return class_index;
+}
+
+static uint32_t page_slot_index(Page* page, void* slot)
+{
+    return (uint32_t)(((char*)slot - page_slots(page)) / page->slot_size);
+}
+
+static Page* page_new(int class_index)
+{
+    Page* page = (Page*)aligned_alloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE);
+    if (page == NULL) exit(1);
+
+    page->next = NULL;
+    page->slot_size = (uint32_t)((class_index + 1) * HEAP_GRANULE);
+    page->slot_count =
+        (uint32_t)((HEAP_PAGE_SIZE - PAGE_SLOTS_OFFSET) / page->slot_size);
+    page->evacuated = false;
+    page->free = NULL;
+
+    memset(page->live, 0, sizeof(page->live));
+    for (int i = 0; i < HEAP_BITMAP_WORDS; ++i) atomic_init(&page->marks[i], 0);
+
+    // Threaded back to front so slots are handed out in address order.
+    for (uint32_t i = page->slot_count; i > 0; --i)
+    {
+        Slot* slot = (Slot*)(page_slots(page) + (i - 1) * page->slot_size);
+        slot->next = page->free;
+        page->free = slot;
+    }
+
+    return page;
+}
+
+static int page_marked_count(Page* page)
+{
+    int count = 0;
+    for (int word = 0; word < HEAP_BITMAP_WORDS; ++word)
+    {
+        count += __builtin_popcountll(
+            atomic_load_explicit(&page->marks[word], memory_order_relaxed));
+    }
+
+    return count;
+}
+
+// Where an evacuated object keeps the address of its copy, past the header.
+#define page_forward_slot(object)                                              \
+    ((Obj**)((char*)(object) + HEAP_GRANULE / 2))
+
+// Returns whether any object of the page survived.
+static bool page_sweep(VM* vm, Page* page, HeapFreeFn free_fn)
+{
+    int survivors = 0;
+
+    for (int word = 0; word < HEAP_BITMAP_WORDS; ++word)
+    {
+        uint64_t marks =
+            atomic_load_explicit(&page->marks[word], memory_order_relaxed);
+        uint64_t dead = page->live[word] & ~marks;
+
+        while (dead != 0)
+        {
+            int bit = __builtin_ctzll(dead);
+            dead &= dead - 1;
+
+            Slot* slot =
+                (Slot*)(page_slots(page) + (word * 64 + bit) * page->slot_size);
+            free_fn(vm, (Obj*)slot);
+
+            slot->next = page->free;
+            page->free = slot;
+        }
+
+        page->live[word] = marks;
+        atomic_store_explicit(&page->marks[word], 0, memory_order_relaxed);
+        survivors += __builtin_popcountll(marks);
+    }
+
+    return survivors > 0;
+}
+
+void heap_init(Heap* heap)
+{
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        heap->pages[i] = NULL;
+        heap->current[i] = NULL;
+    }
+}
+
+Obj* heap_alloc(Heap* heap, size_t size)
+{
+    int class_index = class_index_of(size);
+
+    Page* page = heap->current[class_index];
+    while (page != NULL && page->free == NULL) page = page->next;
+
+    if (page == NULL)
+    {
+        page = page_new(class_index);
+        page->next = heap->pages[class_index];
+        heap->pages[class_index] = page;
+    }
+
+    heap->current[class_index] = page;
+
+    Slot* slot = page->free;
+    page->free = slot->next;
+
+    uint32_t index = page_slot_index(page, slot);
+    page->live[index / 64] |= UINT64_C(1) << (index % 64);
+
+    return (Obj*)slot;
+}
+
+size_t heap_slot_size(size_t size)
+{
+    return (size_t)(class_index_of(size) + 1) * HEAP_GRANULE;
+}
+
+size_t heap_obj_size(Obj* object)
+{
+    return page_of(object)->slot_size;
+}
+
+bool heap_is_marked(Obj* object)
+{
+    Page* page = page_of(object);
+    uint32_t index = page_slot_index(page, object);
+
+    uint64_t word =
+        atomic_load_explicit(&page->marks[index / 64], memory_order_relaxed);
+    return (word >> (index % 64)) & 1;
+}
+
+bool heap_mark(Obj* object)
+{
+    Page* page = page_of(object);
+    uint32_t index = page_slot_index(page, object);
+    uint64_t bit = UINT64_C(1) << (index % 64);
+    atomic_uint_least64_t* word = &page->marks[index / 64];
+
+    // Plain load first, most objects are reached more than once.
+    if (atomic_load_explicit(word, memory_order_relaxed) & bit) return false;
+
+    return !(atomic_fetch_or_explicit(word, bit, memory_order_relaxed) & bit);
+}
+
+void heap_sweep(VM* vm, Heap* heap, HeapFreeFn free_fn)
+{
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        Page** link = &heap->pages[i];
+
+        while (*link != NULL)
+        {
+            Page* page = *link;
+
+            if (page_sweep(vm, page, free_fn))
+            {
+                link = &page->next;
+            }
+            else
+            {
+                *link = page->next;
+                free(page);
+            }
+        }
+
+        heap->current[i] = heap->pages[i];
+    }
+}
+
+void heap_merge(Heap* heap, Heap* from)
+{
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        if (from->pages[i] != NULL)
+        {
+            Page* last = from->pages[i];
+            while (last->next != NULL) last = last->next;
+
+            last->next = heap->pages[i];
+            heap->pages[i] = from->pages[i];
+        }
+
+        heap->current[i] = heap->pages[i];
+        from->pages[i] = NULL;
+        from->current[i] = NULL;
+    }
+}
+
+void heap_occupancy(Heap* heap, size_t* used, size_t* capacity)
+{
+    *used = 0;
+    *capacity = 0;
+
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        for (Page* page = heap->pages[i]; page != NULL; page = page->next)
+        {
+            for (int word = 0; word < HEAP_BITMAP_WORDS; ++word)
+            {
+                *used += (size_t)__builtin_popcountll(page->live[word]) *
+                         page->slot_size;
+            }
+
+            *capacity += (size_t)page->slot_count * page->slot_size;
+        }
+    }
+}
+
+int heap_evacuate(Heap* heap, Heap* evacuated, HeapMoveFn move_fn)
+{
+    int count = 0;
+
+    // Pick the pages first, so no copy lands on a page being emptied.
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        Page** link = &heap->pages[i];
+
+        while (*link != NULL)
+        {
+            Page* page = *link;
+
+            if ((uint32_t)page_marked_count(page) * 2 >= page->slot_count)
+            {
+                link = &page->next;
+                continue;
+            }
+
+            *link = page->next;
+            page->evacuated = true;
+            page->next = evacuated->pages[i];
+            evacuated->pages[i] = page;
+            count++;
+        }
+
+        heap->current[i] = heap->pages[i];
+    }
+
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        for (Page* page = evacuated->pages[i]; page != NULL; page = page->next)
+        {
+            for (int word = 0; word < HEAP_BITMAP_WORDS; ++word)
+            {
+                uint64_t marks = atomic_load_explicit(&page->marks[word],
+                                                      memory_order_relaxed);
+
+                while (marks != 0)
+                {
+                    int bit = __builtin_ctzll(marks);
+                    marks &= marks - 1;
+
+                    Obj* object = (Obj*)(page_slots(page) +
+                                         (word * 64 + bit) * page->slot_size);
+                    Obj* copy = heap_alloc(heap, page->slot_size);
+
+                    memcpy(copy, object, page->slot_size);
+                    heap_mark(copy);
+                    move_fn(object, copy);
+
+                    // The object's fields were copied, its slot can hold the
+                    // forwarding address now.
+                    *page_forward_slot(object) = copy;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+Obj* heap_forward(Obj* object)
+{
+    if (object == NULL || !page_of(object)->evacuated) return object;
+    return *page_forward_slot(object);
+}
+
+void heap_release(VM* vm, Heap* evacuated, HeapFreeFn free_fn)
+{
+    for (int i = 0; i < HEAP_CLASS_COUNT; ++i)
+    {
+        while (evacuated->pages[i] != NULL)
+        {
+            Page* page = evacuated->pages[i];
+            evacuated->pages[i] = page->next;
+
+            // Marked objects live on in their copies, only the dead ones
+            // still own anything.
+            for (int word = 0; word < HEAP_BITMAP_WORDS; ++word)
+            {
+                uint64_t dead =
+                    page->live[word] & ~atomic_load_explicit(
+                                           &page->marks[word],
+                                           memory_order_relaxed);
+
+                while (dead != 0)
+                {
+                    int bit = __builtin_ctzll(dead);
+                    dead &= dead - 1;
+                    free_fn(vm, (Obj*)(page_slots(page) +
+                                       (word * 64 + bit) * page->slot_size));
+                }
+            }
+
+            free(page);
+        }
+
+        evacuated->current[i] = NULL;
+    }
+}
+
+void heap_iter_init(HeapIter* iter, Heap* heap)
+{
+    iter->heap = heap;
+    iter->class_index = 0;
+    iter->page = heap->pages[0];
+    iter->slot = 0;
+}
+
+Obj* heap_iter_next(HeapIter* iter)
+{
+    while (iter->class_index < HEAP_CLASS_COUNT)
+    {
+        Page* page = iter->page;
+
+        if (page == NULL)
+        {
+            if (++iter->class_index < HEAP_CLASS_COUNT)
+                iter->page = iter->heap->pages[iter->class_index];
+            continue;
+        }
+
+        while ((uint32_t)iter->slot < page->slot_count)
+        {
+            int index = iter->slot++;
+            if (page->live[index / 64] & (UINT64_C(1) << (index % 64)))
+                return (Obj*)(page_slots(page) + index * page->slot_size);
+        }
+
+        iter->page = page->next;
+        iter->slot = 0;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef CLOX_HEAP_H_
+#define CLOX_HEAP_H_
+
+#include "general.h"
+#include "value.h"
+
+// Objects live in HEAP_PAGE_SIZE aligned pages, each page holding slots of a
+// single size class. A page keeps the live and mark bits of its slots in side
+// bitmaps, so neither costs the object header anything and the page of an
+// object is found by masking its address.
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 16
+#define HEAP_CLASS_COUNT 8
+
+typedef struct Page Page;
+
+typedef struct
+{
+    Page* pages[HEAP_CLASS_COUNT];
+    // The page of each class allocations are served from, the ones before it
+    // ran out of free slots.
+    Page* current[HEAP_CLASS_COUNT];
+} Heap;
+
+typedef struct
+{
+    Heap* heap;
+    int class_index;
+    Page* page;
+    int slot;
+} HeapIter;
+
+typedef void (*HeapFreeFn)(VM* vm, Obj* object);
+typedef void (*HeapMoveFn)(Obj* from, Obj* to);
+
+void heap_init(Heap* heap);
+
+// Returns an uninitialized slot for an object of the given size.
+Obj* heap_alloc(Heap* heap, size_t size);
+size_t heap_slot_size(size_t size);
+size_t heap_obj_size(Obj* object);
+
+bool heap_is_marked(Obj* object);
+
+// Sets the mark bit of the object, returns false when it was set already.
+// Safe to call from several markers at once.
+bool heap_mark(Obj* object);
+
+// Calls free_fn on every live but unmarked object and recycles its slot,
+// clears the marks of the survivors and releases the pages left empty.
+void heap_sweep(VM* vm, Heap* heap, HeapFreeFn free_fn);
+
+// Moves every page of from to the front of heap.
+void heap_merge(Heap* heap, Heap* from);
+
+// Sums up the bytes of the slots in use and of all slots over the pages.
+void heap_occupancy(Heap* heap, size_t* used, size_t* capacity);
+
+// Evacuation, run between marking and sweeping: heap_evacuate moves the pages
+// where fewer than half of the slots are marked to evacuated and copies their
+// marked objects into the remaining pages, calling move_fn for each one, and
+// returns how many pages it emptied. Until heap_release frees the evacuated
+// pages, heap_forward maps an old address to the copy.
+int heap_evacuate(Heap* heap, Heap* evacuated, HeapMoveFn move_fn);
+Obj* heap_forward(Obj* object);
+void heap_release(VM* vm, Heap* evacuated, HeapFreeFn free_fn);
+
+void heap_iter_init(HeapIter* iter, Heap* heap);
+Obj* heap_iter_next(HeapIter* iter);
+
+#endif // CLOX_HEAP_H_
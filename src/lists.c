@@ -0,0 +1,561 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lists.h"
+#include "memory.h"
+#include "simd.h"
+#include "vm.h"
+
+static bool args_check(VM* vm, int argc, int min, int max)
+{
+    if (argc >= min && argc <= max) return true;
+
+    if (min == max)
+    {
+        vm_raise_runtime_error(vm, "insufficient arguments, need %d got=%d",
+                               min, argc);
+    }
+    else
+    {
+        vm_raise_runtime_error(vm,
+                               "insufficient arguments, need %d to %d got=%d",
+                               min, max, argc);
+    }
+
+    return false;
+}
+
+static bool arg_list(VM* vm, Value value, ObjList** out_list)
+{
+    if (!obj_is_list(value))
+    {
+        vm_raise_runtime_error(vm, "argument must be a list.");
+        return false;
+    }
+
+    *out_list = obj_as_list(value);
+    return true;
+}
+
+// Reads an index between 0 and max, both included.
+static bool arg_index(VM* vm, Value value, int max, int* out_index)
+{
+    if (!value_is_number(value))
+    {
+        vm_raise_runtime_error(vm, "index cannot be a non-number value.");
+        return false;
+    }
+
+    double index = value_as_number(value);
+    if (index < 0 || index > max)
+    {
+        vm_raise_runtime_error(vm, "index out of range.");
+        return false;
+    }
+
+    *out_index = (int)index;
+    return true;
+}
+
+// A new list with room for capacity items, left on the stack to stay rooted.
+static ObjList* list_push_new(VM* vm, int capacity)
+{
+    ObjList* list = obj_list_new(vm);
+    vm_stack_push(vm, value_make_obj(list));
+    obj_list_reserve(vm, list, capacity);
+    return list;
+}
+
+static void list_add_all(VM* vm, ObjList* list, const Value* items, int count)
+{
+    if (count == 0) return;
+
+    obj_list_reserve(vm, list, list->count + count);
+    memcpy(list->items + list->count, items, sizeof(Value) * count);
+    list->count += count;
+}
+
+static int list_index_of(ObjList* list, Value value)
+{
+#ifdef NAN_BOXING
+    // Equal values share their bits, except for zeros of either sign and
+    // NaNs, which equal nothing.
+    if (!value_is_number(value))
+        return simd_find_u64(list->items, list->count, value);
+
+    double number = value_as_number(value);
+    if (number != number) return -1;
+    if (number != 0) return simd_find_u64(list->items, list->count, value);
+#endif
+
+    for (int i = 0; i < list->count; ++i)
+        if (value_check_equality(list->items[i], value)) return i;
+
+    return -1;
+}
+
+static bool native_fn_list_index_of(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &list))
+        return false;
+
+    native_return(value_make_number(list_index_of(list, args[1])));
+}
+
+static bool native_fn_list_contains(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &list))
+        return false;
+
+    native_return(value_make_bool(list_index_of(list, args[1]) >= 0));
+}
+
+// fill(list, value) overwrites every item.
+static bool native_fn_list_fill(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &list))
+        return false;
+
+    Value value = args[1];
+    for (int i = 0; i < list->count; ++i) list->items[i] = value;
+
+    native_return(value_make_nil());
+}
+
+static bool native_fn_list_copy(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 1, 1) || !arg_list(vm, args[0], &list))
+        return false;
+
+    ObjList* copy = list_push_new(vm, list->count);
+    list_add_all(vm, copy, list->items, list->count);
+    native_return(value_make_obj(copy));
+}
+
+// slice(list, start[, end]) copies the items from start up to, but not
+// including, end or the end of the list.
+static bool native_fn_list_slice(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    int start;
+    if (!args_check(vm, argc, 2, 3) || !arg_list(vm, args[0], &list) ||
+        !arg_index(vm, args[1], list->count, &start))
+        return false;
+
+    int end = list->count;
+    if (argc == 3 && !arg_index(vm, args[2], list->count, &end)) return false;
+    if (end < start) end = start;
+
+    ObjList* slice = list_push_new(vm, end - start);
+    list_add_all(vm, slice, list->items + start, end - start);
+    native_return(value_make_obj(slice));
+}
+
+static bool native_fn_list_concat(VM* vm, int argc, Value* args)
+{
+    ObjList* a;
+    ObjList* b;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &a) ||
+        !arg_list(vm, args[1], &b))
+        return false;
+
+    ObjList* result = list_push_new(vm, a->count + b->count);
+    list_add_all(vm, result, a->items, a->count);
+    list_add_all(vm, result, b->items, b->count);
+    native_return(value_make_obj(result));
+}
+
+static bool native_fn_list_reverse(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 1, 1) || !arg_list(vm, args[0], &list))
+        return false;
+
+    for (int i = 0, j = list->count - 1; i < j; ++i, --j)
+    {
+        Value item = list->items[i];
+        list->items[i] = list->items[j];
+        list->items[j] = item;
+    }
+
+    native_return(value_make_nil());
+}
+
+// extend(list, other) appends every item of other, growing list once.
+static bool native_fn_list_extend(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    ObjList* other;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &list) ||
+        !arg_list(vm, args[1], &other))
+        return false;
+
+    // Reserved first, other may be list itself.
+    int count = other->count;
+    obj_list_reserve(vm, list, list->count + count);
+    list_add_all(vm, list, other->items, count);
+    native_return(value_make_nil());
+}
+
+static bool native_fn_list_push_front(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 2, 2) || !arg_list(vm, args[0], &list))
+        return false;
+
+    obj_list_push_front(vm, list, args[1]);
+    native_return(value_make_nil());
+}
+
+static bool arg_list_non_empty(VM* vm, Value value, ObjList** out_list)
+{
+    if (!arg_list(vm, value, out_list)) return false;
+
+    if ((*out_list)->count == 0)
+    {
+        vm_raise_runtime_error(vm, "cannot pop from an empty list.");
+        return false;
+    }
+
+    return true;
+}
+
+static bool native_fn_list_pop_front(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 1, 1) || !arg_list_non_empty(vm, args[0], &list))
+        return false;
+
+    native_return(obj_list_pop_front(list));
+}
+
+static bool native_fn_list_pop(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 1, 1) || !arg_list_non_empty(vm, args[0], &list))
+        return false;
+
+    native_return(obj_list_pop(list));
+}
+
+// Runs this short are insertion sorted before merging starts.
+#define SORT_RUN 16
+
+typedef struct Sorter Sorter;
+
+// Tells whether a goes before b, false after a runtime error.
+typedef bool (*SortLess)(Sorter* sorter, Value a, Value b, bool* out_less);
+
+struct Sorter
+{
+    VM* vm;
+    SortLess less;
+
+    // The Lox comparator, unused by the built-in orders.
+    Callback compare;
+};
+
+static bool string_less(Sorter* sorter, Value a, Value b, bool* out_less)
+{
+    (void)sorter;
+
+    ObjString* x = obj_as_string(a);
+    ObjString* y = obj_as_string(b);
+
+    int length = x->length < y->length ? x->length : y->length;
+    int order = memcmp(x->chars, y->chars, length);
+    *out_less = order < 0 || (order == 0 && x->length < y->length);
+    return true;
+}
+
+static bool compare_less(Sorter* sorter, Value a, Value b, bool* out_less)
+{
+    VM* vm = sorter->vm;
+    Value pair[2] = {a, b};
+    Value order;
+    if (!vm_callback_call(vm, &sorter->compare, pair, &order)) return false;
+
+    if (!value_is_number(order))
+    {
+        vm_raise_runtime_error(vm, "comparator must return a number.");
+        return false;
+    }
+
+    *out_less = value_as_number(order) < 0;
+    return true;
+}
+
+static bool sort_insertion(Sorter* sorter, Value* items, int count)
+{
+    for (int i = 1; i < count; ++i)
+    {
+        Value item = items[i];
+        int j = i;
+
+        while (j > 0)
+        {
+            bool less;
+            if (!sorter->less(sorter, item, items[j - 1], &less)) return false;
+            if (!less) break;
+
+            items[j] = items[j - 1];
+            --j;
+        }
+
+        items[j] = item;
+    }
+
+    return true;
+}
+
+// Merges the sorted runs src[start, mid) and src[mid, end) into dst, taking
+// from the left run on ties to stay stable.
+static bool sort_merge(Sorter* sorter, const Value* src, Value* dst, int start,
+                       int mid, int end)
+{
+    int i = start;
+    int j = mid;
+    int k = start;
+
+    // Runs already in order, as in sorted input, cost one comparison.
+    bool less = false;
+    if (mid < end && !sorter->less(sorter, src[mid], src[mid - 1], &less))
+        return false;
+
+    if (less)
+    {
+        while (i < mid && j < end)
+        {
+            if (!sorter->less(sorter, src[j], src[i], &less)) return false;
+            dst[k++] = less ? src[j++] : src[i++];
+        }
+    }
+
+    memcpy(dst + k, src + i, sizeof(Value) * (mid - i));
+    k += mid - i;
+    memcpy(dst + k, src + j, sizeof(Value) * (end - j));
+    return true;
+}
+
+// Stable bottom-up merge sort of items, using scratch of the same length.
+// Every value stays in items or scratch throughout, so keeping both rooted
+// keeps the values alive while a comparator runs.
+static bool sort_values(Sorter* sorter, Value* items, Value* scratch,
+                        int count)
+{
+    for (int start = 0; start < count; start += SORT_RUN)
+    {
+        int length = count - start < SORT_RUN ? count - start : SORT_RUN;
+        if (!sort_insertion(sorter, items + start, length)) return false;
+    }
+
+    Value* src = items;
+    Value* dst = scratch;
+
+    for (int width = SORT_RUN; width < count; width *= 2)
+    {
+        for (int start = 0; start < count; start += 2 * width)
+        {
+            int mid = count - start < width ? count : start + width;
+            int end = count - mid < width ? count : mid + width;
+            if (!sort_merge(sorter, src, dst, start, mid, end)) return false;
+        }
+
+        Value* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != items) memcpy(items, src, sizeof(Value) * count);
+    return true;
+}
+
+// Flips the bits of a number so its key orders the same way as unsigned.
+static uint64_t number_key(double number)
+{
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return bits ^ ((uint64_t)-(int64_t)(bits >> 63) | (UINT64_C(1) << 63));
+}
+
+static double number_from_key(uint64_t key)
+{
+    uint64_t bits = key ^ (((key >> 63) - 1) | (UINT64_C(1) << 63));
+
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+// LSD radix sort a byte at a time, skipping the bytes every key shares such
+// as the low mantissa bytes of whole numbers.
+static void radix_sort(uint64_t* keys, uint64_t* scratch, int count)
+{
+    if (count < 2) return;
+
+    size_t counts[8][256] = {{0}};
+
+    for (int i = 0; i < count; ++i)
+    {
+        uint64_t key = keys[i];
+        for (int digit = 0; digit < 8; ++digit)
+            counts[digit][(key >> (digit * 8)) & 0xff]++;
+    }
+
+    uint64_t* src = keys;
+    uint64_t* dst = scratch;
+
+    for (int digit = 0; digit < 8; ++digit)
+    {
+        int shift = digit * 8;
+        size_t* offsets = counts[digit];
+        if (offsets[(src[0] >> shift) & 0xff] == (size_t)count) continue;
+
+        size_t offset = 0;
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            size_t bucket = offsets[byte];
+            offsets[byte] = offset;
+            offset += bucket;
+        }
+
+        for (int i = 0; i < count; ++i)
+            dst[offsets[(src[i] >> shift) & 0xff]++] = src[i];
+
+        uint64_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != keys) memcpy(keys, src, sizeof(uint64_t) * count);
+}
+
+// Sorts numbers by their keys, NaNs go last in the order they came.
+static void list_sort_numbers(ObjList* list)
+{
+    int count = list->count;
+    uint64_t* keys = (uint64_t*)malloc(sizeof(uint64_t) * count * 2);
+    if (keys == NULL) exit(1);
+
+    int key_count = 0;
+    int nan_count = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Value item = list->items[i];
+        double number = value_as_number(item);
+
+        if (number != number)
+            list->items[nan_count++] = item;
+        else
+            keys[key_count++] = number_key(number);
+    }
+
+    memmove(list->items + key_count, list->items, sizeof(Value) * nan_count);
+
+    radix_sort(keys, keys + count, key_count);
+    for (int i = 0; i < key_count; ++i)
+        list->items[i] = value_make_number(number_from_key(keys[i]));
+
+    free(keys);
+}
+
+static void list_sort_strings(VM* vm, ObjList* list)
+{
+    Value* scratch = (Value*)malloc(sizeof(Value) * list->count);
+    if (scratch == NULL) exit(1);
+
+    // Comparing strings never calls into Lox, so this cannot fail.
+    Sorter sorter = {vm, string_less, {0}};
+    sort_values(&sorter, list->items, scratch, list->count);
+
+    free(scratch);
+}
+
+// sort(list[, compare]) sorts list in place. Without a comparator every item
+// has to be a number, sorted with NaNs last, or a string, sorted bytewise.
+// compare(a, b) returns a negative number when a goes before b; items it
+// calls equal keep their order.
+static bool native_fn_list_sort(VM* vm, int argc, Value* args)
+{
+    ObjList* list;
+    if (!args_check(vm, argc, 1, 2) || !arg_list(vm, args[0], &list))
+        return false;
+
+    int count = list->count;
+    if (count < 2) native_return(value_make_nil());
+
+    if (argc == 1)
+    {
+        bool numbers = true;
+        bool strings = true;
+        for (int i = 0; i < count; ++i)
+        {
+            numbers = numbers && value_is_number(list->items[i]);
+            strings = strings && obj_is_string(list->items[i]);
+        }
+
+        if (numbers)
+        {
+            list_sort_numbers(list);
+        }
+        else if (strings)
+        {
+            list_sort_strings(vm, list);
+        }
+        else
+        {
+            vm_raise_runtime_error(
+                vm, "sort needs a comparator unless all items are numbers or "
+                    "all are strings.");
+            return false;
+        }
+
+        native_return(value_make_nil());
+    }
+
+    // The comparator may collect garbage or change the list, so the items
+    // are sorted in two private lists kept rooted on the stack. It may also
+    // move the stack, args is found again by offset afterwards.
+    int offset = (int)(args - vm->fiber->stack);
+
+    ObjList* items = list_push_new(vm, count);
+    list_add_all(vm, items, list->items, count);
+    ObjList* scratch = list_push_new(vm, count);
+    list_add_all(vm, scratch, list->items, count);
+
+    Sorter sorter = {vm, compare_less, {0}};
+    if (!vm_callback_begin(vm, &sorter.compare, args[1], 2)) return false;
+    if (!sort_values(&sorter, items->items, scratch->items, count))
+        return false;
+
+    if (list->count != count)
+    {
+        vm_raise_runtime_error(vm, "list changed while sorting.");
+        return false;
+    }
+
+    memcpy(list->items, items->items, sizeof(Value) * count);
+
+    args = vm->fiber->stack + offset;
+    native_return(value_make_nil());
+}
+
+void lists_define_natives(VM* vm)
+{
+    vm_define_native_fn(vm, "indexOf", native_fn_list_index_of);
+    vm_define_native_fn(vm, "contains", native_fn_list_contains);
+    vm_define_native_fn(vm, "fill", native_fn_list_fill);
+    vm_define_native_fn(vm, "copy", native_fn_list_copy);
+    vm_define_native_fn(vm, "slice", native_fn_list_slice);
+    vm_define_native_fn(vm, "concat", native_fn_list_concat);
+    vm_define_native_fn(vm, "reverse", native_fn_list_reverse);
+    vm_define_native_fn(vm, "extend", native_fn_list_extend);
+    vm_define_native_fn(vm, "sort", native_fn_list_sort);
+    vm_define_native_fn(vm, "pushFront", native_fn_list_push_front);
+    vm_define_native_fn(vm, "popFront", native_fn_list_pop_front);
+    vm_define_native_fn(vm, "pop", native_fn_list_pop);
+}
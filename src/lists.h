@@ -0,0 +1,13 @@
+#ifndef CLOX_LISTS_H_
+#define CLOX_LISTS_H_
+
+#include "general.h"
+#include "object.h"
+
+// Natives working on whole lists at once: indexOf, contains, fill, copy,
+// slice, concat, reverse, extend and sort. Each is one native call where a
+// Lox loop would index the list item by item. pushFront, popFront and pop
+// use lists as deques in constant time.
+void lists_define_natives(VM* vm);
+
+#endif // CLOX_LISTS_H_
@@ -0,0 +1,987 @@
+#define _GNU_SOURCE // accept4, pipe2
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "memory.h"
+#include "vm.h"
+
+#define LOOP_READ_DEFAULT 4096
+#define LOOP_EVENTS_MAX 64
+
+typedef enum
+{
+    WAIT_READ,
+    WAIT_WRITE,
+    WAIT_ACCEPT,
+    WAIT_CONNECT,
+    WAIT_SLEEP,
+    WAIT_FILE,
+} WaitKind;
+
+// Regular files are always "ready" as far as epoll is concerned, so whole
+// file reads and writes run on a helper thread which signals `event_fd`.
+// The job is shared with that thread and freed by whoever drops it last.
+typedef struct
+{
+    atomic_int refs;
+    int event_fd;
+    bool is_write;
+    bool failed;
+    char* path;
+    char* data;
+    size_t length;
+} FileJob;
+
+typedef struct Waiter
+{
+    ObjFiber* fiber;
+    WaitKind kind;
+    int fd;
+    uint32_t events;
+
+    int size;         // WAIT_READ: most bytes to return.
+    ObjString* data;  // WAIT_WRITE: what is left to write starts at `written`.
+    size_t written;
+    FileJob* job;     // WAIT_FILE
+
+    struct Waiter* next;
+    struct Waiter* watch_next;
+} Waiter;
+
+// The one epoll registration of a descriptor, shared by every fiber parked
+// on it, say one reading and one writing a socket. It is armed for what all
+// of them wait for and wakes them oldest first.
+typedef struct
+{
+    Waiter* waiters;
+    bool registered;
+} Watch;
+
+struct Loop
+{
+    int epoll_fd;
+
+    // Ring buffer of fibers ready to run.
+    ObjFiber** ready;
+    int ready_head;
+    int ready_count;
+    int ready_capacity;
+
+    Waiter* waiters;
+
+    // Indexed by descriptor, NULL where nobody waits.
+    Watch** watches;
+    int watch_capacity;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////
+// FILE JOBS
+///////////////////////////////////////////////////////////////////////////////////////
+
+static void file_job_release(FileJob* job)
+{
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+
+    close(job->event_fd);
+    free(job->path);
+    free(job->data);
+    free(job);
+}
+
+static void* file_job_run(void* arg)
+{
+    FileJob* job = (FileJob*)arg;
+    FILE* file = fopen(job->path, job->is_write ? "wb" : "rb");
+
+    if (file == NULL)
+    {
+        job->failed = true;
+    }
+    else if (job->is_write)
+    {
+        job->failed = fwrite(job->data, 1, job->length, file) != job->length;
+    }
+    else
+    {
+        size_t capacity = LOOP_READ_DEFAULT;
+        job->data = (char*)malloc(capacity);
+
+        size_t count;
+        while (job->data != NULL &&
+               (count = fread(job->data + job->length, 1,
+                              capacity - job->length, file)) > 0)
+        {
+            job->length += count;
+            if (job->length < capacity) continue;
+
+            capacity *= 2;
+            char* data = (char*)realloc(job->data, capacity);
+            if (data == NULL) free(job->data);
+            job->data = data;
+        }
+
+        job->failed = job->data == NULL || ferror(file);
+    }
+
+    if (file != NULL) fclose(file);
+
+    uint64_t one = 1;
+    if (write(job->event_fd, &one, sizeof(one)) < 0) job->failed = true;
+
+    file_job_release(job);
+    return NULL;
+}
+
+static FileJob* file_job_start(const char* path, ObjString* data)
+{
+    FileJob* job = (FileJob*)calloc(1, sizeof(FileJob));
+    if (job == NULL) return NULL;
+
+    atomic_init(&job->refs, 2);
+    job->is_write = data != NULL;
+    job->path = strdup(path);
+    job->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (data != NULL)
+    {
+        job->data = (char*)malloc(data->length + 1);
+        if (job->data != NULL) memcpy(job->data, data->chars, data->length);
+        job->length = (size_t)data->length;
+    }
+
+    if (job->path == NULL || job->event_fd == -1 ||
+        (data != NULL && job->data == NULL))
+    {
+        if (job->event_fd != -1) close(job->event_fd);
+        free(job->path);
+        free(job->data);
+        free(job);
+        return NULL;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, file_job_run, job) == 0)
+        pthread_detach(thread);
+    else
+        file_job_run(job); // Still signals the eventfd, just not in parallel.
+
+    return job;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// SCHEDULING
+///////////////////////////////////////////////////////////////////////////////////////
+
+static void ready_push(Loop* loop, ObjFiber* fiber)
+{
+    if (loop->ready_count == loop->ready_capacity)
+    {
+        int capacity = capacity_grow(loop->ready_capacity);
+        ObjFiber** ready = (ObjFiber**)malloc(sizeof(ObjFiber*) * capacity);
+        if (ready == NULL) exit(1);
+
+        for (int i = 0; i < loop->ready_count; ++i)
+        {
+            ready[i] =
+                loop->ready[(loop->ready_head + i) % loop->ready_capacity];
+        }
+
+        free(loop->ready);
+        loop->ready = ready;
+        loop->ready_head = 0;
+        loop->ready_capacity = capacity;
+    }
+
+    int tail = (loop->ready_head + loop->ready_count) % loop->ready_capacity;
+    loop->ready[tail] = fiber;
+    loop->ready_count++;
+}
+
+static ObjFiber* ready_pop(Loop* loop)
+{
+    ObjFiber* fiber = loop->ready[loop->ready_head];
+    loop->ready_head = (loop->ready_head + 1) % loop->ready_capacity;
+    loop->ready_count--;
+    return fiber;
+}
+
+static Watch* watch_find(Loop* loop, int fd)
+{
+    return fd < loop->watch_capacity ? loop->watches[fd] : NULL;
+}
+
+static Watch* watch_get(Loop* loop, int fd)
+{
+    if (fd >= loop->watch_capacity)
+    {
+        int capacity = loop->watch_capacity;
+        while (capacity <= fd) capacity = capacity_grow(capacity);
+
+        Watch** watches =
+            (Watch**)realloc(loop->watches, sizeof(Watch*) * capacity);
+        if (watches == NULL) exit(1);
+
+        for (int i = loop->watch_capacity; i < capacity; ++i)
+            watches[i] = NULL;
+
+        loop->watches = watches;
+        loop->watch_capacity = capacity;
+    }
+
+    if (loop->watches[fd] == NULL)
+    {
+        loop->watches[fd] = (Watch*)calloc(1, sizeof(Watch));
+        if (loop->watches[fd] == NULL) exit(1);
+    }
+
+    return loop->watches[fd];
+}
+
+// Arms the registration of fd for whatever its waiters still wait for, or
+// drops it once nobody does. Registrations are one-shot, so this runs again
+// after every event.
+static bool watch_arm(Loop* loop, int fd)
+{
+    Watch* watch = watch_find(loop, fd);
+    if (watch == NULL) return true;
+
+    uint32_t events = 0;
+    for (Waiter* waiter = watch->waiters; waiter != NULL;
+         waiter = waiter->watch_next)
+        events |= waiter->events;
+
+    if (events == 0)
+    {
+        if (watch->registered)
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+        loop->watches[fd] = NULL;
+        free(watch);
+        return true;
+    }
+
+    struct epoll_event event = {0};
+    event.events = events | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    int op = watch->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epoll_fd, op, fd, &event) != 0) return false;
+
+    watch->registered = true;
+    return true;
+}
+
+static void waiter_unlink(Loop* loop, Waiter* waiter)
+{
+    for (Waiter** link = &loop->waiters; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == waiter)
+        {
+            *link = waiter->next;
+            break;
+        }
+    }
+
+    Watch* watch = watch_find(loop, waiter->fd);
+    if (watch == NULL) return;
+
+    for (Waiter** link = &watch->waiters; *link != NULL;
+         link = &(*link)->watch_next)
+    {
+        if (*link == waiter)
+        {
+            *link = waiter->watch_next;
+            return;
+        }
+    }
+}
+
+// Releases whatever the waiter owns besides its fiber. Its registration is
+// left to watch_arm.
+static void waiter_free(Waiter* waiter)
+{
+    if (waiter->kind == WAIT_SLEEP) close(waiter->fd);
+    if (waiter->kind == WAIT_FILE) file_job_release(waiter->job);
+
+    free(waiter);
+}
+
+// Frees a waiter that will never complete. A pending connect has not handed
+// its socket to Lox yet, so nobody else would close it.
+static void waiter_abandon(Waiter* waiter)
+{
+    if (waiter->kind == WAIT_CONNECT) close(waiter->fd);
+    waiter_free(waiter);
+}
+
+// Hands `result` to the parked fiber and queues it again.
+static void waiter_finish(VM* vm, Waiter* waiter, Value result)
+{
+    Loop* loop = vm->loop;
+
+    waiter->fiber->stack_top[-1] = result;
+    ready_push(loop, waiter->fiber);
+
+    waiter_unlink(loop, waiter);
+    waiter_free(waiter);
+}
+
+// Tries the operation the waiter is parked on, finishing it unless the
+// descriptor turned out not to be ready after all.
+static void waiter_complete(VM* vm, Waiter* waiter)
+{
+    switch (waiter->kind)
+    {
+        case WAIT_READ:
+        {
+            char* buffer = (char*)malloc(waiter->size);
+            if (buffer == NULL) exit(1);
+
+            ssize_t count = read(waiter->fd, buffer, waiter->size);
+            if (count < 0 && (errno == EAGAIN || errno == EINTR))
+            {
+                free(buffer);
+                return;
+            }
+
+            // The waiter keeps the fiber rooted while the string is made.
+            Value result = value_make_nil();
+            if (count >= 0)
+            {
+                result =
+                    value_make_obj(obj_string_cpy(vm, buffer, (int)count));
+            }
+
+            free(buffer);
+            waiter_finish(vm, waiter, result);
+            return;
+        }
+
+        case WAIT_WRITE:
+        {
+            ObjString* data = waiter->data;
+            ssize_t count = write(waiter->fd, data->chars + waiter->written,
+                                  data->length - waiter->written);
+
+            if (count < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                waiter_finish(vm, waiter, value_make_nil());
+                return;
+            }
+
+            if (count > 0) waiter->written += count;
+            if (waiter->written < (size_t)data->length) return;
+
+            waiter_finish(vm, waiter, value_make_number(data->length));
+            return;
+        }
+
+        case WAIT_ACCEPT:
+        {
+            int fd = accept4(waiter->fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+            waiter_finish(vm, waiter,
+                          fd < 0 ? value_make_nil() : value_make_number(fd));
+            return;
+        }
+
+        case WAIT_CONNECT:
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(waiter->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+            int fd = waiter->fd;
+            if (error != 0)
+            {
+                waiter_finish(vm, waiter, value_make_nil());
+                close(fd);
+                return;
+            }
+
+            waiter_finish(vm, waiter, value_make_number(fd));
+            return;
+        }
+
+        case WAIT_SLEEP:
+            waiter_finish(vm, waiter, value_make_nil());
+            return;
+
+        case WAIT_FILE:
+        {
+            FileJob* job = waiter->job;
+
+            Value result = value_make_nil();
+            if (!job->failed && job->is_write)
+                result = value_make_number((double)job->length);
+            else if (!job->failed)
+                result = value_make_obj(
+                    obj_string_cpy(vm, job->data, (int)job->length));
+
+            waiter_finish(vm, waiter, result);
+            return;
+        }
+    }
+}
+
+static void loop_poll(VM* vm, int timeout)
+{
+    Loop* loop = vm->loop;
+    struct epoll_event events[LOOP_EVENTS_MAX];
+
+    int count;
+    do
+    {
+        count = epoll_wait(loop->epoll_fd, events, LOOP_EVENTS_MAX, timeout);
+    } while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; ++i)
+    {
+        int fd = events[i].data.fd;
+        Watch* watch = watch_find(loop, fd);
+        if (watch == NULL) continue;
+
+        // Errors and hangups concern everyone, completing reports them.
+        uint32_t ready = events[i].events;
+        if (ready & (EPOLLERR | EPOLLHUP)) ready |= EPOLLIN | EPOLLOUT;
+
+        for (Waiter* waiter = watch->waiters; waiter != NULL;)
+        {
+            Waiter* next = waiter->watch_next;
+            if (waiter->events & ready) waiter_complete(vm, waiter);
+            waiter = next;
+        }
+
+        watch_arm(loop, fd);
+    }
+}
+
+ObjFiber* loop_next(VM* vm)
+{
+    Loop* loop = vm->loop;
+
+    while (true)
+    {
+        // Pick up finished I/O without blocking while others can run.
+        if (loop->waiters != NULL)
+            loop_poll(vm, loop->ready_count > 0 ? 0 : -1);
+
+        if (loop->ready_count > 0)
+        {
+            ObjFiber* fiber = ready_pop(loop);
+            fiber->state = FIBER_RUNNING;
+            return fiber;
+        }
+
+        if (loop->waiters == NULL) return NULL;
+    }
+}
+
+// Parks the running fiber until `fd` reports `events`. The native's result
+// slot is filled in by waiter_complete.
+static bool loop_wait(VM* vm, Value* args, Waiter* waiter, uint32_t events)
+{
+    Loop* loop = vm->loop;
+
+    if (vm->callback_fiber != NULL)
+    {
+        waiter_abandon(waiter);
+        vm_raise_runtime_error(vm, "cannot block inside a callback.");
+        return false;
+    }
+
+    if (loop->epoll_fd == -1)
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (loop->epoll_fd == -1)
+    {
+        int error = errno;
+        waiter_abandon(waiter);
+        vm_raise_runtime_error(vm, "cannot wait on descriptor: %s.",
+                               strerror(error));
+        return false;
+    }
+
+    // Queued behind whoever already waits on the descriptor.
+    Watch* watch = watch_get(loop, waiter->fd);
+    Waiter** tail = &watch->waiters;
+    while (*tail != NULL) tail = &(*tail)->watch_next;
+
+    waiter->events = events;
+    waiter->fiber = vm->fiber;
+    waiter->next = loop->waiters;
+    loop->waiters = waiter;
+    *tail = waiter;
+
+    if (!watch_arm(loop, waiter->fd))
+    {
+        int error = errno;
+        waiter_unlink(loop, waiter);
+        watch_arm(loop, waiter->fd);
+        waiter_abandon(waiter);
+
+        vm_raise_runtime_error(vm, "cannot wait on descriptor: %s.",
+                               strerror(error));
+        return false;
+    }
+
+    // Drop the arguments now, completing may happen before the native
+    // returns to its caller.
+    args[-1] = value_make_nil();
+    vm->fiber->stack_top = args;
+    vm->fiber = loop_next(vm);
+    return true;
+}
+
+static Waiter* waiter_new(WaitKind kind, int fd)
+{
+    Waiter* waiter = (Waiter*)calloc(1, sizeof(Waiter));
+    if (waiter == NULL) exit(1);
+
+    waiter->kind = kind;
+    waiter->fd = fd;
+    return waiter;
+}
+
+void loop_init(VM* vm)
+{
+    Loop* loop = (Loop*)malloc(sizeof(Loop));
+    if (loop == NULL) exit(1);
+
+    loop->epoll_fd = -1;
+    loop->ready = NULL;
+    loop->ready_head = 0;
+    loop->ready_count = 0;
+    loop->ready_capacity = 0;
+    loop->waiters = NULL;
+    loop->watches = NULL;
+    loop->watch_capacity = 0;
+
+    // A write to a closed pipe or socket returns nil rather than killing the
+    // process, which SIGPIPE would do before write even returns.
+    signal(SIGPIPE, SIG_IGN);
+
+    vm->loop = loop;
+}
+
+void loop_reset(VM* vm)
+{
+    Loop* loop = vm->loop;
+
+    while (loop->ready_count > 0) ready_pop(loop)->state = FIBER_DONE;
+    loop->ready_head = 0;
+
+    // Registrations go first, sleeps and connects close their descriptors.
+    for (int fd = 0; fd < loop->watch_capacity; ++fd)
+    {
+        Watch* watch = loop->watches[fd];
+        if (watch == NULL) continue;
+
+        if (watch->registered)
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+        free(watch);
+        loop->watches[fd] = NULL;
+    }
+
+    while (loop->waiters != NULL)
+    {
+        Waiter* waiter = loop->waiters;
+        loop->waiters = waiter->next;
+        waiter->fiber->state = FIBER_DONE;
+        waiter_abandon(waiter);
+    }
+}
+
+void loop_free(VM* vm)
+{
+    Loop* loop = vm->loop;
+    if (loop == NULL) return;
+
+    loop_reset(vm);
+
+    if (loop->epoll_fd != -1) close(loop->epoll_fd);
+    free(loop->ready);
+    free(loop->watches);
+    free(loop);
+
+    vm->loop = NULL;
+}
+
+void gc_mark_loop(VM* vm)
+{
+    Loop* loop = vm->loop;
+    if (loop == NULL) return;
+
+    for (int i = 0; i < loop->ready_count; ++i)
+    {
+        int index = (loop->ready_head + i) % loop->ready_capacity;
+        gc_mark_obj(vm, (Obj*)loop->ready[index]);
+    }
+
+    for (Waiter* waiter = loop->waiters; waiter != NULL; waiter = waiter->next)
+    {
+        gc_mark_obj(vm, (Obj*)waiter->fiber);
+        gc_mark_obj(vm, (Obj*)waiter->data);
+    }
+}
+
+void gc_forward_loop(VM* vm)
+{
+    Loop* loop = vm->loop;
+    if (loop == NULL) return;
+
+    for (int i = 0; i < loop->ready_count; ++i)
+    {
+        int index = (loop->ready_head + i) % loop->ready_capacity;
+        loop->ready[index] = (ObjFiber*)heap_forward((Obj*)loop->ready[index]);
+    }
+
+    for (Waiter* waiter = loop->waiters; waiter != NULL; waiter = waiter->next)
+    {
+        waiter->fiber = (ObjFiber*)heap_forward((Obj*)waiter->fiber);
+        waiter->data = (ObjString*)heap_forward((Obj*)waiter->data);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// NATIVES
+///////////////////////////////////////////////////////////////////////////////////////
+
+static bool args_check(VM* vm, int argc, int min, int max)
+{
+    if (argc >= min && argc <= max) return true;
+
+    if (min == max)
+    {
+        vm_raise_runtime_error(vm, "insufficient arguments, need %d got=%d",
+                               min, argc);
+    }
+    else
+    {
+        vm_raise_runtime_error(vm,
+                               "insufficient arguments, need %d to %d got=%d",
+                               min, max, argc);
+    }
+
+    return false;
+}
+
+static bool arg_fd(VM* vm, Value value, int* out_fd)
+{
+    if (!value_is_number(value) || value_as_number(value) < 0)
+    {
+        vm_raise_runtime_error(vm, "file descriptor must be a number.");
+        return false;
+    }
+
+    *out_fd = (int)value_as_number(value);
+    return true;
+}
+
+static bool arg_string(VM* vm, Value value, const char* what)
+{
+    if (obj_is_string(value)) return true;
+
+    vm_raise_runtime_error(vm, "%s must be a string.", what);
+    return false;
+}
+
+static bool unix_address_make(VM* vm, ObjString* path,
+                              struct sockaddr_un* address)
+{
+    if ((size_t)path->length >= sizeof(address->sun_path))
+    {
+        vm_raise_runtime_error(vm, "socket path '%s' is too long.",
+                               path->chars);
+        return false;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, path->chars, path->length);
+    return true;
+}
+
+static bool native_fn_spawn(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+
+    if (!obj_is_closure(args[0]) ||
+        obj_as_closure(args[0])->function->arity != 0)
+    {
+        vm_raise_runtime_error(vm, "spawn needs a function with no arguments.");
+        return false;
+    }
+
+    // Queued fibers count as running so nobody can resume them as well.
+    ObjFiber* fiber = obj_fiber_new(vm, obj_as_closure(args[0]));
+    fiber->state = FIBER_RUNNING;
+    ready_push(vm->loop, fiber);
+
+    native_return(value_make_obj(fiber));
+}
+
+static bool native_fn_sleep(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+
+    if (!value_is_number(args[0]))
+    {
+        vm_raise_runtime_error(vm, "sleep duration must be a number.");
+        return false;
+    }
+
+    if (vm->callback_fiber != NULL)
+    {
+        vm_raise_runtime_error(vm, "cannot block inside a callback.");
+        return false;
+    }
+
+    double ms = value_as_number(args[0]);
+    if (ms <= 0)
+    {
+        // Just let every other runnable fiber go first.
+        args[-1] = value_make_nil();
+        vm->fiber->stack_top = args;
+        ready_push(vm->loop, vm->fiber);
+        vm->fiber = loop_next(vm);
+        return true;
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+    {
+        vm_raise_runtime_error(vm, "cannot create timer: %s.", strerror(errno));
+        return false;
+    }
+
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = (time_t)(ms / 1000);
+    spec.it_value.tv_nsec = (long)((ms - spec.it_value.tv_sec * 1000) * 1e6);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;
+
+    timerfd_settime(fd, 0, &spec, NULL);
+    return loop_wait(vm, args, waiter_new(WAIT_SLEEP, fd), EPOLLIN);
+}
+
+static bool native_fn_pipe(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 0, 0)) return false;
+
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+        native_return(value_make_nil());
+
+    ObjList* list = obj_list_new(vm);
+    vm_stack_push(vm, value_make_obj(list));
+    obj_list_append(vm, list, value_make_number(fds[0]));
+    obj_list_append(vm, list, value_make_number(fds[1]));
+    vm_stack_pop(vm);
+
+    native_return(value_make_obj(list));
+}
+
+static bool native_fn_read(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 2)) return false;
+
+    int fd;
+    if (!arg_fd(vm, args[0], &fd)) return false;
+
+    int size = LOOP_READ_DEFAULT;
+    if (argc == 2)
+    {
+        if (!value_is_number(args[1]) || value_as_number(args[1]) < 1)
+        {
+            vm_raise_runtime_error(vm, "read size must be a positive number.");
+            return false;
+        }
+
+        size = (int)value_as_number(args[1]);
+    }
+
+    char* buffer = (char*)malloc(size);
+    if (buffer == NULL) exit(1);
+
+    ssize_t count = read(fd, buffer, size);
+    if (count < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+        free(buffer);
+
+        Waiter* waiter = waiter_new(WAIT_READ, fd);
+        waiter->size = size;
+        return loop_wait(vm, args, waiter, EPOLLIN);
+    }
+
+    Value result = value_make_nil();
+    if (count >= 0)
+        result = value_make_obj(obj_string_cpy(vm, buffer, (int)count));
+
+    free(buffer);
+    native_return(result);
+}
+
+static bool native_fn_write(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 2, 2)) return false;
+
+    int fd;
+    if (!arg_fd(vm, args[0], &fd)) return false;
+    if (!arg_string(vm, args[1], "data to write")) return false;
+
+    ObjString* data = obj_as_string(args[1]);
+    ssize_t count = write(fd, data->chars, data->length);
+
+    if (count < 0 && errno != EAGAIN && errno != EINTR)
+        native_return(value_make_nil());
+
+    if (count == data->length) native_return(value_make_number(count));
+
+    Waiter* waiter = waiter_new(WAIT_WRITE, fd);
+    waiter->data = data;
+    waiter->written = count > 0 ? (size_t)count : 0;
+    return loop_wait(vm, args, waiter, EPOLLOUT);
+}
+
+static bool native_fn_close(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+
+    int fd;
+    if (!arg_fd(vm, args[0], &fd)) return false;
+
+    // Fibers waiting on the descriptor would never hear from it again.
+    Loop* loop = vm->loop;
+    Watch* watch = watch_find(loop, fd);
+    if (watch != NULL)
+    {
+        while (watch->waiters != NULL)
+            waiter_finish(vm, watch->waiters, value_make_nil());
+
+        watch_arm(loop, fd);
+    }
+
+    native_return(value_make_bool(close(fd) == 0));
+}
+
+static bool native_fn_listen(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+    if (!arg_string(vm, args[0], "socket path")) return false;
+
+    struct sockaddr_un address;
+    if (!unix_address_make(vm, obj_as_string(args[0]), &address)) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) native_return(value_make_nil());
+
+    unlink(address.sun_path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(fd, SOMAXCONN) != 0)
+    {
+        close(fd);
+        native_return(value_make_nil());
+    }
+
+    native_return(value_make_number(fd));
+}
+
+static bool native_fn_accept(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+
+    int listener;
+    if (!arg_fd(vm, args[0], &listener)) return false;
+
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) native_return(value_make_number(fd));
+
+    if (errno != EAGAIN && errno != EINTR) native_return(value_make_nil());
+
+    return loop_wait(vm, args, waiter_new(WAIT_ACCEPT, listener), EPOLLIN);
+}
+
+static bool native_fn_connect(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+    if (!arg_string(vm, args[0], "socket path")) return false;
+
+    struct sockaddr_un address;
+    if (!unix_address_make(vm, obj_as_string(args[0]), &address)) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) native_return(value_make_nil());
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+        native_return(value_make_number(fd));
+
+    if (errno != EAGAIN && errno != EINPROGRESS)
+    {
+        close(fd);
+        native_return(value_make_nil());
+    }
+
+    return loop_wait(vm, args, waiter_new(WAIT_CONNECT, fd), EPOLLOUT);
+}
+
+static bool file_start(VM* vm, Value* args, ObjString* data)
+{
+    FileJob* job = file_job_start(obj_as_cstring(args[0]), data);
+    if (job == NULL) native_return(value_make_nil());
+
+    Waiter* waiter = waiter_new(WAIT_FILE, job->event_fd);
+    waiter->job = job;
+    return loop_wait(vm, args, waiter, EPOLLIN);
+}
+
+static bool native_fn_read_file(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 1, 1)) return false;
+    if (!arg_string(vm, args[0], "file path")) return false;
+
+    return file_start(vm, args, NULL);
+}
+
+static bool native_fn_write_file(VM* vm, int argc, Value* args)
+{
+    if (!args_check(vm, argc, 2, 2)) return false;
+    if (!arg_string(vm, args[0], "file path")) return false;
+    if (!arg_string(vm, args[1], "data to write")) return false;
+
+    return file_start(vm, args, obj_as_string(args[1]));
+}
+
+void loop_define_natives(VM* vm)
+{
+    vm_define_native_fn(vm, "spawn", native_fn_spawn);
+    vm_define_native_fn(vm, "sleep", native_fn_sleep);
+    vm_define_native_fn(vm, "pipe", native_fn_pipe);
+    vm_define_native_fn(vm, "read", native_fn_read);
+    vm_define_native_fn(vm, "write", native_fn_write);
+    vm_define_native_fn(vm, "close", native_fn_close);
+    vm_define_native_fn(vm, "listen", native_fn_listen);
+    vm_define_native_fn(vm, "accept", native_fn_accept);
+    vm_define_native_fn(vm, "connect", native_fn_connect);
+    vm_define_native_fn(vm, "readFile", native_fn_read_file);
+    vm_define_native_fn(vm, "writeFile", native_fn_write_file);
+}
@@ -0,0 +1,28 @@
+#ifndef CLOX_LOOP_H_
+#define CLOX_LOOP_H_
+
+#include "general.h"
+#include "object.h"
+
+// Per-VM event loop. Natives that would block park the calling fiber on an
+// epoll registration and switch to the next runnable fiber, the parked one
+// is queued again with the result in its native's result slot once the
+// descriptor is ready.
+typedef struct Loop Loop;
+
+void loop_init(VM* vm);
+void loop_free(VM* vm);
+
+// Abandons every queued and waiting fiber, used after a runtime error.
+void loop_reset(VM* vm);
+
+void loop_define_natives(VM* vm);
+
+// Returns the next fiber to run, blocking until one becomes runnable, or
+// NULL once nothing is queued or waiting anymore.
+ObjFiber* loop_next(VM* vm);
+
+void gc_mark_loop(VM* vm);
+void gc_forward_loop(VM* vm);
+
+#endif // CLOX_LOOP_H_
@@ -1,19 +1,43 @@
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocs.h"
 #include "chunk.h"
 #include "debug.h"
 #include "general.h"
+#include "memory.h"
+#include "profile.h"
+#include "sampler.h"
+#include "server.h"
+#include "snapshot.h"
 #include "vm.h"
 
 #define CLOX_REPL_EXIT ":q"
+#define SAMPLER_HZ 1000
+#define ALLOCS_REPORT_SITES 20
 
-static void repl()
+static VM* repl_vm;
+
+static void repl_interrupt(int signal)
+{
+    (void)signal;
+    vm_interrupt(repl_vm);
+}
+
+static void repl(VM* vm)
 {
     puts("clox REPL");
     printf("Type '%s' to exit.\n", CLOX_REPL_EXIT);
 
+    // Ctrl-C stops the running line instead of the REPL.
+    repl_vm = vm;
+    struct sigaction action = {0};
+    action.sa_handler = repl_interrupt;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, NULL);
+
     char line[1024];
 
     while (true)
@@ -28,7 +52,8 @@ static void repl()
 
         if (strncmp(line, CLOX_REPL_EXIT, strlen(CLOX_REPL_EXIT)) == 0) break;
 
-        vm_interpret(line);
+        if (vm_interpret(vm, line) == INTERPRET_INTERRUPTED)
+            puts("Interrupted.");
     }
 }
 
@@ -65,31 +90,249 @@ static char* file_read(const char* path)
     return buffer;
 }
 
-static void file_run(const char* path)
+static int file_run(VM* vm, const char* path)
 {
     char* source = file_read(path);
-    InterpretResult result = vm_interpret(source);
+    InterpretResult result = vm_interpret(vm, source);
     free(source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    if (result == INTERPRET_INTERRUPTED)
+    {
+        fputs("Out of fuel.\n", stderr);
+        return 75;
+    }
+    return 0;
+}
+
+static void gc_stats_print(VM* vm)
+{
+    GcStats stats;
+    gc_stats(vm, &stats);
+
+    fprintf(stderr,
+            "gc: %llu collections, %llu compactions, pause total %.3fms, "
+            "max %.3fms\n"
+            "gc: %zu bytes freed, %zu live after the last sweep, %zu now\n",
+            (unsigned long long)stats.collections,
+            (unsigned long long)stats.compactions, stats.pause_total_ns / 1e6,
+            stats.pause_max_ns / 1e6, stats.bytes_freed, stats.live_bytes,
+            (size_t)gc_bytes_allocated(vm));
+
+    for (int i = 0; i < OBJ_TYPE_COUNT; ++i)
+    {
+        if (stats.objects[i] == 0) continue;
+        fprintf(stderr, "gc: %8zu %s\n", stats.objects[i],
+                obj_type_name((ObjType)i));
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: clox [options] [--image image] [path]\n"
+                    "       clox --save-image image prelude-path\n"
+                    "       clox --serve [--heap-limit bytes] [--fuel count] "
+                    "[socket-path]\n"
+                    "Options:\n"
+                    "  --gc-threads count       markers tracing large heaps\n"
+                    "  --gc-parallel-min bytes  heap size to trace in "
+                    "parallel from\n"
+                    "  --gc-no-compact          never move objects to release "
+                    "sparse pages\n"
+                    "  --gc-grow factor         heap growth between "
+                    "collections\n"
+                    "  --gc-heap-min bytes      heap size to start "
+                    "collecting at\n"
+                    "  --gc-heap-max bytes      heap size to collect at the "
+                    "latest\n"
+                    "  --gc-stats               print collector statistics "
+                    "on exit\n"
+                    "  --heap-limit bytes       fail with out of memory "
+                    "past this heap size\n"
+                    "  --fuel count             interrupt scripts after this "
+                    "many loops and calls\n"
+                    "  --profile                print time spent per opcode, "
+                    "function and line\n"
+                    "  --sample path            write sampled stacks for "
+                    "flamegraphs to path\n"
+                    "  --sample-hz hz           samples per CPU second, "
+                    "1000 by default\n"
+                    "  --alloc-profile          print the lines allocating "
+                    "the most\n"
+                    "  --alloc-every count      record only every count-th "
+                    "allocation\n");
+}
+
+static int serve(int argc, const char* argv[])
+{
+    const char* socket_path = NULL;
+    long long heap_limit = 0;
+    long long fuel = 0;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc &&
+            (heap_limit = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc &&
+                 (fuel = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (argv[i][0] != '-' && socket_path == NULL)
+            socket_path = argv[i];
+        else
+        {
+            usage();
+            return 64;
+        }
+    }
+
+    return server_run(socket_path, (size_t)heap_limit, (uint64_t)fuel);
 }
 
 int main(int argc, const char* argv[])
 {
-    vm_init();
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0)
+        return serve(argc, argv);
 
-    if (argc == 1)
-        repl();
-    else if (argc == 2)
-        file_run(argv[1]);
+    const char* image_path = NULL;
+    const char* save_image_path = NULL;
+    const char* path = NULL;
+    long gc_threads = 0;
+    long long gc_parallel_min = -1;
+    bool gc_compact = true;
+    double gc_grow = 0;
+    long long gc_heap_min = -1;
+    long long gc_heap_max = -1;
+    long long heap_limit = -1;
+    long long fuel = -1;
+    bool print_gc_stats = false;
+    bool profile = false;
+    const char* sample_path = NULL;
+    long sample_hz = SAMPLER_HZ;
+    long alloc_every = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--image") == 0 && i + 1 < argc)
+            image_path = argv[++i];
+        else if (strcmp(argv[i], "--save-image") == 0 && i + 1 < argc)
+            save_image_path = argv[++i];
+        else if (strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc &&
+                 (gc_threads = strtol(argv[++i], NULL, 10)) > 0)
+            continue;
+        else if (strcmp(argv[i], "--gc-parallel-min") == 0 && i + 1 < argc &&
+                 (gc_parallel_min = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--gc-no-compact") == 0)
+            gc_compact = false;
+        else if (strcmp(argv[i], "--gc-grow") == 0 && i + 1 < argc &&
+                 (gc_grow = strtod(argv[++i], NULL)) > 1)
+            continue;
+        else if (strcmp(argv[i], "--gc-heap-min") == 0 && i + 1 < argc &&
+                 (gc_heap_min = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--gc-heap-max") == 0 && i + 1 < argc &&
+                 (gc_heap_max = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc &&
+                 (heap_limit = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc &&
+                 (fuel = strtoll(argv[++i], NULL, 10)) >= 0)
+            continue;
+        else if (strcmp(argv[i], "--gc-stats") == 0)
+            print_gc_stats = true;
+        else if (strcmp(argv[i], "--profile") == 0)
+            profile = true;
+        else if (strcmp(argv[i], "--alloc-profile") == 0)
+            alloc_every = alloc_every > 0 ? alloc_every : 1;
+        else if (strcmp(argv[i], "--alloc-every") == 0 && i + 1 < argc &&
+                 (alloc_every = strtol(argv[++i], NULL, 10)) > 0)
+            continue;
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+            sample_path = argv[++i];
+        else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc &&
+                 (sample_hz = strtol(argv[++i], NULL, 10)) > 0 &&
+                 sample_hz <= 1000000)
+            continue;
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else
+        {
+            usage();
+            return 64;
+        }
+    }
+
+    if (save_image_path != NULL && path == NULL)
+    {
+        usage();
+        return 64;
+    }
+
+    static VM vm;
+    vm_init(&vm);
+    if (gc_threads > 0) vm.gc_threads = (int)gc_threads;
+    if (gc_parallel_min >= 0) vm.gc_parallel_threshold = gc_parallel_min;
+    vm.gc_compact = gc_compact;
+    if (gc_grow > 1) vm.gc_grow_factor = gc_grow;
+    if (gc_heap_min >= 0) vm.gc_heap_min = vm.next_gc = gc_heap_min;
+    if (gc_heap_max >= 0) vm.gc_heap_max = gc_heap_max;
+    if (heap_limit >= 0) vm.heap_limit = heap_limit;
+    if (fuel >= 0) vm.fuel_limit = fuel;
+    if (profile) vm.profile = profile_new();
+    if (alloc_every > 0) vm.allocs = allocs_new((int)alloc_every);
+
+    if (sample_path != NULL)
+    {
+        vm.sampler = sampler_new();
+        if (!sampler_start(vm.sampler, &vm, (int)sample_hz))
+        {
+            fprintf(stderr, "Could not start the sampler.\n");
+            exit(71);
+        }
+    }
+
+    if (image_path != NULL && !snapshot_load(&vm, image_path)) exit(74);
+
+    int status = 0;
+    if (path == NULL)
+        repl(&vm);
     else
+        status = file_run(&vm, path);
+
+    if (print_gc_stats) gc_stats_print(&vm);
+    if (vm.sampler != NULL)
+    {
+        sampler_stop(vm.sampler);
+        if (!sampler_write(vm.sampler, sample_path))
+            fprintf(stderr, "Could not write samples to '%s'.\n", sample_path);
+
+        sampler_free(vm.sampler);
+        vm.sampler = NULL;
+    }
+
+    if (vm.allocs != NULL)
     {
-        fprintf(stderr, "Usage: clox [path]\n");
+        allocs_report(vm.allocs, stderr, ALLOCS_REPORT_SITES);
+        allocs_free(vm.allocs);
+        vm.allocs = NULL;
     }
 
+    if (vm.profile != NULL)
+    {
+        profile_report(vm.profile, stderr);
+        profile_free(vm.profile);
+        vm.profile = NULL;
+    }
+    if (status != 0) exit(status);
+
+    if (save_image_path != NULL && !snapshot_save(&vm, save_image_path))
+        exit(74);
+
     // Clean ups
-    vm_free();
+    vm_free(&vm);
 
     return 0;
-}
\ No newline at end of file
+}
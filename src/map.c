@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+#define MAP_MAX_LOAD 0.75
+
+static uint32_t map_hash(Value key)
+{
+    uint64_t bits;
+
+    if (obj_is_string(key))
+    {
+        bits = obj_as_string(key)->hash;
+    }
+    else if (value_is_number(key))
+    {
+        // Adding zero turns -0 into 0, the two are equal keys.
+        double number = value_as_number(key) + 0.0;
+        memcpy(&bits, &number, sizeof(bits));
+    }
+    else if (value_is_obj(key))
+    {
+        bits = (uint64_t)(uintptr_t)value_as_obj(key);
+    }
+    else
+    {
+        bits = value_is_nil(key) ? 1 : value_as_bool(key) ? 3 : 2;
+    }
+
+    // The MurmurHash3 finalizer, so the low bits picking the slot depend on
+    // all of them.
+    bits ^= bits >> 33;
+    bits *= UINT64_C(0xff51afd7ed558ccd);
+    bits ^= bits >> 33;
+    bits *= UINT64_C(0xc4ceb9fe1a85ec53);
+    bits ^= bits >> 33;
+
+    uint32_t hash = (uint32_t)bits;
+    return hash < MAP_HASH_MIN ? hash + MAP_HASH_MIN : hash;
+}
+
+static MapEntry* entry_find(MapEntry* entries, int capacity, Value key,
+                            uint32_t hash)
+{
+    uint32_t index = hash & (capacity - 1);
+    MapEntry* tombstone = NULL;
+
+    while (true)
+    {
+        MapEntry* entry = &entries[index];
+
+        if (entry->hash == MAP_EMPTY)
+            return tombstone != NULL ? tombstone : entry;
+
+        if (entry->hash == MAP_TOMBSTONE)
+        {
+            if (tombstone == NULL) tombstone = entry;
+        }
+        else if (entry->hash == hash && value_check_equality(entry->key, key))
+        {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void entries_clear(MapEntry* entries, int capacity)
+{
+    for (int i = 0; i < capacity; ++i)
+    {
+        entries[i].key = value_make_nil();
+        entries[i].value = value_make_nil();
+        entries[i].hash = MAP_EMPTY;
+    }
+}
+
+bool map_get(ObjMap* map, Value key, Value* out_value)
+{
+    if (map->count == 0) return false;
+
+    MapEntry* entry =
+        entry_find(map->entries, map->capacity, key, map_hash(key));
+    if (entry->hash < MAP_HASH_MIN) return false;
+
+    *out_value = entry->value;
+    return true;
+}
+
+static void capacity_adjust(VM* vm, ObjMap* map, int capacity)
+{
+    MapEntry* entries = mem_alloc(vm, MapEntry, capacity);
+    entries_clear(entries, capacity);
+
+    // Tombstones are left behind.
+    for (int i = 0; i < map->capacity; ++i)
+    {
+        MapEntry* entry = &map->entries[i];
+        if (entry->hash < MAP_HASH_MIN) continue;
+
+        *entry_find(entries, capacity, entry->key, entry->hash) = *entry;
+    }
+
+    array_free(vm, MapEntry, map->entries, map->capacity);
+
+    map->entries = entries;
+    map->capacity = capacity;
+    map->used = map->count;
+}
+
+bool map_set(VM* vm, ObjMap* map, Value key, Value value)
+{
+    if (map->used + 1 > map->capacity * MAP_MAX_LOAD)
+    {
+        // Mostly tombstones only need sweeping out.
+        int capacity = map->capacity;
+        if (map->count + 1 > capacity * MAP_MAX_LOAD / 2)
+            capacity = capacity_grow(capacity);
+
+        capacity_adjust(vm, map, capacity);
+    }
+
+    uint32_t hash = map_hash(key);
+    MapEntry* entry = entry_find(map->entries, map->capacity, key, hash);
+    bool is_new_key = entry->hash < MAP_HASH_MIN;
+
+    if (is_new_key)
+    {
+        if (entry->hash == MAP_EMPTY) map->used++;
+        map->count++;
+    }
+
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+
+    return is_new_key;
+}
+
+bool map_delete(ObjMap* map, Value key)
+{
+    if (map->count == 0) return false;
+
+    MapEntry* entry =
+        entry_find(map->entries, map->capacity, key, map_hash(key));
+    if (entry->hash < MAP_HASH_MIN) return false;
+
+    entry->key = value_make_nil();
+    entry->value = value_make_nil();
+    entry->hash = MAP_TOMBSTONE;
+    map->count--;
+
+    return true;
+}
+
+int map_entries_copy(ObjMap* map, Value* out, bool keys)
+{
+    int count = 0;
+    for (int i = 0; i < map->capacity; ++i)
+    {
+        MapEntry* entry = &map->entries[i];
+        if (entry->hash < MAP_HASH_MIN) continue;
+
+        out[count++] = keys ? entry->key : entry->value;
+    }
+
+    return count;
+}
+
+void map_reserve(VM* vm, ObjMap* map, int count)
+{
+    int capacity = map->capacity;
+    while (count > capacity * MAP_MAX_LOAD) capacity = capacity_grow(capacity);
+
+    if (capacity > map->capacity) capacity_adjust(vm, map, capacity);
+}
+
+void map_rehash(ObjMap* map)
+{
+    if (map->count == 0) return;
+
+    // Runs inside a compaction, which must not allocate from the VM.
+    MapEntry* live = (MapEntry*)malloc(sizeof(MapEntry) * map->count);
+    if (live == NULL) exit(1);
+
+    int count = 0;
+    for (int i = 0; i < map->capacity; ++i)
+    {
+        if (map->entries[i].hash >= MAP_HASH_MIN)
+            live[count++] = map->entries[i];
+    }
+
+    entries_clear(map->entries, map->capacity);
+
+    for (int i = 0; i < count; ++i)
+    {
+        uint32_t hash = map_hash(live[i].key);
+        MapEntry* entry =
+            entry_find(map->entries, map->capacity, live[i].key, hash);
+
+        entry->key = live[i].key;
+        entry->value = live[i].value;
+        entry->hash = hash;
+    }
+
+    map->used = count;
+    free(live);
+}
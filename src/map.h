@@ -0,0 +1,33 @@
+#ifndef CLOX_MAP_H_
+#define CLOX_MAP_H_
+
+#include "general.h"
+#include "object.h"
+
+// Hashes of slots without a key, any key's hash is at least MAP_HASH_MIN.
+#define MAP_EMPTY 0
+#define MAP_TOMBSTONE 1
+#define MAP_HASH_MIN 2
+
+// Open addressing like Table, keyed by values. Keys are equal like `==`
+// says, strings by content through interning and other objects by identity.
+// NaN equals nothing, so it cannot be a key.
+bool map_get(ObjMap* map, Value key, Value* out_value);
+
+// Returns whether key is new. Key and value have to be rooted, growing the
+// map may collect.
+bool map_set(VM* vm, ObjMap* map, Value key, Value value);
+bool map_delete(ObjMap* map, Value key);
+
+// Writes every key, or every value, to out in slot order and returns how many
+// there were.
+int map_entries_copy(ObjMap* map, Value* out, bool keys);
+
+// Makes room for count keys without growing again.
+void map_reserve(VM* vm, ObjMap* map, int count);
+
+// Puts every key back where its hash says, after compaction moved objects
+// hashed by their address.
+void map_rehash(ObjMap* map);
+
+#endif // CLOX_MAP_H_
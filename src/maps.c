@@ -0,0 +1,81 @@
+#include "map.h"
+#include "maps.h"
+#include "vm.h"
+
+static bool args_count_check(VM* vm, int argc, int count)
+{
+    if (argc == count) return true;
+
+    vm_raise_runtime_error(vm, "insufficient arguments, need %d got=%d", count,
+                           argc);
+    return false;
+}
+
+static bool arg_map(VM* vm, Value value, ObjMap** out_map)
+{
+    if (!obj_is_map(value))
+    {
+        vm_raise_runtime_error(vm, "argument must be a map.");
+        return false;
+    }
+
+    *out_map = obj_as_map(value);
+    return true;
+}
+
+// A list of every key, or every value, in the map's slot order.
+static bool map_collect(VM* vm, Value* args, ObjMap* map, bool keys)
+{
+    ObjList* list = obj_list_new(vm);
+    vm_stack_push(vm, value_make_obj(list));
+    obj_list_reserve(vm, list, map->count);
+    list->count = map_entries_copy(map, list->items, keys);
+
+    native_return(value_make_obj(list));
+}
+
+static bool native_fn_map_keys(VM* vm, int argc, Value* args)
+{
+    ObjMap* map;
+    if (!args_count_check(vm, argc, 1) || !arg_map(vm, args[0], &map))
+        return false;
+
+    return map_collect(vm, args, map, true);
+}
+
+static bool native_fn_map_values(VM* vm, int argc, Value* args)
+{
+    ObjMap* map;
+    if (!args_count_check(vm, argc, 1) || !arg_map(vm, args[0], &map))
+        return false;
+
+    return map_collect(vm, args, map, false);
+}
+
+static bool native_fn_map_has(VM* vm, int argc, Value* args)
+{
+    ObjMap* map;
+    if (!args_count_check(vm, argc, 2) || !arg_map(vm, args[0], &map))
+        return false;
+
+    Value value;
+    native_return(value_make_bool(map_get(map, args[1], &value)));
+}
+
+// remove(map, key) tells whether the key was there.
+static bool native_fn_map_remove(VM* vm, int argc, Value* args)
+{
+    ObjMap* map;
+    if (!args_count_check(vm, argc, 2) || !arg_map(vm, args[0], &map))
+        return false;
+
+    native_return(value_make_bool(map_delete(map, args[1])));
+}
+
+void maps_define_natives(VM* vm)
+{
+    vm_define_native_fn(vm, "keys", native_fn_map_keys);
+    vm_define_native_fn(vm, "values", native_fn_map_values);
+    vm_define_native_fn(vm, "has", native_fn_map_has);
+    vm_define_native_fn(vm, "remove", native_fn_map_remove);
+}
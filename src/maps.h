@@ -0,0 +1,11 @@
+#ifndef CLOX_MAPS_H_
+#define CLOX_MAPS_H_
+
+#include "general.h"
+#include "object.h"
+
+// Natives on maps: keys and values copy them out into a list, has and
+// remove look a key up.
+void maps_define_natives(VM* vm);
+
+#endif // CLOX_MAPS_H_
@@ -1,6 +1,14 @@
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "allocs.h"
 #include "compiler.h"
+#include "loop.h"
+#include "map.h"
 #include "memory.h"
 #include "vm.h"
 
@@ -9,20 +17,76 @@
 #include <stdio.h>
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+#define GC_THREADS_MAX 16
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size)
+// Smaller heaps are swept in less time than it takes to start a thread.
+#define GC_SWEEP_BACKGROUND_MIN (1024 * 1024)
+
+// Pages of smaller heaps are not worth compacting.
+#define GC_COMPACT_MIN (1024 * 1024)
+
+// A marker holding more gray objects than this offers half of them to the
+// idle ones.
+#define GC_SHARE_MIN 32
+
+// Bytes released on this thread. A sweep reads it before and after, which
+// tells its frees apart from whatever the mutator does meanwhile.
+static _Thread_local size_t gc_freed;
+
+// Runs a full collection once the heap outgrew vm->heap_limit and flags the
+// VM out of memory when that did not bring it back below. The allocation
+// still succeeds, callers are not prepared for it to fail, the interpreter
+// raises the error once it takes the interrupt instead.
+static void gc_last_chance(VM* vm)
+{
+    if (vm->out_of_memory) return;
+
+    gc_sweep_finish(vm);
+    if (gc_bytes_allocated(vm) > vm->heap_limit)
+    {
+        gc_perform(vm);
+        gc_sweep_finish(vm);
+    }
+
+    vm->out_of_memory = gc_bytes_allocated(vm) > vm->heap_limit;
+    if (vm->out_of_memory) vm_interrupt(vm);
+}
+
+static void gc_account(VM* vm, size_t old_size, size_t new_size)
 {
-    vm.bytes_allocated += new_size - old_size;
+    if (new_size < old_size) gc_freed += old_size - new_size;
+
+    // A background sweep frees through here as well.
+    size_t allocated =
+        atomic_fetch_add_explicit(&vm->bytes_allocated, new_size - old_size,
+                                  memory_order_relaxed) +
+        (new_size - old_size);
 
     if (new_size > old_size)
     {
+        if (atomic_load_explicit(&vm->sweep.finished, memory_order_relaxed))
+        {
+            gc_sweep_finish(vm);
+            allocated = gc_bytes_allocated(vm);
+        }
+
 #ifdef DEBUG_STRESS_GC
-        gc_perform();
+        gc_perform(vm);
 #endif
 
-        if (vm.bytes_allocated > vm.next_gc) gc_perform();
+        if (allocated > vm->next_gc) gc_perform(vm);
+
+        if (vm->heap_limit > 0 && gc_bytes_allocated(vm) > vm->heap_limit)
+            gc_last_chance(vm);
     }
+}
+
+void* reallocate(VM* vm, void* pointer, size_t old_size, size_t new_size)
+{
+    gc_account(vm, old_size, new_size);
+
+    if (vm->allocs != NULL && new_size > old_size)
+        allocs_record(vm->allocs, vm, ALLOCS_BUFFER, new_size - old_size);
 
     if (new_size == 0)
     {
@@ -31,50 +95,91 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size)
     }
 
     void* result = realloc(pointer, new_size);
-    if (result == NULL) exit(1);
+    if (result == NULL)
+    {
+        // The system ran out before the heap limit did, free what we can.
+        gc_perform(vm);
+        gc_sweep_finish(vm);
+
+        result = realloc(pointer, new_size);
+        if (result == NULL) exit(1);
+    }
+
     return result;
 }
 
-void gc_mark_obj(Obj* object)
+Obj* gc_obj_alloc(VM* vm, size_t size)
+{
+    // Collect before taking the slot, nothing refers to it yet.
+    gc_account(vm, 0, heap_slot_size(size));
+    return heap_alloc(&vm->heap, size);
+}
+
+static void gray_reserve(GrayStack* gray, int count)
+{
+    if (gray->capacity >= gray->count + count) return;
+
+    while (gray->capacity < gray->count + count)
+        gray->capacity = capacity_grow(gray->capacity);
+
+    // Plain realloc, growing the gray stack must not start another collection.
+    gray->items = (Obj**)realloc(gray->items, sizeof(Obj*) * gray->capacity);
+    if (gray->items == NULL) exit(1);
+}
+
+static void gray_mark_obj(GrayStack* gray, Obj* object)
 {
     if (object == NULL) return;
-    if (object->is_marked) return;
+
+    // Two markers may race to the same object, only one of them grays it.
+    if (!heap_mark(object)) return;
 
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
-    value_print(value_make_obj(object));
+    value_print(stdout, value_make_obj(object));
     puts("");
 #endif
 
-    object->is_marked = true;
+    gray_reserve(gray, 1);
+    gray->items[gray->count++] = object;
+}
 
-    if (vm.gray_capacity < vm.gray_count + 1)
-    {
-        vm.gray_capacity = capacity_grow(vm.gray_capacity);
-        vm.gray_stack =
-            (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+static void gray_mark_value(GrayStack* gray, Value value)
+{
+    if (value_is_obj(value)) gray_mark_obj(gray, value_as_obj(value));
+}
 
-        if (vm.gray_stack == NULL) exit(1);
-    }
+static void gray_mark_array(GrayStack* gray, ValueArray* array)
+{
+    for (int i = 0; i < array->count; ++i)
+        gray_mark_value(gray, array->values[i]);
+}
 
-    vm.gray_stack[vm.gray_count++] = object;
+static void gray_mark_table(GrayStack* gray, Table* table)
+{
+    for (int i = 0; i < table->capacity; ++i)
+    {
+        Entry* entry = &table->entries[i];
+        gray_mark_obj(gray, (Obj*)entry->key);
+        gray_mark_value(gray, entry->value);
+    }
 }
 
-void gc_mark_value(Value value)
+void gc_mark_obj(VM* vm, Obj* object)
 {
-    if (value_is_obj(value)) gc_mark_obj(value_as_obj(value));
+    gray_mark_obj(&vm->gray, object);
 }
 
-static void gc_mark_array(ValueArray* array)
+void gc_mark_value(VM* vm, Value value)
 {
-    for (int i = 0; i < array->count; ++i) gc_mark_value(array->values[i]);
+    gray_mark_value(&vm->gray, value);
 }
 
-static void gc_blacken_obj(Obj* object)
+static void gc_blacken_obj(GrayStack* gray, Obj* object)
 {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)object);
-    value_print(value_make_obj(object));
+    value_print(stdout, value_make_obj(object));
     puts("");
 #endif
 
@@ -83,223 +188,737 @@ static void gc_blacken_obj(Obj* object)
         case OBJ_BOUND_METHOD:
         {
             ObjBoundMethod* bound = (ObjBoundMethod*)object;
-            gc_mark_value(bound->receiver);
-            gc_mark_obj((Obj*)bound->method);
+            gray_mark_value(gray, bound->receiver);
+            gray_mark_obj(gray, (Obj*)bound->method);
             break;
         }
 
         case OBJ_CLASS:
         {
             ObjClass* cls = (ObjClass*)object;
-            gc_mark_obj((Obj*)cls->name);
-            gc_mark_table(&cls->methods);
+            gray_mark_obj(gray, (Obj*)cls->name);
+            gray_mark_table(gray, &cls->methods);
             break;
         }
 
         case OBJ_INSTANCE:
         {
             ObjInstance* instance = (ObjInstance*)object;
-            gc_mark_obj((Obj*)instance->cls);
-            gc_mark_table(&instance->fields);
+            gray_mark_obj(gray, (Obj*)instance->cls);
+            gray_mark_table(gray, &instance->fields);
             break;
         }
 
         case OBJ_CLOSURE:
         {
             ObjClosure* closure = (ObjClosure*)object;
-            gc_mark_obj((Obj*)closure->function);
+            gray_mark_obj(gray, (Obj*)closure->function);
             for (int i = 0; i < closure->upvalue_count; ++i)
-                gc_mark_obj((Obj*)closure->upvalues[i]);
+                gray_mark_obj(gray, (Obj*)closure->upvalues[i]);
+
+            break;
+        }
+
+        case OBJ_FIBER:
+        {
+            ObjFiber* fiber = (ObjFiber*)object;
+            for (Value* slot = fiber->stack; slot < fiber->stack_top; ++slot)
+                gray_mark_value(gray, *slot);
 
+            for (int i = 0; i < fiber->frame_count; ++i)
+                gray_mark_obj(gray, (Obj*)fiber->frames[i].closure);
+
+            for (ObjUpValue* upvalue = fiber->open_upvalues; upvalue != NULL;
+                 upvalue = upvalue->next)
+            {
+                gray_mark_obj(gray, (Obj*)upvalue);
+            }
+
+            gray_mark_obj(gray, (Obj*)fiber->caller);
             break;
         }
 
         case OBJ_FUNCTION:
         {
             ObjFunction* function = (ObjFunction*)object;
-            gc_mark_obj((Obj*)function->name);
-            gc_mark_array(&function->chunk.constants);
+            gray_mark_obj(gray, (Obj*)function->name);
+            gray_mark_array(gray, &function->chunk.constants);
             break;
         }
 
         case OBJ_UPVALUE:
-            gc_mark_value(((ObjUpValue*)object)->closed);
+        {
+            // An open upvalue keeps the fiber owning its slot alive.
+            ObjUpValue* upvalue = (ObjUpValue*)object;
+            gray_mark_value(gray, upvalue->closed);
+            gray_mark_obj(gray, (Obj*)upvalue->fiber);
             break;
+        }
 
         case OBJ_NATIVE_FN:
         case OBJ_STRING:
+        case OBJ_FLOAT_ARRAY:
             break;
 
         case OBJ_LIST:
         {
             ObjList* list = (ObjList*)object;
-            for (int i = 0; i < list->count; ++i) gc_mark_value(list->items[i]);
+            for (int i = 0; i < list->count; ++i)
+                gray_mark_value(gray, list->items[i]);
+
+            break;
+        }
+
+        case OBJ_MAP:
+        {
+            ObjMap* map = (ObjMap*)object;
+            for (int i = 0; i < map->capacity; ++i)
+            {
+                MapEntry* entry = &map->entries[i];
+                if (entry->hash < MAP_HASH_MIN) continue;
+
+                gray_mark_value(gray, entry->key);
+                gray_mark_value(gray, entry->value);
+            }
 
             break;
         }
     }
 }
 
-static void object_free(Obj* object)
+static void object_free(VM* vm, Obj* object)
 {
 #ifdef DEBUG_LOG_GC
     printf("%p free type %d\n", (void*)object, object->type);
 #endif
 
+    // The slot itself is recycled by the heap, only what the object owns
+    // outside of it is freed here.
     switch (object->type)
     {
         case OBJ_BOUND_METHOD:
-            mem_free(ObjBoundMethod, object);
+        case OBJ_NATIVE_FN:
+        case OBJ_UPVALUE:
             break;
 
         case OBJ_CLASS:
         {
             ObjClass* cls = (ObjClass*)object;
-            table_free(&cls->methods);
-            mem_free(ObjClass, object);
+            table_free(vm, &cls->methods);
             break;
         }
 
         case OBJ_INSTANCE:
         {
             ObjInstance* instance = (ObjInstance*)object;
-            table_free(&instance->fields);
-            mem_free(ObjInstance, object);
+            table_free(vm, &instance->fields);
             break;
         }
 
         case OBJ_CLOSURE:
         {
             ObjClosure* closure = (ObjClosure*)object;
-            array_free(ObjUpValue*, closure->upvalues, closure->upvalue_count);
-            mem_free(ObjClosure, object);
+            array_free(vm, ObjUpValue*, closure->upvalues,
+                       closure->upvalue_count);
             break;
         }
 
-        case OBJ_FUNCTION:
+        case OBJ_FIBER:
         {
-            ObjFunction* function = (ObjFunction*)object;
-            chunk_free(&function->chunk);
-            mem_free(ObjFunction, object);
+            ObjFiber* fiber = (ObjFiber*)object;
+            array_free(vm, Value, fiber->stack, fiber->stack_capacity);
+            array_free(vm, CallFrame, fiber->frames, fiber->frame_capacity);
             break;
         }
 
-        case OBJ_NATIVE_FN:
-            mem_free(ObjNativeFn, object);
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            chunk_free(vm, &function->chunk);
             break;
+        }
 
         case OBJ_STRING:
         {
             ObjString* string = (ObjString*)object;
-            array_free(char, string->chars, string->length + 1);
-            mem_free(ObjString, object);
+            array_free(vm, char, string->chars, string->length + 1);
             break;
         }
 
-        case OBJ_UPVALUE:
-            mem_free(ObjUpValue, object);
-            break;
-
         case OBJ_LIST:
         {
             ObjList* list = (ObjList*)object;
-            array_free(Value*, list->items, list->count);
-            mem_free(ObjList, object);
+            array_free(vm, Value, list->items - list->front,
+                       list->front + list->capacity);
+            break;
+        }
+
+        case OBJ_FLOAT_ARRAY:
+        {
+            ObjFloatArray* array = (ObjFloatArray*)object;
+            array_free(vm, double, array->items, array->count);
+            break;
+        }
+
+        case OBJ_MAP:
+        {
+            ObjMap* map = (ObjMap*)object;
+            array_free(vm, MapEntry, map->entries, map->capacity);
             break;
         }
     }
+
+    gc_account(vm, heap_obj_size(object), 0);
 }
 
-static void gc_mark_roots()
+static void gc_mark_roots(VM* vm)
 {
-    for (Value* slot = vm.stack; slot < vm.stack_top; ++slot)
-        gc_mark_value(*slot);
+    // The running fiber reaches its callers, suspended fibers are reached
+    // through whatever values still refer to them.
+    gc_mark_obj(vm, (Obj*)vm->fiber);
+    gc_mark_obj(vm, (Obj*)vm->main_fiber);
+    gc_mark_loop(vm);
 
-    for (int i = 0; i < vm.frame_count; ++i)
-        gc_mark_obj((Obj*)vm.frames[i].closure);
+    gc_mark_table(vm, &vm->globals);
+    gc_mark_table(vm, &vm->builtins);
 
-    for (ObjUpValue* upvalue = vm.open_upvalues; upvalue != NULL;
-         upvalue = upvalue->next)
-        gc_mark_obj((Obj*)upvalue);
+    gc_mark_compiler_roots(vm);
+
+    gc_mark_obj(vm, (Obj*)vm->init_str);
+}
 
-    gc_mark_table(&vm.globals);
+///////////////////////////////////////////////////////////////////////////////////////
+// PARALLEL MARKING
+///////////////////////////////////////////////////////////////////////////////////////
 
-    gc_mark_compiler_roots();
+typedef struct MarkCrew MarkCrew;
 
-    gc_mark_obj((Obj*)vm.init_str);
+typedef struct
+{
+    MarkCrew* crew;
+    int index;
+    pthread_t thread;
+    bool running;
+    GrayStack local;
+
+    // The part of the gray set other markers may steal. available mirrors
+    // shared.count so idle markers can look for work without locking.
+    pthread_mutex_t lock;
+    GrayStack shared;
+    atomic_int available;
+} Marker;
+
+struct MarkCrew
+{
+    Marker* markers;
+    int count;
+    atomic_int idle;
+};
+
+static void marker_share(Marker* marker)
+{
+    // Hand out the older half, the objects grayed first tend to lead to the
+    // larger subgraphs.
+    int half = marker->local.count / 2;
+
+    pthread_mutex_lock(&marker->lock);
+    gray_reserve(&marker->shared, half);
+    memcpy(marker->shared.items + marker->shared.count, marker->local.items,
+           sizeof(Obj*) * half);
+    marker->shared.count += half;
+    atomic_store(&marker->available, marker->shared.count);
+    pthread_mutex_unlock(&marker->lock);
+
+    marker->local.count -= half;
+    memmove(marker->local.items, marker->local.items + half,
+            sizeof(Obj*) * marker->local.count);
 }
 
-static void gc_trace_refs()
+static bool marker_take(Marker* marker, Marker* victim, bool everything)
 {
-    while (vm.gray_count > 0)
-    {
-        Obj* object = vm.gray_stack[--vm.gray_count];
-        gc_blacken_obj(object);
-    }
+    pthread_mutex_lock(&victim->lock);
+    int count =
+        everything ? victim->shared.count : (victim->shared.count + 1) / 2;
+    victim->shared.count -= count;
+
+    gray_reserve(&marker->local, count);
+    memcpy(marker->local.items + marker->local.count,
+           victim->shared.items + victim->shared.count, sizeof(Obj*) * count);
+    marker->local.count += count;
+
+    atomic_store(&victim->available, victim->shared.count);
+    pthread_mutex_unlock(&victim->lock);
+
+    return count > 0;
 }
 
-static void gc_sweep()
+// Looks for work in the other markers' shared stacks. Returns false once
+// every marker ran out of work, which ends the trace.
+static bool marker_steal(Marker* marker)
 {
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
+    MarkCrew* crew = marker->crew;
+    atomic_fetch_add(&crew->idle, 1);
 
-    while (object != NULL)
+    while (atomic_load(&crew->idle) < crew->count)
     {
-        if (object->is_marked)
+        for (int i = 1; i < crew->count; ++i)
         {
-            object->is_marked = false;
-            previous = object;
-            object = object->next;
+            Marker* victim = &crew->markers[(marker->index + i) % crew->count];
+            if (atomic_load(&victim->available) == 0) continue;
+
+            // Leave the idle count before taking anything, so nobody sees
+            // the whole crew idle while this marker holds work.
+            atomic_fetch_sub(&crew->idle, 1);
+            if (marker_take(marker, victim, false)) return true;
+            atomic_fetch_add(&crew->idle, 1);
         }
-        else
+
+        sched_yield();
+    }
+
+    return false;
+}
+
+static void marker_drain(Marker* marker)
+{
+    do
+    {
+        while (marker->local.count > 0)
         {
-            Obj* unreached = object;
-            object = object->next;
+            Obj* object = marker->local.items[--marker->local.count];
+            gc_blacken_obj(&marker->local, object);
 
-            if (previous != NULL)
-            {
-                previous->next = object;
-            }
-            else
+            if (marker->local.count > GC_SHARE_MIN &&
+                atomic_load_explicit(&marker->available,
+                                     memory_order_relaxed) == 0)
             {
-                vm.objects = object;
+                marker_share(marker);
             }
-
-            object_free(unreached);
         }
+    } while ((atomic_load(&marker->available) > 0 &&
+              marker_take(marker, marker, true)) ||
+             marker_steal(marker));
+}
+
+static void* marker_main(void* arg)
+{
+    marker_drain((Marker*)arg);
+    return NULL;
+}
+
+static void gc_trace_refs_parallel(VM* vm)
+{
+    MarkCrew crew;
+    crew.count = vm->gc_threads;
+    crew.markers = (Marker*)calloc(crew.count, sizeof(Marker));
+    if (crew.markers == NULL) exit(1);
+    atomic_init(&crew.idle, 0);
+
+    for (int i = 0; i < crew.count; ++i)
+    {
+        Marker* marker = &crew.markers[i];
+        marker->crew = &crew;
+        marker->index = i;
+        pthread_mutex_init(&marker->lock, NULL);
+        atomic_init(&marker->available, 0);
+    }
+
+    // The roots all start out with the marker running on this thread, the
+    // others get going by stealing from it.
+    crew.markers[0].local = vm->gray;
+
+    for (int i = 1; i < crew.count; ++i)
+    {
+        Marker* marker = &crew.markers[i];
+        marker->running =
+            pthread_create(&marker->thread, NULL, marker_main, marker) == 0;
+
+        // A marker that never started holds no work, count it as idle.
+        if (!marker->running) atomic_fetch_add(&crew.idle, 1);
+    }
+
+    marker_drain(&crew.markers[0]);
+
+    for (int i = 0; i < crew.count; ++i)
+    {
+        Marker* marker = &crew.markers[i];
+        if (marker->running) pthread_join(marker->thread, NULL);
+        if (i > 0) free(marker->local.items);
+        free(marker->shared.items);
+        pthread_mutex_destroy(&marker->lock);
+    }
+
+    // Keep the roots' buffer around for the next collection.
+    vm->gray = crew.markers[0].local;
+    free(crew.markers);
+}
+
+static void gc_trace_refs(VM* vm)
+{
+    if (vm->gc_threads > 1 &&
+        gc_bytes_allocated(vm) >= vm->gc_parallel_threshold)
+    {
+        gc_trace_refs_parallel(vm);
+        return;
+    }
+
+    while (vm->gray.count > 0)
+    {
+        Obj* object = vm->gray.items[--vm->gray.count];
+        gc_blacken_obj(&vm->gray, object);
+    }
+}
+
+static size_t gc_next_threshold(VM* vm)
+{
+    double next = (double)gc_bytes_allocated(vm) * vm->gc_grow_factor;
+    if (vm->gc_heap_max > 0 && next > (double)vm->gc_heap_max)
+        next = (double)vm->gc_heap_max;
+    if (next < (double)vm->gc_heap_min) next = (double)vm->gc_heap_min;
+    if (vm->heap_limit > 0 && next > (double)vm->heap_limit)
+        next = (double)vm->heap_limit;
+
+    return (size_t)next;
+}
+
+static void gc_sweep_done(VM* vm, size_t freed)
+{
+    vm->gc_stats.bytes_freed += freed;
+    vm->gc_stats.live_bytes = gc_bytes_allocated(vm);
+    vm->next_gc = gc_next_threshold(vm);
+    if (!vm->gc_compact) return;
+
+    // With less than half of the slots in use, most pages are only kept
+    // around by a few survivors.
+    size_t used, capacity;
+    heap_occupancy(&vm->heap, &used, &capacity);
+    vm->gc_compact_pending = capacity >= GC_COMPACT_MIN && used * 2 < capacity;
+}
+
+static void* gc_sweep_main(void* arg)
+{
+    VM* vm = (VM*)arg;
+    size_t freed = gc_freed;
+    heap_sweep(vm, &vm->sweep.heap, object_free);
+    vm->sweep.freed = gc_freed - freed;
+    atomic_store(&vm->sweep.finished, true);
+    return NULL;
+}
+
+static void gc_sweep(VM* vm)
+{
+    if (gc_bytes_allocated(vm) < GC_SWEEP_BACKGROUND_MIN)
+    {
+        size_t freed = gc_freed;
+        heap_sweep(vm, &vm->heap, object_free);
+        gc_sweep_done(vm, gc_freed - freed);
+        return;
     }
+
+    // Every page allocated so far is the sweeper's now, the mutator starts
+    // filling fresh ones and gets the swept pages back in gc_sweep_finish.
+    heap_merge(&vm->sweep.heap, &vm->heap);
+
+    vm->sweep.running =
+        pthread_create(&vm->sweep.thread, NULL, gc_sweep_main, vm) == 0;
+    if (!vm->sweep.running) gc_sweep_main(vm);
+
+    // Garbage still counts until the sweep is done, so this is only a
+    // ceiling until gc_sweep_finish sets the real one.
+    vm->next_gc = gc_next_threshold(vm);
+}
+
+void gc_sweep_finish(VM* vm)
+{
+    if (vm->sweep.running) pthread_join(vm->sweep.thread, NULL);
+    else if (!atomic_load(&vm->sweep.finished)) return;
+
+    vm->sweep.running = false;
+    atomic_store(&vm->sweep.finished, false);
+
+    heap_merge(&vm->heap, &vm->sweep.heap);
+    gc_sweep_done(vm, vm->sweep.freed);
+}
+
+int gc_default_threads(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) return 1;
+    return cores > GC_THREADS_MAX ? GC_THREADS_MAX : (int)cores;
+}
+
+static uint64_t gc_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void gc_pause_end(VM* vm, uint64_t start)
+{
+    uint64_t pause = gc_now() - start;
+
+    vm->gc_stats.collections++;
+    vm->gc_stats.pause_total_ns += pause;
+    if (pause > vm->gc_stats.pause_max_ns) vm->gc_stats.pause_max_ns = pause;
 }
 
-void gc_perform()
+void gc_perform(VM* vm)
 {
 #ifdef DEBUG_LOG_GC
     puts("-- gc begin");
-    size_t before = vm.bytes_allocated;
 #endif
 
-    gc_mark_roots();
-    gc_trace_refs();
-    gc_table_remove_white(&vm.strings);
-    gc_sweep();
+    uint64_t start = gc_now();
 
-    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    // The previous sweep still owns part of the heap.
+    gc_sweep_finish(vm);
+
+#ifdef DEBUG_LOG_GC
+    size_t before = gc_bytes_allocated(vm);
+#endif
+
+    gc_mark_roots(vm);
+    gc_trace_refs(vm);
+    gc_table_remove_white(&vm->strings);
+    gc_sweep(vm);
+
+    gc_pause_end(vm, start);
 
 #ifdef DEBUG_LOG_GC
     puts("-- gc end");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+    size_t after = gc_bytes_allocated(vm);
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu%s\n",
+           before - after, before, after, vm->next_gc,
+           vm->sweep.running ? ", sweeping in the background" : "");
 #endif
 }
 
-void objects_free()
+///////////////////////////////////////////////////////////////////////////////////////
+// COMPACTION
+///////////////////////////////////////////////////////////////////////////////////////
+
+#define gc_forward(pointer) ((pointer) = (void*)heap_forward((Obj*)(pointer)))
+
+static void gc_forward_value(Value* value)
+{
+    if (value_is_obj(*value))
+        *value = value_make_obj(heap_forward(value_as_obj(*value)));
+}
+
+static void gc_forward_array(ValueArray* array)
 {
-    Obj* object = vm.objects;
-    while (object != NULL)
+    for (int i = 0; i < array->count; ++i) gc_forward_value(&array->values[i]);
+}
+
+static void gc_forward_table(Table* table)
+{
+    // Keys keep their hashes when they move, so every entry stays put.
+    for (int i = 0; i < table->capacity; ++i)
     {
-        Obj* next = object->next;
-        object_free(object);
-        object = next;
+        Entry* entry = &table->entries[i];
+        gc_forward(entry->key);
+        gc_forward_value(&entry->value);
     }
+}
+
+static void gc_forward_fields(Obj* object)
+{
+    switch (object->type)
+    {
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            gc_forward_value(&bound->receiver);
+            gc_forward(bound->method);
+            break;
+        }
+
+        case OBJ_CLASS:
+        {
+            ObjClass* cls = (ObjClass*)object;
+            gc_forward(cls->name);
+            gc_forward_table(&cls->methods);
+            break;
+        }
+
+        case OBJ_INSTANCE:
+        {
+            ObjInstance* instance = (ObjInstance*)object;
+            gc_forward(instance->cls);
+            gc_forward_table(&instance->fields);
+            break;
+        }
+
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)object;
+            gc_forward(closure->function);
+            for (int i = 0; i < closure->upvalue_count; ++i)
+                gc_forward(closure->upvalues[i]);
+
+            break;
+        }
+
+        case OBJ_FIBER:
+        {
+            ObjFiber* fiber = (ObjFiber*)object;
+            for (Value* slot = fiber->stack; slot < fiber->stack_top; ++slot)
+                gc_forward_value(slot);
+
+            for (int i = 0; i < fiber->frame_count; ++i)
+                gc_forward(fiber->frames[i].closure);
+
+            gc_forward(fiber->open_upvalues);
+            gc_forward(fiber->caller);
+            break;
+        }
+
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            gc_forward(function->name);
+            gc_forward_array(&function->chunk.constants);
+            break;
+        }
+
+        case OBJ_UPVALUE:
+        {
+            ObjUpValue* upvalue = (ObjUpValue*)object;
+            gc_forward_value(&upvalue->closed);
+            gc_forward(upvalue->fiber);
+            gc_forward(upvalue->next);
+            break;
+        }
+
+        case OBJ_NATIVE_FN:
+        case OBJ_STRING:
+        case OBJ_FLOAT_ARRAY:
+            break;
+
+        case OBJ_LIST:
+        {
+            ObjList* list = (ObjList*)object;
+            for (int i = 0; i < list->count; ++i)
+                gc_forward_value(&list->items[i]);
+
+            break;
+        }
+
+        case OBJ_MAP:
+        {
+            // Strings keep their hashes when they move, other objects are
+            // hashed by address and need their map rehashed.
+            ObjMap* map = (ObjMap*)object;
+            bool rehash = false;
+
+            for (int i = 0; i < map->capacity; ++i)
+            {
+                MapEntry* entry = &map->entries[i];
+                if (entry->hash < MAP_HASH_MIN) continue;
+
+                Value key = entry->key;
+                gc_forward_value(&entry->key);
+                gc_forward_value(&entry->value);
+
+                if (value_is_obj(key) && !obj_is_string(entry->key) &&
+                    value_as_obj(key) != value_as_obj(entry->key))
+                    rehash = true;
+            }
+
+            if (rehash) map_rehash(map);
+            break;
+        }
+    }
+}
+
+static void gc_moved(Obj* from, Obj* to)
+{
+    // A closed upvalue points at its own field.
+    if (to->type == OBJ_UPVALUE)
+    {
+        ObjUpValue* old = (ObjUpValue*)from;
+        ObjUpValue* upvalue = (ObjUpValue*)to;
+        if (old->location == &old->closed) upvalue->location = &upvalue->closed;
+    }
+}
+
+static void gc_forward_roots(VM* vm)
+{
+    gc_forward(vm->fiber);
+    gc_forward(vm->main_fiber);
+    gc_forward_loop(vm);
+
+    gc_forward_table(&vm->globals);
+    gc_forward_table(&vm->builtins);
+    gc_forward_table(&vm->strings);
+
+    gc_forward_compiler_roots(vm);
+
+    gc_forward(vm->init_str);
+}
+
+void gc_compact(VM* vm)
+{
+    uint64_t start = gc_now();
+
+    vm->gc_compact_pending = false;
+    gc_sweep_finish(vm);
+
+    gc_mark_roots(vm);
+    gc_trace_refs(vm);
+    gc_table_remove_white(&vm->strings);
+
+    Heap evacuated;
+    heap_init(&evacuated);
+
+    int pages = heap_evacuate(&vm->heap, &evacuated, gc_moved);
+    if (pages > 0)
+    {
+        gc_forward_roots(vm);
+
+        // Copies are marked as well, so this visits every survivor once.
+        HeapIter iter;
+        heap_iter_init(&iter, &vm->heap);
+        for (Obj* object; (object = heap_iter_next(&iter)) != NULL;)
+        {
+            if (heap_is_marked(object)) gc_forward_fields(object);
+        }
+
+        size_t freed = gc_freed;
+        heap_release(vm, &evacuated, object_free);
+        vm->gc_stats.bytes_freed += gc_freed - freed;
+    }
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc compact evacuated %d pages\n", pages);
+#endif
+
+    gc_sweep(vm);
+
+    vm->gc_stats.compactions++;
+    gc_pause_end(vm, start);
+}
+
+void gc_stats(VM* vm, GcStats* stats)
+{
+    gc_sweep_finish(vm);
+    *stats = vm->gc_stats;
+
+    for (int i = 0; i < OBJ_TYPE_COUNT; ++i) stats->objects[i] = 0;
+
+    HeapIter iter;
+    heap_iter_init(&iter, &vm->heap);
+    for (Obj* object; (object = heap_iter_next(&iter)) != NULL;)
+        stats->objects[object->type]++;
+}
+
+void objects_free(VM* vm)
+{
+    gc_sweep_finish(vm);
+
+    // Nothing is marked outside of a collection, so this frees everything.
+    heap_sweep(vm, &vm->heap, object_free);
 
-    free(vm.gray_stack);
+    free(vm->gray.items);
 }
@@ -1,26 +1,89 @@
 #ifndef CHUNK_MEMORY_H_
 #define CHUNK_MEMORY_H_
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "general.h"
+#include "heap.h"
 #include "object.h"
 
-#define mem_alloc(type, count) (type*)reallocate(NULL, 0, sizeof(type) * count)
+#define mem_alloc(vm, type, count)                                             \
+    (type*)reallocate(vm, NULL, 0, sizeof(type) * (count))
+
+#define mem_free(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
+
+typedef struct
+{
+    Obj** items;
+    int count;
+    int capacity;
+} GrayStack;
+
+// A sweep handed to a background thread along with every page allocated
+// before it started, the pages go back to the VM's heap once it finished.
+typedef struct
+{
+    pthread_t thread;
+    bool running;
+    atomic_bool finished;
+    Heap heap;
+    size_t freed;
+} Sweep;
+
+typedef struct
+{
+    uint64_t collections;
+    uint64_t compactions;
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+    size_t bytes_freed;
+
+    // Heap size right after the last sweep.
+    size_t live_bytes;
 
-#define mem_free(type, pointer) reallocate(pointer, sizeof(type), 0)
+    // Objects in the heap by ObjType, only filled in by gc_stats.
+    size_t objects[OBJ_TYPE_COUNT];
+} GcStats;
+
+#define gc_bytes_allocated(vm)                                                 \
+    atomic_load_explicit(&(vm)->bytes_allocated, memory_order_relaxed)
 
 #define capacity_grow(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define array_grow(type, pointer, old_count, new_count)                        \
-    (type*)reallocate(pointer, sizeof(type) * (old_count),                     \
+#define array_grow(vm, type, pointer, old_count, new_count)                    \
+    (type*)reallocate(vm, pointer, sizeof(type) * (old_count),                 \
                       sizeof(type) * (new_count))
 
-#define array_free(type, pointer, old_count)                                   \
-    reallocate(pointer, sizeof(type) * (old_count), 0)
+#define array_free(vm, type, pointer, old_count)                               \
+    reallocate(vm, pointer, sizeof(type) * (old_count), 0)
+
+// Heaps smaller than this are traced faster by one thread than by waking up
+// a crew of markers.
+#define GC_PARALLEL_THRESHOLD (64 * 1024 * 1024)
+
+#define GC_GROW_FACTOR 2.0
+#define GC_HEAP_MIN (1024 * 1024)
+
+void* reallocate(VM* vm, void* pointer, size_t old_size, size_t new_size);
+Obj* gc_obj_alloc(VM* vm, size_t size);
+void gc_mark_obj(VM* vm, Obj* object);
+void gc_mark_value(VM* vm, Value value);
+void gc_perform(VM* vm);
+int gc_default_threads(void);
+
+// Waits for a background sweep and takes its pages back, to be called before
+// walking vm->heap.
+void gc_sweep_finish(VM* vm);
+
+// Collects and moves the survivors of sparse pages together, releasing the
+// pages they leave behind. Only safe where every object the C stack refers
+// to is reachable from the roots, the interpreter calls it at backward jumps
+// once a collection found the heap fragmented.
+void gc_compact(VM* vm);
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size);
-void gc_mark_obj(Obj* object);
-void gc_mark_value(Value value);
-void gc_perform();
-void objects_free();
+// Copies the collector's statistics and counts the objects in the heap.
+void gc_stats(VM* vm, GcStats* stats);
+void objects_free(VM* vm);
 
 #endif // CHUNK_MEMORY_H_
@@ -1,23 +1,27 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "allocs.h"
+#include "map.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
 
-#define obj_mem_alloc(type, object_type)                                       \
-    (type*)obj_alloc(sizeof(type), object_type)
+#define FIBER_STACK_INITIAL 16
+#define FIBER_FRAMES_INITIAL 4
 
-static Obj* obj_alloc(size_t size, ObjType type)
+#define obj_mem_alloc(vm, type, object_type)                                   \
+    (type*)obj_alloc(vm, sizeof(type), object_type)
+
+static Obj* obj_alloc(VM* vm, size_t size, ObjType type)
 {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = gc_obj_alloc(vm, size);
     object->type = type;
-    object->is_marked = false;
 
-    object->next = vm.objects;
-    vm.objects = object;
+    if (vm->allocs != NULL)
+        allocs_record(vm->allocs, vm, type, heap_slot_size(size));
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -26,26 +30,58 @@ static Obj* obj_alloc(size_t size, ObjType type)
     return object;
 }
 
-ObjList* obj_list_new()
+ObjList* obj_list_new(VM* vm)
 {
-    ObjList* list = obj_mem_alloc(ObjList, OBJ_LIST);
+    ObjList* list = obj_mem_alloc(vm, ObjList, OBJ_LIST);
     list->items = NULL;
     list->count = 0;
     list->capacity = 0;
+    list->front = 0;
 
     return list;
 }
 
-void obj_list_append(ObjList* list, Value value)
+// Moves the items back to the start of the allocation, handing the free
+// front slots to the back.
+static void list_reclaim_front(ObjList* list)
 {
-    if (list->capacity < list->count + 1)
+    Value* base = list->items - list->front;
+    memmove(base, list->items, sizeof(Value) * list->count);
+
+    list->items = base;
+    list->capacity += list->front;
+    list->front = 0;
+}
+
+void obj_list_reserve(VM* vm, ObjList* list, int capacity)
+{
+    if (list->capacity >= capacity) return;
+
+    // A queue drained from the front refills the slots it left behind, but
+    // only once as many were freed as items are left, so sliding the items
+    // stays amortized constant.
+    if (list->front > 0 && list->front >= list->count)
     {
-        int old_capacity = list->capacity;
-        list->capacity = capacity_grow(old_capacity);
-        list->items =
-            array_grow(Value, list->items, old_capacity, list->capacity);
+        list_reclaim_front(list);
+        if (list->capacity >= capacity) return;
     }
 
+    // At least doubling keeps a run of reserves amortized constant.
+    int old_capacity = list->capacity;
+    int new_capacity = capacity_grow(old_capacity);
+    if (new_capacity < capacity) new_capacity = capacity;
+
+    int front = list->front;
+    Value* base = array_grow(vm, Value, list->items - front,
+                             front + old_capacity, front + new_capacity);
+    list->items = base + front;
+    list->capacity = new_capacity;
+}
+
+void obj_list_append(VM* vm, ObjList* list, Value value)
+{
+    obj_list_reserve(vm, list, list->count + 1);
+
     list->items[list->count] = value;
     list->count++;
 }
@@ -60,13 +96,78 @@ Value obj_list_get(ObjList* list, int index)
     return list->items[index];
 }
 
+static Value list_drop_front(ObjList* list)
+{
+    Value item = list->items[0];
+    list->items++;
+    list->front++;
+    list->capacity--;
+    list->count--;
+
+    // Empty lists start over at the beginning.
+    if (list->count == 0) list_reclaim_front(list);
+    return item;
+}
+
 void obj_list_delete(ObjList* list, int index)
 {
-    for (int i = index; i < list->count - 1; ++i)
-        list->items[i] = list->items[i + 1];
+    if (index < list->count / 2)
+    {
+        memmove(list->items + 1, list->items, sizeof(Value) * index);
+        list_drop_front(list);
+        return;
+    }
+
+    memmove(list->items + index, list->items + index + 1,
+            sizeof(Value) * (list->count - index - 1));
+    list->count--;
+}
+
+void obj_list_push_front(VM* vm, ObjList* list, Value value)
+{
+    if (list->front == 0)
+    {
+        // Grows by at least doubling like appending, and splits the new
+        // slots between both ends so either can keep growing.
+        int old_size = list->capacity;
+        int new_size = capacity_grow(old_size);
+        if (new_size < list->count + 1) new_size = list->count + 1;
+
+        int front = (new_size - list->count) / 2;
+        if (front == 0) front = 1;
+        if (new_size < list->count + front) new_size = list->count + front;
+
+        // The list keeps its old items until the copy, should allocating
+        // collect.
+        vm_stack_push(vm, value);
+        Value* items = mem_alloc(vm, Value, new_size);
+        vm_stack_pop(vm);
+
+        if (list->count > 0)
+            memcpy(items + front, list->items, sizeof(Value) * list->count);
+        array_free(vm, Value, list->items, old_size);
+
+        list->items = items + front;
+        list->front = front;
+        list->capacity = new_size - front;
+    }
+
+    list->items--;
+    list->front--;
+    list->capacity++;
+    list->count++;
+    list->items[0] = value;
+}
+
+Value obj_list_pop_front(ObjList* list)
+{
+    return list_drop_front(list);
+}
 
-    list->items[list->count - 1] = value_make_nil();
+Value obj_list_pop(ObjList* list)
+{
     list->count--;
+    return list->items[list->count];
 }
 
 bool obj_list_is_valid_index(ObjList* list, int index)
@@ -74,9 +175,31 @@ bool obj_list_is_valid_index(ObjList* list, int index)
     return (index >= 0 && index < list->count);
 }
 
-ObjBoundMethod* obj_bound_method_new(Value receiver, ObjClosure* method)
+ObjFloatArray* obj_float_array_new(VM* vm, int count)
+{
+    // The items come first, a collection they trigger has nothing to lose.
+    double* items = count > 0 ? mem_alloc(vm, double, count) : NULL;
+    if (count > 0) memset(items, 0, sizeof(double) * count);
+
+    ObjFloatArray* array = obj_mem_alloc(vm, ObjFloatArray, OBJ_FLOAT_ARRAY);
+    array->count = count;
+    array->items = items;
+    return array;
+}
+
+ObjMap* obj_map_new(VM* vm)
+{
+    ObjMap* map = obj_mem_alloc(vm, ObjMap, OBJ_MAP);
+    map->count = 0;
+    map->used = 0;
+    map->capacity = 0;
+    map->entries = NULL;
+    return map;
+}
+
+ObjBoundMethod* obj_bound_method_new(VM* vm, Value receiver, ObjClosure* method)
 {
-    ObjBoundMethod* bound = obj_mem_alloc(ObjBoundMethod, OBJ_BOUND_METHOD);
+    ObjBoundMethod* bound = obj_mem_alloc(vm, ObjBoundMethod, OBJ_BOUND_METHOD);
 
     bound->receiver = receiver;
     bound->method = method;
@@ -84,68 +207,145 @@ ObjBoundMethod* obj_bound_method_new(Value receiver, ObjClosure* method)
     return bound;
 }
 
-ObjClass* obj_class_new(ObjString* name)
+ObjClass* obj_class_new(VM* vm, ObjString* name)
 {
-    ObjClass* cls = obj_mem_alloc(ObjClass, OBJ_CLASS);
+    ObjClass* cls = obj_mem_alloc(vm, ObjClass, OBJ_CLASS);
     cls->name = name;
     table_init(&cls->methods);
 
     return cls;
 }
 
-ObjInstance* obj_instance_new(ObjClass* cls)
+ObjInstance* obj_instance_new(VM* vm, ObjClass* cls)
 {
-    ObjInstance* instance = obj_mem_alloc(ObjInstance, OBJ_INSTANCE);
+    ObjInstance* instance = obj_mem_alloc(vm, ObjInstance, OBJ_INSTANCE);
     instance->cls = cls;
     table_init(&instance->fields);
 
     return instance;
 }
 
-ObjFunction* obj_function_new()
+ObjFunction* obj_function_new(VM* vm)
 {
-    ObjFunction* function = obj_mem_alloc(ObjFunction, OBJ_FUNCTION);
+    ObjFunction* function = obj_mem_alloc(vm, ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalue_count = 0;
+    function->profile_id = 0;
     function->name = NULL;
     chunk_init(&function->chunk);
 
     return function;
 }
 
-ObjNativeFn* obj_native_fn_new(NativeFn function)
+ObjNativeFn* obj_native_fn_new(VM* vm, NativeFn function)
 {
-    ObjNativeFn* native = obj_mem_alloc(ObjNativeFn, OBJ_NATIVE_FN);
+    ObjNativeFn* native = obj_mem_alloc(vm, ObjNativeFn, OBJ_NATIVE_FN);
     native->function = function;
     return native;
 }
 
-ObjClosure* obj_closure_new(ObjFunction* function)
+ObjClosure* obj_closure_new(VM* vm, ObjFunction* function)
 {
-    ObjUpValue** upvalues = mem_alloc(ObjUpValue*, function->upvalue_count);
+    ObjUpValue** upvalues = mem_alloc(vm, ObjUpValue*, function->upvalue_count);
 
     for (int i = 0; i < function->upvalue_count; ++i)
     {
         upvalues[i] = NULL;
     }
 
-    ObjClosure* closure = obj_mem_alloc(ObjClosure, OBJ_CLOSURE);
+    ObjClosure* closure = obj_mem_alloc(vm, ObjClosure, OBJ_CLOSURE);
     closure->function = function;
     closure->upvalues = upvalues;
     closure->upvalue_count = function->upvalue_count;
     return closure;
 }
 
-static ObjString* obj_string_allocate(char* chars, int length, uint32_t hash)
+ObjFiber* obj_fiber_new(VM* vm, ObjClosure* closure)
+{
+    Value* stack = mem_alloc(vm, Value, FIBER_STACK_INITIAL);
+    CallFrame* frames = mem_alloc(vm, CallFrame, FIBER_FRAMES_INITIAL);
+
+    ObjFiber* fiber = obj_mem_alloc(vm, ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->stack = stack;
+    fiber->stack_top = stack;
+    fiber->stack_capacity = FIBER_STACK_INITIAL;
+    fiber->frames = frames;
+    fiber->frame_count = 0;
+    fiber->frame_capacity = FIBER_FRAMES_INITIAL;
+    fiber->open_upvalues = NULL;
+    fiber->caller = NULL;
+
+    // The closure sits in slot zero like any callee and the first resume
+    // starts executing it.
+    if (closure != NULL)
+    {
+        *fiber->stack_top++ = value_make_obj(closure);
+
+        CallFrame* frame = &fiber->frames[fiber->frame_count++];
+        frame->closure = closure;
+        frame->ip = closure->function->chunk.code;
+        frame->slots = fiber->stack;
+    }
+
+    return fiber;
+}
+
+void obj_fiber_stack_ensure(VM* vm, ObjFiber* fiber, int capacity)
+{
+    if (fiber->stack_capacity >= capacity) return;
+
+    int old_capacity = fiber->stack_capacity;
+    int new_capacity = old_capacity;
+    while (new_capacity < capacity) new_capacity = capacity_grow(new_capacity);
+
+    Value* old_stack = fiber->stack;
+    fiber->stack =
+        array_grow(vm, Value, fiber->stack, old_capacity, new_capacity);
+    fiber->stack_capacity = new_capacity;
+
+    if (fiber->stack == old_stack) return;
+
+    // Everything pointing into the old stack has to follow it.
+    fiber->stack_top = fiber->stack + (fiber->stack_top - old_stack);
+
+    for (int i = 0; i < fiber->frame_count; ++i)
+    {
+        CallFrame* frame = &fiber->frames[i];
+        frame->slots = fiber->stack + (frame->slots - old_stack);
+    }
+
+    for (ObjUpValue* upvalue = fiber->open_upvalues; upvalue != NULL;
+         upvalue = upvalue->next)
+    {
+        upvalue->location = fiber->stack + (upvalue->location - old_stack);
+    }
+}
+
+void obj_fiber_frames_ensure(VM* vm, ObjFiber* fiber, int capacity)
+{
+    if (fiber->frame_capacity >= capacity) return;
+
+    int old_capacity = fiber->frame_capacity;
+    int new_capacity = old_capacity;
+    while (new_capacity < capacity) new_capacity = capacity_grow(new_capacity);
+
+    fiber->frames =
+        array_grow(vm, CallFrame, fiber->frames, old_capacity, new_capacity);
+    fiber->frame_capacity = new_capacity;
+}
+
+static ObjString* obj_string_allocate(VM* vm, char* chars, int length,
+                                      uint32_t hash)
 {
-    ObjString* string = obj_mem_alloc(ObjString, OBJ_STRING);
+    ObjString* string = obj_mem_alloc(vm, ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
 
-    vm_stack_push(value_make_obj(string));
-    table_set(&vm.strings, string, value_make_nil());
-    vm_stack_pop();
+    vm_stack_push(vm, value_make_obj(string));
+    table_set(vm, &vm->strings, string, value_make_nil());
+    vm_stack_pop(vm);
 
     return string;
 }
@@ -163,106 +363,199 @@ static uint32_t string_hash(const char* key, int length)
     return hash;
 }
 
-ObjString* obj_string_take(char* chars, int length)
+ObjString* obj_string_take(VM* vm, char* chars, int length)
 {
     uint32_t hash = string_hash(chars, length);
 
-    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
 
     if (interned != NULL)
     {
-        array_free(char, chars, length + 1);
+        array_free(vm, char, chars, length + 1);
         return interned;
     }
 
-    return obj_string_allocate(chars, length, hash);
+    return obj_string_allocate(vm, chars, length, hash);
 }
 
-ObjString* obj_string_cpy(const char* chars, int length)
+ObjString* obj_string_cpy(VM* vm, const char* chars, int length)
 {
     uint32_t hash = string_hash(chars, length);
 
-    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
 
     if (interned != NULL) return interned;
 
-    char* head_chars = mem_alloc(char, length + 1);
+    char* head_chars = mem_alloc(vm, char, length + 1);
     memcpy(head_chars, chars, length);
     head_chars[length] = '\0';
-    return obj_string_allocate(head_chars, length, hash);
+    return obj_string_allocate(vm, head_chars, length, hash);
 }
 
-static void function_print(ObjFunction* function)
+static void function_print(FILE* stream, ObjFunction* function)
 {
     if (function->name == NULL)
     {
-        printf("<Main Body>");
+        fprintf(stream, "<Main Body>");
         return;
     }
 
-    printf("<fn %s>", function->name->chars);
+    fprintf(stream, "<fn %s>", function->name->chars);
 }
 
-static void list_print(ObjList* list)
+static void list_print(FILE* stream, ObjList* list)
 {
-    printf("[");
+    fprintf(stream, "[");
 
     for (int i = 0; i < list->count; ++i)
     {
-        value_print(list->items[i]);
-        if (i < list->count - 1) printf(", ");
+        value_print(stream, list->items[i]);
+        if (i < list->count - 1) fprintf(stream, ", ");
+    }
+
+    fprintf(stream, "]");
+}
+
+static void float_array_print(FILE* stream, ObjFloatArray* array)
+{
+    fprintf(stream, "FloatArray[");
+
+    for (int i = 0; i < array->count; ++i)
+    {
+        fprintf(stream, "%g", array->items[i]);
+        if (i < array->count - 1) fprintf(stream, ", ");
+    }
+
+    fprintf(stream, "]");
+}
+
+static void map_print(FILE* stream, ObjMap* map)
+{
+    fprintf(stream, "{");
+
+    bool first = true;
+    for (int i = 0; i < map->capacity; ++i)
+    {
+        MapEntry* entry = &map->entries[i];
+        if (entry->hash < MAP_HASH_MIN) continue;
+
+        if (!first) fprintf(stream, ", ");
+        first = false;
+
+        value_print(stream, entry->key);
+        fprintf(stream, ": ");
+        value_print(stream, entry->value);
     }
 
-    printf("]");
+    fprintf(stream, "}");
 }
 
-ObjUpValue* obj_upvalue_new(Value* slot)
+ObjUpValue* obj_upvalue_new(VM* vm, Value* slot)
 {
-    ObjUpValue* upvalue = obj_mem_alloc(ObjUpValue, OBJ_UPVALUE);
+    ObjUpValue* upvalue = obj_mem_alloc(vm, ObjUpValue, OBJ_UPVALUE);
     upvalue->closed = value_make_nil();
     upvalue->location = slot;
     upvalue->next = NULL;
+    upvalue->fiber = NULL;
     return upvalue;
 }
 
-void obj_print(Value value)
+const char* obj_type_name(ObjType type)
+{
+    switch (type)
+    {
+        case OBJ_LIST:
+            return "list";
+
+        case OBJ_BOUND_METHOD:
+            return "boundMethod";
+
+        case OBJ_CLASS:
+            return "class";
+
+        case OBJ_CLOSURE:
+            return "closure";
+
+        case OBJ_FIBER:
+            return "fiber";
+
+        case OBJ_FUNCTION:
+            return "function";
+
+        case OBJ_INSTANCE:
+            return "instance";
+
+        case OBJ_NATIVE_FN:
+            return "native";
+
+        case OBJ_STRING:
+            return "string";
+
+        case OBJ_UPVALUE:
+            return "upvalue";
+
+        case OBJ_FLOAT_ARRAY:
+            return "floatArray";
+
+        case OBJ_MAP:
+            return "map";
+    }
+
+    return "unknown";
+}
+
+void obj_print(FILE* stream, Value value)
 {
     switch (obj_get_type(value))
     {
         case OBJ_BOUND_METHOD:
-            function_print(obj_as_bound_method(value)->method->function);
+            function_print(stream,
+                           obj_as_bound_method(value)->method->function);
             break;
 
         case OBJ_CLASS:
-            printf("%s", obj_as_class(value)->name->chars);
+            fprintf(stream, "%s", obj_as_class(value)->name->chars);
             break;
 
         case OBJ_INSTANCE:
-            printf("%s instance", obj_as_instance(value)->cls->name->chars);
+            fprintf(stream, "%s instance",
+                    obj_as_instance(value)->cls->name->chars);
             break;
 
         case OBJ_CLOSURE:
-            function_print(obj_as_closure(value)->function);
+            function_print(stream, obj_as_closure(value)->function);
+            break;
+
+        case OBJ_FIBER:
+            fprintf(stream, "<fiber>");
             break;
 
         case OBJ_FUNCTION:
-            function_print(obj_as_function(value));
+            function_print(stream, obj_as_function(value));
             break;
 
         case OBJ_NATIVE_FN:
-            printf("<native fn>");
+            fprintf(stream, "<native fn>");
             break;
 
         case OBJ_STRING:
-            printf("%s", obj_as_cstring(value));
+            fprintf(stream, "%s", obj_as_cstring(value));
             break;
 
         case OBJ_UPVALUE:
-            printf("upvalue");
+            fprintf(stream, "upvalue");
             break;
 
         case OBJ_LIST:
-            list_print(obj_as_list(value));
+            list_print(stream, obj_as_list(value));
+            break;
+
+        case OBJ_FLOAT_ARRAY:
+            float_array_print(stream, obj_as_float_array(value));
+            break;
+
+        case OBJ_MAP:
+            map_print(stream, obj_as_map(value));
             break;
     }
 }
@@ -13,19 +13,25 @@
 #define obj_is_class(value) (is_object_of_type(value, OBJ_CLASS))
 #define obj_is_instance(value) (is_object_of_type(value, OBJ_INSTANCE))
 #define obj_is_closure(value) (is_object_of_type(value, OBJ_CLOSURE))
+#define obj_is_fiber(value) (is_object_of_type(value, OBJ_FIBER))
 #define obj_is_function(value) (is_object_of_type(value, OBJ_FUNCTION))
 #define obj_is_native_fn(value) (is_object_of_type(value, OBJ_NATIVE_FN))
 #define obj_is_string(value) (is_object_of_type(value, OBJ_STRING))
+#define obj_is_float_array(value) (is_object_of_type(value, OBJ_FLOAT_ARRAY))
+#define obj_is_map(value) (is_object_of_type(value, OBJ_MAP))
 
 #define obj_as_list(value) ((ObjList*)value_as_obj(value))
 #define obj_as_bound_method(value) ((ObjBoundMethod*)value_as_obj(value))
 #define obj_as_class(value) ((ObjClass*)value_as_obj(value))
 #define obj_as_instance(value) ((ObjInstance*)value_as_obj(value))
 #define obj_as_closure(value) ((ObjClosure*)value_as_obj(value))
+#define obj_as_fiber(value) ((ObjFiber*)value_as_obj(value))
 #define obj_as_function(value) ((ObjFunction*)value_as_obj(value))
 #define obj_as_native_fn(value) (((ObjNativeFn*)value_as_obj(value))->function)
 #define obj_as_string(value) ((ObjString*)value_as_obj(value))
 #define obj_as_cstring(value) (((ObjString*)value_as_obj(value))->chars)
+#define obj_as_float_array(value) ((ObjFloatArray*)value_as_obj(value))
+#define obj_as_map(value) ((ObjMap*)value_as_obj(value))
 
 typedef enum
 {
@@ -33,38 +39,80 @@ typedef enum
     OBJ_BOUND_METHOD,
     OBJ_CLASS,
     OBJ_CLOSURE,
+    OBJ_FIBER,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
     OBJ_NATIVE_FN,
     OBJ_STRING,
     OBJ_UPVALUE,
+    OBJ_FLOAT_ARRAY,
+    OBJ_MAP,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_MAP + 1)
+
 struct Obj
 {
+    // Mark bits and the list of all objects are kept by the heap pages.
     ObjType type;
-    bool is_marked;
-    struct Obj* next;
 };
 
+// items points at the first item, front slots before it are left free by
+// removing from the front and capacity counts the slots from items on. The
+// allocation starts at items - front.
 typedef struct
 {
     Obj obj;
     int count;
     int capacity;
+    int front;
     Value* items;
 } ObjList;
 
+// Fixed length array of unboxed doubles, for the bulk numeric natives.
+typedef struct
+{
+    Obj obj;
+    int count;
+    double* items;
+} ObjFloatArray;
+
+// Slot of a map, see map.h. hash is MAP_EMPTY or MAP_TOMBSTONE for a slot
+// without a key.
+typedef struct
+{
+    Value key;
+    Value value;
+    uint32_t hash;
+} MapEntry;
+
+// Hash map keyed by any value but NaN. count is the number of keys, used
+// also counts the tombstones towards the load factor.
+typedef struct
+{
+    Obj obj;
+    int count;
+    int used;
+    int capacity;
+    MapEntry* entries;
+} ObjMap;
+
 typedef struct
 {
     Obj obj;
     int upvalue_count;
     int arity;
+
+    // Index of the function's counters plus one, zero until the profiler
+    // first sees it run.
+    int profile_id;
     Chunk chunk;
     ObjString* name;
 } ObjFunction;
 
-typedef Value (*NativeFn)(int argc, Value* args);
+// Natives leave their result in args[-1], the callee slot, and return false
+// after raising a runtime error.
+typedef bool (*NativeFn)(VM* vm, int argc, Value* args);
 
 typedef struct
 {
@@ -86,6 +134,9 @@ typedef struct ObjUpValue
     Value* location;
     Value closed;
     struct ObjUpValue* next;
+
+    // Owner of the stack slot while the upvalue is still open.
+    struct ObjFiber* fiber;
 } ObjUpValue;
 
 typedef struct
@@ -96,6 +147,40 @@ typedef struct
     int upvalue_count;
 } ObjClosure;
 
+typedef struct
+{
+    ObjClosure* closure;
+    uint8_t* ip;
+    Value* slots;
+} CallFrame;
+
+typedef enum
+{
+    FIBER_NEW,
+    FIBER_RUNNING,
+    FIBER_SUSPENDED,
+    FIBER_DONE,
+} FiberState;
+
+typedef struct ObjFiber
+{
+    Obj obj;
+    FiberState state;
+
+    CallFrame* frames;
+    int frame_count;
+    int frame_capacity;
+
+    Value* stack;
+    Value* stack_top;
+    int stack_capacity;
+
+    ObjUpValue* open_upvalues;
+
+    // The fiber that resumed this one, control goes back to it on yield.
+    struct ObjFiber* caller;
+} ObjFiber;
+
 typedef struct
 {
     Obj obj;
@@ -117,27 +202,46 @@ typedef struct
     ObjClosure* method;
 } ObjBoundMethod;
 
-ObjList* obj_list_new();
-void obj_list_append(ObjList* list, Value value);
+ObjList* obj_list_new(VM* vm);
+
+// Makes room for capacity items, growing the items once at most.
+void obj_list_reserve(VM* vm, ObjList* list, int capacity);
+void obj_list_append(VM* vm, ObjList* list, Value value);
 void obj_list_set(ObjList* list, int index, Value value);
 Value obj_list_get(ObjList* list, int index);
+// Shifts whichever side of index is shorter, so deleting the first or last
+// item takes constant time.
 void obj_list_delete(ObjList* list, int index);
+void obj_list_push_front(VM* vm, ObjList* list, Value value);
+Value obj_list_pop_front(ObjList* list);
+Value obj_list_pop(ObjList* list);
 bool obj_list_is_valid_index(ObjList* list, int index);
 
-ObjBoundMethod* obj_bound_method_new(Value receiver, ObjClosure* method);
-ObjClass* obj_class_new(ObjString* name);
-ObjInstance* obj_instance_new(ObjClass* cls);
+// Every item starts out as zero.
+ObjFloatArray* obj_float_array_new(VM* vm, int count);
+
+ObjMap* obj_map_new(VM* vm);
+
+ObjBoundMethod* obj_bound_method_new(VM* vm, Value receiver,
+                                     ObjClosure* method);
+ObjClass* obj_class_new(VM* vm, ObjString* name);
+ObjInstance* obj_instance_new(VM* vm, ObjClass* cls);
+
+ObjFunction* obj_function_new(VM* vm);
+ObjNativeFn* obj_native_fn_new(VM* vm, NativeFn function);
+ObjClosure* obj_closure_new(VM* vm, ObjFunction* function);
 
-ObjFunction* obj_function_new();
-ObjNativeFn* obj_native_fn_new(NativeFn function);
-ObjClosure* obj_closure_new(ObjFunction* function);
+ObjFiber* obj_fiber_new(VM* vm, ObjClosure* closure);
+void obj_fiber_stack_ensure(VM* vm, ObjFiber* fiber, int capacity);
+void obj_fiber_frames_ensure(VM* vm, ObjFiber* fiber, int capacity);
 
-ObjString* obj_string_take(char* chars, int length);
-ObjString* obj_string_cpy(const char* chars, int length);
+ObjString* obj_string_take(VM* vm, char* chars, int length);
+ObjString* obj_string_cpy(VM* vm, const char* chars, int length);
 
-ObjUpValue* obj_upvalue_new(Value* slot);
+ObjUpValue* obj_upvalue_new(VM* vm, Value* slot);
 
-void obj_print(Value value);
+void obj_print(FILE* stream, Value value);
+const char* obj_type_name(ObjType type);
 
 static inline bool is_object_of_type(Value value, ObjType type)
 {
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "chunk.h"
+#include "debug.h"
+#include "memory.h"
+#include "profile.h"
+
+#define PROFILE_LINES_MAX 20
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t cycles;
+} ProfileCounter;
+
+typedef struct
+{
+    // Copied, the function itself may be collected before the report.
+    char* name;
+    ProfileCounter total;
+
+    // Indexed by source line minus first_line.
+    int first_line;
+    int line_count;
+    ProfileCounter* lines;
+} ProfileFunction;
+
+typedef struct
+{
+    const char* name;
+    int line;
+    ProfileCounter counter;
+} ProfileRow;
+
+struct Profile
+{
+    ProfileCounter opcodes[UINT8_COUNT];
+
+    // ObjFunction.profile_id is an index into functions plus one.
+    ProfileFunction* functions;
+    int function_count;
+    int function_capacity;
+
+    // The instruction the time since `last` is charged to, or a negative
+    // opcode when there is none.
+    uint64_t last;
+    int last_opcode;
+    int last_function;
+    int last_line;
+};
+
+// Time stamp counter ticks where there is one, nanoseconds otherwise.
+static uint64_t profile_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+Profile* profile_new(void)
+{
+    Profile* profile = (Profile*)calloc(1, sizeof(Profile));
+    if (profile == NULL) exit(1);
+
+    profile->last_opcode = -1;
+    return profile;
+}
+
+void profile_free(Profile* profile)
+{
+    for (int i = 0; i < profile->function_count; ++i)
+    {
+        free(profile->functions[i].name);
+        free(profile->functions[i].lines);
+    }
+
+    free(profile->functions);
+    free(profile);
+}
+
+void profile_begin(Profile* profile)
+{
+    profile->last_opcode = -1;
+}
+
+static int profile_function_add(Profile* profile, ObjFunction* function)
+{
+    if (profile->function_count == profile->function_capacity)
+    {
+        profile->function_capacity = capacity_grow(profile->function_capacity);
+        profile->functions = (ProfileFunction*)realloc(
+            profile->functions,
+            sizeof(ProfileFunction) * profile->function_capacity);
+        if (profile->functions == NULL) exit(1);
+    }
+
+    Chunk* chunk = &function->chunk;
+    int first_line = chunk->count > 0 ? chunk->lines[0] : 0;
+    int last_line = first_line;
+
+    for (int i = 0; i < chunk->count; ++i)
+    {
+        if (chunk->lines[i] < first_line) first_line = chunk->lines[i];
+        if (chunk->lines[i] > last_line) last_line = chunk->lines[i];
+    }
+
+    const char* name =
+        function->name == NULL ? "script" : function->name->chars;
+
+    ProfileFunction* entry = &profile->functions[profile->function_count];
+    entry->name = strdup(name);
+    entry->total.count = 0;
+    entry->total.cycles = 0;
+    entry->first_line = first_line;
+    entry->line_count = last_line - first_line + 1;
+    entry->lines =
+        (ProfileCounter*)calloc(entry->line_count, sizeof(ProfileCounter));
+    if (entry->name == NULL || entry->lines == NULL) exit(1);
+
+    function->profile_id = ++profile->function_count;
+    return function->profile_id - 1;
+}
+
+void profile_step(Profile* profile, ObjFunction* function, uint8_t* ip)
+{
+    uint64_t now = profile_clock();
+
+    if (profile->last_opcode >= 0)
+    {
+        uint64_t cycles = now - profile->last;
+        ProfileFunction* last = &profile->functions[profile->last_function];
+
+        profile->opcodes[profile->last_opcode].cycles += cycles;
+        last->total.cycles += cycles;
+        last->lines[profile->last_line].cycles += cycles;
+    }
+
+    int index = function->profile_id - 1;
+    if (index < 0) index = profile_function_add(profile, function);
+
+    ProfileFunction* entry = &profile->functions[index];
+    int line = function->chunk.lines[ip - function->chunk.code] -
+               entry->first_line;
+
+    profile->opcodes[*ip].count++;
+    entry->total.count++;
+    entry->lines[line].count++;
+
+    profile->last_opcode = *ip;
+    profile->last_function = index;
+    profile->last_line = line;
+
+    // Read again, so the bookkeeping above is not charged to anybody.
+    profile->last = profile_clock();
+}
+
+static int profile_row_compare(const void* a, const void* b)
+{
+    uint64_t left = ((const ProfileRow*)a)->counter.cycles;
+    uint64_t right = ((const ProfileRow*)b)->counter.cycles;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void profile_rows_print(FILE* out, const char* title, ProfileRow* rows,
+                               int count, int limit, uint64_t total)
+{
+    qsort(rows, count, sizeof(ProfileRow), profile_row_compare);
+
+    fprintf(out, "-- profile: %s\n", title);
+    fprintf(out, "%14s %16s %7s  %s\n", "count", "cycles", "%", "where");
+
+    for (int i = 0; i < count && i < limit; ++i)
+    {
+        ProfileRow* row = &rows[i];
+        if (row->counter.count == 0) continue;
+
+        double share =
+            total > 0 ? 100.0 * (double)row->counter.cycles / total : 0;
+        fprintf(out, "%14llu %16llu %6.2f%%  %s",
+                (unsigned long long)row->counter.count,
+                (unsigned long long)row->counter.cycles, share, row->name);
+
+        if (row->line > 0) fprintf(out, ":%d", row->line);
+        fputs("\n", out);
+    }
+}
+
+void profile_report(Profile* profile, FILE* out)
+{
+    uint64_t total = 0;
+    int line_count = 0;
+
+    for (int i = 0; i < profile->function_count; ++i)
+    {
+        total += profile->functions[i].total.cycles;
+        line_count += profile->functions[i].line_count;
+    }
+
+    int row_count = UINT8_COUNT;
+    if (profile->function_count > row_count)
+        row_count = profile->function_count;
+    if (line_count > row_count) row_count = line_count;
+
+    ProfileRow* rows = (ProfileRow*)malloc(sizeof(ProfileRow) * row_count);
+    if (rows == NULL) exit(1);
+
+    for (int i = 0; i < UINT8_COUNT; ++i)
+    {
+        rows[i].name = opcode_name((uint8_t)i);
+        rows[i].line = 0;
+        rows[i].counter = profile->opcodes[i];
+    }
+
+    profile_rows_print(out, "opcodes", rows, UINT8_COUNT, UINT8_COUNT, total);
+
+    for (int i = 0; i < profile->function_count; ++i)
+    {
+        rows[i].name = profile->functions[i].name;
+        rows[i].line = 0;
+        rows[i].counter = profile->functions[i].total;
+    }
+
+    profile_rows_print(out, "functions", rows, profile->function_count,
+                       profile->function_count, total);
+
+    int count = 0;
+    for (int i = 0; i < profile->function_count; ++i)
+    {
+        ProfileFunction* function = &profile->functions[i];
+
+        for (int line = 0; line < function->line_count; ++line)
+        {
+            rows[count].name = function->name;
+            rows[count].line = function->first_line + line;
+            rows[count].counter = function->lines[line];
+            count++;
+        }
+    }
+
+    profile_rows_print(out, "lines", rows, count, PROFILE_LINES_MAX, total);
+    free(rows);
+}
@@ -0,0 +1,28 @@
+#ifndef CLOX_PROFILE_H_
+#define CLOX_PROFILE_H_
+
+#include <stdio.h>
+
+#include "general.h"
+#include "object.h"
+
+// Instrumenting profiler behind `--profile`. The interpreter reports every
+// instruction it is about to run, and the time until the next one is charged
+// to its opcode, its function and its source line. A function's time is
+// therefore its own, callees are charged separately, while natives and
+// collections count towards the instruction that started them.
+typedef struct Profile Profile;
+
+Profile* profile_new(void);
+void profile_free(Profile* profile);
+
+// Forgets the instruction run last, so the time until the interpreter
+// continues is not charged to it.
+void profile_begin(Profile* profile);
+
+void profile_step(Profile* profile, ObjFunction* function, uint8_t* ip);
+
+// Prints opcodes, functions and the hottest lines, most expensive first.
+void profile_report(Profile* profile, FILE* out);
+
+#endif // CLOX_PROFILE_H_
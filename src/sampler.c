@@ -0,0 +1,235 @@
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "memory.h"
+#include "sampler.h"
+#include "vm.h"
+
+typedef struct
+{
+    char* stack;
+    uint32_t hash;
+    uint64_t count;
+} SampleEntry;
+
+struct Sampler
+{
+    VM* vm;
+    atomic_uint ticks;
+
+    // Open addressing table of collapsed stacks.
+    SampleEntry* entries;
+    int count;
+    int capacity;
+
+    // The stack being built, reused between samples.
+    char* buffer;
+    size_t length;
+    size_t buffer_capacity;
+};
+
+// The sampler the SIGPROF handler reports to.
+static Sampler* sampler_running;
+
+static void sampler_tick(int signal)
+{
+    (void)signal;
+
+    Sampler* sampler = sampler_running;
+    if (sampler == NULL) return;
+
+    atomic_fetch_add_explicit(&sampler->ticks, 1, memory_order_relaxed);
+    atomic_fetch_or_explicit(&sampler->vm->interrupt, VM_INTERRUPT_SAMPLE,
+                             memory_order_relaxed);
+}
+
+Sampler* sampler_new(void)
+{
+    Sampler* sampler = (Sampler*)calloc(1, sizeof(Sampler));
+    if (sampler == NULL) exit(1);
+
+    atomic_init(&sampler->ticks, 0);
+    return sampler;
+}
+
+void sampler_free(Sampler* sampler)
+{
+    for (int i = 0; i < sampler->capacity; ++i)
+        free(sampler->entries[i].stack);
+
+    free(sampler->entries);
+    free(sampler->buffer);
+    free(sampler);
+}
+
+bool sampler_start(Sampler* sampler, VM* vm, int hz)
+{
+    sampler->vm = vm;
+    sampler_running = sampler;
+
+    struct sigaction action = {0};
+    action.sa_handler = sampler_tick;
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+    long interval = 1000000 / hz;
+
+    struct itimerval timer = {0};
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+void sampler_stop(Sampler* sampler)
+{
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    if (sampler_running == sampler) sampler_running = NULL;
+}
+
+static uint32_t sample_hash(const char* stack, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (uint8_t)stack[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static SampleEntry* sample_find(SampleEntry* entries, int capacity,
+                                const char* stack, size_t length,
+                                uint32_t hash)
+{
+    uint32_t index = hash & (capacity - 1);
+
+    while (true)
+    {
+        SampleEntry* entry = &entries[index];
+        if (entry->stack == NULL) return entry;
+
+        if (entry->hash == hash && strlen(entry->stack) == length &&
+            memcmp(entry->stack, stack, length) == 0)
+            return entry;
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void sample_table_grow(Sampler* sampler)
+{
+    int capacity = capacity_grow(sampler->capacity);
+    SampleEntry* entries = (SampleEntry*)calloc(capacity, sizeof(SampleEntry));
+    if (entries == NULL) exit(1);
+
+    for (int i = 0; i < sampler->capacity; ++i)
+    {
+        SampleEntry* entry = &sampler->entries[i];
+        if (entry->stack == NULL) continue;
+
+        *sample_find(entries, capacity, entry->stack, strlen(entry->stack),
+                     entry->hash) = *entry;
+    }
+
+    free(sampler->entries);
+    sampler->entries = entries;
+    sampler->capacity = capacity;
+}
+
+static void buffer_append(Sampler* sampler, const char* chars, size_t length)
+{
+    if (sampler->length + length + 1 > sampler->buffer_capacity)
+    {
+        while (sampler->length + length + 1 > sampler->buffer_capacity)
+            sampler->buffer_capacity = capacity_grow(sampler->buffer_capacity);
+
+        sampler->buffer =
+            (char*)realloc(sampler->buffer, sampler->buffer_capacity);
+        if (sampler->buffer == NULL) exit(1);
+    }
+
+    memcpy(sampler->buffer + sampler->length, chars, length);
+    sampler->length += length;
+    sampler->buffer[sampler->length] = '\0';
+}
+
+// Appends the frames of the fibers that resumed this one first, so the
+// stack reads from the outermost call in.
+static void buffer_append_fiber(Sampler* sampler, ObjFiber* fiber)
+{
+    if (fiber->caller != NULL) buffer_append_fiber(sampler, fiber->caller);
+
+    for (int i = 0; i < fiber->frame_count; ++i)
+    {
+        CallFrame* frame = &fiber->frames[i];
+        ObjFunction* function = frame->closure->function;
+        size_t instruction = frame->ip - function->chunk.code - 1;
+
+        char frame_name[256];
+        int length = snprintf(
+            frame_name, sizeof(frame_name), "%s%s:%d",
+            sampler->length > 0 ? ";" : "",
+            function->name == NULL ? "script" : function->name->chars,
+            function->chunk.lines[instruction]);
+        if (length >= (int)sizeof(frame_name))
+            length = (int)sizeof(frame_name) - 1;
+
+        buffer_append(sampler, frame_name, (size_t)length);
+    }
+}
+
+void sampler_record(Sampler* sampler, VM* vm)
+{
+    unsigned int ticks =
+        atomic_exchange_explicit(&sampler->ticks, 0, memory_order_relaxed);
+    if (ticks == 0) return;
+
+    sampler->length = 0;
+    buffer_append_fiber(sampler, vm->fiber);
+    if (sampler->length == 0) return;
+
+    if ((sampler->count + 1) * 4 > sampler->capacity * 3)
+        sample_table_grow(sampler);
+
+    uint32_t hash = sample_hash(sampler->buffer, sampler->length);
+    SampleEntry* entry =
+        sample_find(sampler->entries, sampler->capacity, sampler->buffer,
+                    sampler->length, hash);
+
+    if (entry->stack == NULL)
+    {
+        entry->stack = strdup(sampler->buffer);
+        if (entry->stack == NULL) exit(1);
+
+        entry->hash = hash;
+        entry->count = 0;
+        sampler->count++;
+    }
+
+    entry->count += ticks;
+}
+
+bool sampler_write(Sampler* sampler, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    for (int i = 0; i < sampler->capacity; ++i)
+    {
+        SampleEntry* entry = &sampler->entries[i];
+        if (entry->stack == NULL) continue;
+
+        fprintf(file, "%s %llu\n", entry->stack,
+                (unsigned long long)entry->count);
+    }
+
+    return fclose(file) == 0;
+}
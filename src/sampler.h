@@ -0,0 +1,28 @@
+#ifndef CLOX_SAMPLER_H_
+#define CLOX_SAMPLER_H_
+
+#include "general.h"
+#include "object.h"
+
+// Sampling profiler behind `--sample`. A SIGPROF timer ticks on the CPU time
+// of the process, its handler only counts the tick and asks the VM for a
+// sample, and the interpreter records its Lox call stack at the next
+// backward jump, call or return. Stacks are written in the collapsed format
+// flamegraph tools read, one `frame;frame;frame count` line each, with
+// every frame being a function name and the line it is at.
+typedef struct Sampler Sampler;
+
+Sampler* sampler_new(void);
+void sampler_free(Sampler* sampler);
+
+// Starts ticking `hz` times per CPU second on behalf of vm. A process runs
+// one sampler at a time.
+bool sampler_start(Sampler* sampler, VM* vm, int hz);
+void sampler_stop(Sampler* sampler);
+
+// Charges the ticks since the last sample to the running Lox stack.
+void sampler_record(Sampler* sampler, VM* vm);
+
+bool sampler_write(Sampler* sampler, const char* path);
+
+#endif // CLOX_SAMPLER_H_
@@ -4,20 +4,11 @@
 #include "general.h"
 #include "scanner.h"
 
-typedef struct
+void scanner_init(Scanner* scanner, const char* source)
 {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
-
-Scanner scanner;
-
-void scanner_init(const char* source)
-{
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;
 }
 
 static bool is_alpha(char c)
@@ -30,84 +21,85 @@ static bool is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
-static bool is_at_end()
+static bool is_at_end(Scanner* scanner)
 {
-    return *scanner.current == '\0';
+    return *scanner->current == '\0';
 }
 
-static char move_to_next_char()
+static char move_to_next_char(Scanner* scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static char get_current_char()
+static char get_current_char(Scanner* scanner)
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
-static char get_next_char()
+static char get_next_char(Scanner* scanner)
 {
-    if (is_at_end()) return '\0';
+    if (is_at_end(scanner)) return '\0';
 
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
-static bool match_char(char expected)
+static bool match_char(Scanner* scanner, char expected)
 {
-    if (is_at_end()) return false;
+    if (is_at_end(scanner)) return false;
 
-    if (*scanner.current != expected) return false;
+    if (*scanner->current != expected) return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static Token token_make(TokenType type)
+static Token token_make(Scanner* scanner, TokenType type)
 {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
-static Token token_make_error(const char* message)
+static Token token_make_error(Scanner* scanner, const char* message)
 {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
-static void skip_whitespaces()
+static void skip_whitespaces(Scanner* scanner)
 {
     while (true)
     {
-        char c = get_current_char();
+        char c = get_current_char(scanner);
 
         switch (c)
         {
             case ' ':
             case '\r':
             case '\t':
-                move_to_next_char();
+                move_to_next_char(scanner);
                 break;
 
             case '\n':
-                scanner.line++;
-                move_to_next_char();
+                scanner->line++;
+                move_to_next_char(scanner);
                 break;
 
             case '/':
-                if (get_next_char() == '/')
+                if (get_next_char(scanner) == '/')
                 {
                     // A comment goes until the end of line
-                    while (get_current_char() != '\n' && !is_at_end())
-                        move_to_next_char();
+                    while (get_current_char(scanner) != '\n' &&
+                           !is_at_end(scanner))
+                        move_to_next_char(scanner);
                 }
                 else
                     return;
@@ -120,200 +112,242 @@ static void skip_whitespaces()
     }
 }
 
-static TokenType if_can_get_keyword(int start, int length, const char* rest,
+static TokenType if_can_get_keyword(Scanner* scanner, int start, int length,
+                                    const char* rest,
                                     TokenType type)
 {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0)
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0)
         return type;
 
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType get_identifier_type()
+static TokenType get_identifier_type(Scanner* scanner)
 {
-    switch (scanner.start[0])
+    switch (scanner->start[0])
     {
         case 'a':
-            return if_can_get_keyword(1, 2, "nd", TOKEN_AND);
+            return if_can_get_keyword(scanner, 1, 2, "nd", TOKEN_AND);
 
         case 'c':
-            return if_can_get_keyword(1, 4, "lass", TOKEN_CLASS);
+            return if_can_get_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
 
         case 'e':
-            return if_can_get_keyword(1, 3, "lse", TOKEN_ELSE);
+            return if_can_get_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
 
         case 'f':
-            if (scanner.current - scanner.start > 1)
+            if (scanner->current - scanner->start > 1)
             {
-                switch (scanner.start[1])
+                switch (scanner->start[1])
                 {
                     case 'a':
-                        return if_can_get_keyword(2, 3, "lse", TOKEN_FALSE);
+                        return if_can_get_keyword(scanner, 2, 3, "lse",
+                                                  TOKEN_FALSE);
                     case 'o':
-                        return if_can_get_keyword(2, 1, "r", TOKEN_FOR);
+                        return if_can_get_keyword(scanner, 2, 1, "r",
+                                                  TOKEN_FOR);
                     case 'u':
-                        return if_can_get_keyword(2, 1, "n", TOKEN_FUN);
+                        return if_can_get_keyword(scanner, 2, 1, "n",
+                                                  TOKEN_FUN);
                 }
             }
             break;
 
         case 'i':
-            return if_can_get_keyword(1, 1, "f", TOKEN_IF);
+        {
+            TokenType t = if_can_get_keyword(scanner, 1, 1, "f", TOKEN_IF);
+
+            return t != TOKEN_IDENTIFIER
+                       ? t
+                       : if_can_get_keyword(scanner, 1, 1, "n", TOKEN_IN);
+        }
 
         case 'n':
-            return if_can_get_keyword(1, 2, "il", TOKEN_NIL);
+            return if_can_get_keyword(scanner, 1, 2, "il", TOKEN_NIL);
 
         case 'o':
-            return if_can_get_keyword(1, 1, "r", TOKEN_OR);
+            return if_can_get_keyword(scanner, 1, 1, "r", TOKEN_OR);
 
         case 'p':
         {
-            TokenType t = if_can_get_keyword(1, 6, "rintln", TOKEN_PRINTLN);
+            TokenType t = if_can_get_keyword(scanner, 1, 6, "rintln",
+                                             TOKEN_PRINTLN);
 
             return t != TOKEN_IDENTIFIER
                        ? t
-                       : if_can_get_keyword(1, 4, "rint", TOKEN_PRINT);
+                       : if_can_get_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
         }
 
         case 'r':
-            return if_can_get_keyword(1, 5, "eturn", TOKEN_RETURN);
+            if (scanner->current - scanner->start > 2 &&
+                scanner->start[1] == 'e')
+            {
+                switch (scanner->start[2])
+                {
+                    case 's':
+                        return if_can_get_keyword(scanner, 3, 3, "ume",
+                                                  TOKEN_RESUME);
+                    case 't':
+                        return if_can_get_keyword(scanner, 3, 3, "urn",
+                                                  TOKEN_RETURN);
+                }
+            }
+            break;
 
         case 's':
-            return if_can_get_keyword(1, 4, "uper", TOKEN_SUPER);
+            return if_can_get_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
 
         case 't':
-            if (scanner.current - scanner.start > 1)
+            if (scanner->current - scanner->start > 1)
             {
-                switch (scanner.start[1])
+                switch (scanner->start[1])
                 {
                     case 'h':
-                        return if_can_get_keyword(2, 2, "is", TOKEN_THIS);
+                        return if_can_get_keyword(scanner, 2, 2, "is",
+                                                  TOKEN_THIS);
                     case 'r':
-                        return if_can_get_keyword(2, 2, "ue", TOKEN_TRUE);
+                        return if_can_get_keyword(scanner, 2, 2, "ue",
+                                                  TOKEN_TRUE);
                 }
             }
             break;
 
         case 'v':
-            return if_can_get_keyword(1, 2, "ar", TOKEN_VAR);
+            return if_can_get_keyword(scanner, 1, 2, "ar", TOKEN_VAR);
 
         case 'w':
-            return if_can_get_keyword(1, 4, "hile", TOKEN_WHILE);
+            return if_can_get_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+
+        case 'y':
+            return if_can_get_keyword(scanner, 1, 4, "ield", TOKEN_YIELD);
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static Token token_make_identifier()
+static Token token_make_identifier(Scanner* scanner)
 {
-    while (is_alpha(get_current_char()) || is_digit(get_current_char()))
-        move_to_next_char();
+    while (is_alpha(get_current_char(scanner)) ||
+           is_digit(get_current_char(scanner)))
+        move_to_next_char(scanner);
 
-    return token_make(get_identifier_type());
+    return token_make(scanner, get_identifier_type(scanner));
 }
 
-static Token token_make_number()
+static Token token_make_number(Scanner* scanner)
 {
-    while (is_digit(get_current_char())) move_to_next_char();
+    while (is_digit(get_current_char(scanner))) move_to_next_char(scanner);
 
     // Look for a fractional part.
-    if (get_current_char() == '.' && is_digit(get_next_char()))
+    if (get_current_char(scanner) == '.' && is_digit(get_next_char(scanner)))
     {
         // consume the ".".
-        move_to_next_char();
+        move_to_next_char(scanner);
 
-        while (is_digit(get_current_char())) move_to_next_char();
+        while (is_digit(get_current_char(scanner))) move_to_next_char(scanner);
     }
 
-    return token_make(TOKEN_NUMBER);
+    return token_make(scanner, TOKEN_NUMBER);
 }
 
-static Token token_make_string()
+static Token token_make_string(Scanner* scanner)
 {
-    while (get_current_char() != '"' && !is_at_end())
+    while (get_current_char(scanner) != '"' && !is_at_end(scanner))
     {
-        if (get_current_char() == '\n') scanner.line++;
-        move_to_next_char();
+        if (get_current_char(scanner) == '\n') scanner->line++;
+        move_to_next_char(scanner);
     }
 
-    if (is_at_end()) return token_make_error("Unterminated string.");
+    if (is_at_end(scanner))
+        return token_make_error(scanner, "Unterminated string.");
 
     // The closing quote.
-    move_to_next_char();
-    return token_make(TOKEN_STRING);
+    move_to_next_char(scanner);
+    return token_make(scanner, TOKEN_STRING);
 }
 
-Token scanner_scan_token()
+Token scanner_scan_token(Scanner* scanner)
 {
-    skip_whitespaces();
-    scanner.start = scanner.current;
+    skip_whitespaces(scanner);
+    scanner->start = scanner->current;
 
-    if (is_at_end()) return token_make(TOKEN_EOF);
+    if (is_at_end(scanner)) return token_make(scanner, TOKEN_EOF);
 
-    char c = move_to_next_char();
+    char c = move_to_next_char(scanner);
 
-    if (is_alpha(c)) return token_make_identifier();
-    if (is_digit(c)) return token_make_number();
+    if (is_alpha(c)) return token_make_identifier(scanner);
+    if (is_digit(c)) return token_make_number(scanner);
 
     switch (c)
     {
         case '(':
-            return token_make(TOKEN_LEFT_PAREN);
+            return token_make(scanner, TOKEN_LEFT_PAREN);
 
         case ')':
-            return token_make(TOKEN_RIGHT_PAREN);
+            return token_make(scanner, TOKEN_RIGHT_PAREN);
 
         case '{':
-            return token_make(TOKEN_LEFT_BRACE);
+            return token_make(scanner, TOKEN_LEFT_BRACE);
 
         case '}':
-            return token_make(TOKEN_RIGHT_BRACE);
+            return token_make(scanner, TOKEN_RIGHT_BRACE);
 
         case '[':
-            return token_make(TOKEN_LEFT_BRACKET);
+            return token_make(scanner, TOKEN_LEFT_BRACKET);
 
         case ']':
-            return token_make(TOKEN_RIGHT_BRACKET);
+            return token_make(scanner, TOKEN_RIGHT_BRACKET);
 
         case ';':
-            return token_make(TOKEN_SEMICOLON);
+            return token_make(scanner, TOKEN_SEMICOLON);
 
         case ',':
-            return token_make(TOKEN_COMMA);
+            return token_make(scanner, TOKEN_COMMA);
+
+        case ':':
+            return token_make(scanner, TOKEN_COLON);
 
         case '.':
-            return token_make(TOKEN_DOT);
+            return token_make(scanner, match_char(scanner, '.')
+                                           ? TOKEN_DOT_DOT
+                                           : TOKEN_DOT);
 
         case '-':
-            return token_make(TOKEN_MINUS);
+            return token_make(scanner, TOKEN_MINUS);
 
         case '+':
-            return token_make(TOKEN_PLUS);
+            return token_make(scanner, TOKEN_PLUS);
 
         case '/':
-            return token_make(TOKEN_SLASH);
+            return token_make(scanner, TOKEN_SLASH);
 
         case '*':
-            return token_make(TOKEN_STAR);
+            return token_make(scanner, TOKEN_STAR);
 
         case '!':
-            return token_make(match_char('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return token_make(scanner, match_char(scanner, '=')
+                                           ? TOKEN_BANG_EQUAL
+                                           : TOKEN_BANG);
 
         case '=':
-            return token_make(match_char('=') ? TOKEN_EQUAL_EQUAL
-                                              : TOKEN_EQUAL);
+            return token_make(scanner, match_char(scanner, '=')
+                                           ? TOKEN_EQUAL_EQUAL
+                                           : TOKEN_EQUAL);
 
         case '<':
-            return token_make(match_char('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return token_make(scanner, match_char(scanner, '=')
+                                           ? TOKEN_LESS_EQUAL
+                                           : TOKEN_LESS);
 
         case '>':
-            return token_make(match_char('=') ? TOKEN_GREATER_EQUAL
-                                              : TOKEN_GREATER);
+            return token_make(scanner, match_char(scanner, '=')
+                                           ? TOKEN_GREATER_EQUAL
+                                           : TOKEN_GREATER);
 
         case '"':
-            return token_make_string();
+            return token_make_string(scanner);
     }
 
-    return token_make_error("Unexpected character.");
+    return token_make_error(scanner, "Unexpected character.");
 }
\ No newline at end of file
@@ -11,6 +11,7 @@ typedef enum
     TOKEN_LEFT_BRACKET,
     TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
+    TOKEN_COLON,
     TOKEN_DOT,
     TOKEN_MINUS,
     TOKEN_PLUS,
@@ -27,6 +28,7 @@ typedef enum
     TOKEN_GREATER_EQUAL,
     TOKEN_LESS,
     TOKEN_LESS_EQUAL,
+    TOKEN_DOT_DOT,
 
     // Literals.
     TOKEN_IDENTIFIER,
@@ -41,16 +43,19 @@ typedef enum
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IN,
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
     TOKEN_PRINTLN,
+    TOKEN_RESUME,
     TOKEN_RETURN,
     TOKEN_SUPER,
     TOKEN_THIS,
     TOKEN_TRUE,
     TOKEN_VAR,
     TOKEN_WHILE,
+    TOKEN_YIELD,
 
     // Other.
     TOKEN_ERROR,
@@ -65,7 +70,14 @@ typedef struct
     int line;
 } Token;
 
-void scanner_init(const char* source);
-Token scanner_scan_token();
+typedef struct
+{
+    const char* start;
+    const char* current;
+    int line;
+} Scanner;
+
+void scanner_init(Scanner* scanner, const char* source);
+Token scanner_scan_token(Scanner* scanner);
 
 #endif // CLOX_SCANNER_H_
@@ -0,0 +1,603 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "general.h"
+#include "server.h"
+#include "vm.h"
+
+#define SERVER_MAX_SOURCE (64 * 1024 * 1024)
+
+typedef struct Job
+{
+    char* source;
+    char* output;
+    size_t output_length;
+    int status;
+
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+
+    struct Job* next; // Used by the in-order stdin writer only.
+} Job;
+
+// A worker owns a deque of jobs. The worker takes jobs from the head of its
+// own deque while idle workers steal from the tail of the others.
+typedef struct
+{
+    pthread_mutex_t lock;
+    Job** jobs;
+    int head;
+    int count;
+    int capacity;
+} JobDeque;
+
+typedef struct ServerPool ServerPool;
+
+typedef struct
+{
+    ServerPool* pool;
+    int index;
+    pthread_t thread;
+    JobDeque deque;
+    VM vm;
+} Worker;
+
+struct ServerPool
+{
+    Worker* workers;
+    int worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int pending;
+    unsigned int next_worker;
+    bool stopping;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////
+// JOBS AND DEQUES
+///////////////////////////////////////////////////////////////////////////////////////
+
+static Job* job_new(char* source)
+{
+    Job* job = (Job*)malloc(sizeof(Job));
+    if (job == NULL) exit(1);
+
+    job->source = source;
+    job->output = NULL;
+    job->output_length = 0;
+    job->status = 0;
+    job->done = false;
+    job->next = NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    return job;
+}
+
+static void job_free(Job* job)
+{
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    free(job->source);
+    free(job->output);
+    free(job);
+}
+
+static void job_wait(Job* job)
+{
+    pthread_mutex_lock(&job->lock);
+    while (!job->done) pthread_cond_wait(&job->finished, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void deque_init(JobDeque* deque)
+{
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->jobs = NULL;
+    deque->head = 0;
+    deque->count = 0;
+    deque->capacity = 0;
+}
+
+static void deque_free(JobDeque* deque)
+{
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->jobs);
+}
+
+static void deque_push(JobDeque* deque, Job* job)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count == deque->capacity)
+    {
+        int capacity = deque->capacity < 8 ? 8 : deque->capacity * 2;
+        Job** jobs = (Job**)malloc(sizeof(Job*) * capacity);
+        if (jobs == NULL) exit(1);
+
+        for (int i = 0; i < deque->count; ++i)
+            jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    deque->jobs[(deque->head + deque->count) % deque->capacity] = job;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static Job* deque_take(JobDeque* deque)
+{
+    Job* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count > 0)
+    {
+        job = deque->jobs[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static Job* deque_steal(JobDeque* deque)
+{
+    Job* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count > 0)
+    {
+        deque->count--;
+        job = deque->jobs[(deque->head + deque->count) % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// WORKERS
+///////////////////////////////////////////////////////////////////////////////////////
+
+static int status_from_result(InterpretResult result)
+{
+    switch (result)
+    {
+        case INTERPRET_COMPILE_ERROR:
+            return 65;
+
+        case INTERPRET_RUNTIME_ERROR:
+            return 70;
+
+        case INTERPRET_INTERRUPTED:
+            return 75;
+
+        default:
+            return 0;
+    }
+}
+
+static void worker_run_job(Worker* worker, Job* job)
+{
+    VM* vm = &worker->vm;
+
+    FILE* output = open_memstream(&job->output, &job->output_length);
+    if (output == NULL) exit(1);
+
+    vm->out = output;
+    vm->err = output;
+
+    InterpretResult result = vm_interpret(vm, job->source);
+    if (result == INTERPRET_INTERRUPTED) fputs("Out of fuel.\n", output);
+    job->status = status_from_result(result);
+
+    fclose(output);
+    vm->out = stdout;
+    vm->err = stderr;
+    vm_reset(vm);
+
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    pthread_cond_signal(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static Job* worker_find_job(Worker* worker)
+{
+    ServerPool* pool = worker->pool;
+
+    Job* job = deque_take(&worker->deque);
+
+    for (int i = 1; job == NULL && i < pool->worker_count; ++i)
+    {
+        Worker* victim =
+            &pool->workers[(worker->index + i) % pool->worker_count];
+        job = deque_steal(&victim->deque);
+    }
+
+    return job;
+}
+
+static void* worker_main(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    ServerPool* pool = worker->pool;
+
+    while (true)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending == 0 && !pool->stopping)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        if (pool->pending == 0 && pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        Job* job = worker_find_job(worker);
+        if (job == NULL) continue; // Another worker got there first.
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_mutex_unlock(&pool->lock);
+
+        worker_run_job(worker, job);
+    }
+
+    return NULL;
+}
+
+static void pool_init(ServerPool* pool, size_t heap_limit,
+                      uint64_t fuel_limit)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pool->worker_count = cores > 0 ? (int)cores : 1;
+    pool->workers = (Worker*)malloc(sizeof(Worker) * pool->worker_count);
+    if (pool->workers == NULL) exit(1);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->pending = 0;
+    pool->next_worker = 0;
+    pool->stopping = false;
+
+    for (int i = 0; i < pool->worker_count; ++i)
+    {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        deque_init(&worker->deque);
+        vm_init(&worker->vm);
+
+        // Every core already runs a VM of its own.
+        worker->vm.gc_threads = 1;
+        worker->vm.heap_limit = heap_limit;
+        worker->vm.fuel_limit = fuel_limit;
+    }
+
+    for (int i = 0; i < pool->worker_count; ++i)
+    {
+        Worker* worker = &pool->workers[i];
+        pthread_create(&worker->thread, NULL, worker_main, worker);
+    }
+}
+
+static void pool_submit(ServerPool* pool, Job* job)
+{
+    pthread_mutex_lock(&pool->lock);
+    Worker* worker = &pool->workers[pool->next_worker++ % pool->worker_count];
+    deque_push(&worker->deque, job);
+    pool->pending++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_free(ServerPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->worker_count; ++i)
+    {
+        Worker* worker = &pool->workers[i];
+        pthread_join(worker->thread, NULL);
+        vm_free(&worker->vm);
+        deque_free(&worker->deque);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// FRAMING
+///////////////////////////////////////////////////////////////////////////////////////
+
+static bool fd_read_exact(int fd, char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = read(fd, buffer, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        buffer += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+static bool fd_write_all(int fd, const char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, buffer, length);
+        if (n < 0 && errno == EINTR) continue;
+
+        // EPIPE included, the peer is gone and its connection is dropped.
+        if (n <= 0) return false;
+
+        buffer += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+// Reads one request and returns its NUL terminated source, or NULL at end of
+// stream or on a malformed header.
+static char* request_read(int fd)
+{
+    char header[32];
+    int length = 0;
+
+    while (true)
+    {
+        if (length == (int)sizeof(header) - 1) return NULL;
+        if (!fd_read_exact(fd, &header[length], 1)) return NULL;
+        if (header[length] == '\n') break;
+        length++;
+    }
+
+    header[length] = '\0';
+
+    char* end;
+    unsigned long size = strtoul(header, &end, 10);
+    if (end == header || *end != '\0' || size > SERVER_MAX_SOURCE) return NULL;
+
+    char* source = (char*)malloc(size + 1);
+    if (source == NULL) exit(1);
+
+    if (!fd_read_exact(fd, source, size))
+    {
+        free(source);
+        return NULL;
+    }
+
+    source[size] = '\0';
+    return source;
+}
+
+static bool response_write(int fd, Job* job)
+{
+    char header[64];
+    int length = snprintf(header, sizeof(header), "%d %zu\n", job->status,
+                          job->output_length);
+
+    return fd_write_all(fd, header, length) &&
+           fd_write_all(fd, job->output, job->output_length);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// STDIN MODE
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Responses on stdout must come back in request order, so a writer thread
+// waits on each submitted job in turn while the reader keeps submitting.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Job* head;
+    Job* tail;
+    bool closed;
+} JobFifo;
+
+static void* stdin_writer_main(void* arg)
+{
+    JobFifo* fifo = (JobFifo*)arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&fifo->lock);
+        while (fifo->head == NULL && !fifo->closed)
+            pthread_cond_wait(&fifo->changed, &fifo->lock);
+
+        Job* job = fifo->head;
+        if (job != NULL)
+        {
+            fifo->head = job->next;
+            if (fifo->head == NULL) fifo->tail = NULL;
+        }
+        pthread_mutex_unlock(&fifo->lock);
+
+        if (job == NULL) break;
+
+        job_wait(job);
+        response_write(STDOUT_FILENO, job);
+        job_free(job);
+    }
+
+    return NULL;
+}
+
+static int server_run_stdin(ServerPool* pool)
+{
+    JobFifo fifo;
+    pthread_mutex_init(&fifo.lock, NULL);
+    pthread_cond_init(&fifo.changed, NULL);
+    fifo.head = NULL;
+    fifo.tail = NULL;
+    fifo.closed = false;
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, stdin_writer_main, &fifo);
+
+    char* source;
+    while ((source = request_read(STDIN_FILENO)) != NULL)
+    {
+        Job* job = job_new(source);
+
+        pthread_mutex_lock(&fifo.lock);
+        if (fifo.tail == NULL)
+            fifo.head = job;
+        else
+            fifo.tail->next = job;
+        fifo.tail = job;
+        pthread_cond_signal(&fifo.changed);
+        pthread_mutex_unlock(&fifo.lock);
+
+        pool_submit(pool, job);
+    }
+
+    pthread_mutex_lock(&fifo.lock);
+    fifo.closed = true;
+    pthread_cond_signal(&fifo.changed);
+    pthread_mutex_unlock(&fifo.lock);
+
+    pthread_join(writer, NULL);
+    pthread_mutex_destroy(&fifo.lock);
+    pthread_cond_destroy(&fifo.changed);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// UNIX SOCKET MODE
+///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    ServerPool* pool;
+    int fd;
+} Connection;
+
+static void* connection_main(void* arg)
+{
+    Connection* connection = (Connection*)arg;
+
+    char* source;
+    while ((source = request_read(connection->fd)) != NULL)
+    {
+        Job* job = job_new(source);
+        pool_submit(connection->pool, job);
+        job_wait(job);
+
+        bool written = response_write(connection->fd, job);
+        job_free(job);
+
+        if (!written) break;
+    }
+
+    close(connection->fd);
+    free(connection);
+    return NULL;
+}
+
+static int server_run_socket(ServerPool* pool, const char* socket_path)
+{
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path '%s' is too long.\n", socket_path);
+        return 74;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return 74;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0)
+    {
+        perror(socket_path);
+        close(listener);
+        return 74;
+    }
+
+    while (true)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+
+        Connection* connection = (Connection*)malloc(sizeof(Connection));
+        if (connection == NULL) exit(1);
+        connection->pool = pool;
+        connection->fd = fd;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_main, connection) != 0)
+        {
+            close(fd);
+            free(connection);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 74;
+}
+
+int server_run(const char* socket_path, size_t heap_limit,
+               uint64_t fuel_limit)
+{
+    // A client hanging up before its response arrives makes the write fail
+    // with EPIPE, which drops just that connection instead of the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    ServerPool pool;
+    pool_init(&pool, heap_limit, fuel_limit);
+
+    int status = socket_path == NULL ? server_run_stdin(&pool)
+                                     : server_run_socket(&pool, socket_path);
+
+    pool_free(&pool);
+    return status;
+}
@@ -0,0 +1,20 @@
+#ifndef CLOX_SERVER_H_
+#define CLOX_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs clox as a script server backed by a pool of pre-initialized VMs, one
+// per online core. Jobs are read from the unix socket at `socket_path`, or
+// from stdin when it is NULL, using the framing
+//
+//     request:  <source length>\n<source bytes>
+//     response: <exit status> <output length>\n<output bytes>
+//
+// where the exit status matches the one `clox <path>` would return. A
+// non-zero heap_limit caps the heap of every VM in the pool and a non-zero
+// fuel_limit the backward jumps and calls of every job.
+int server_run(const char* socket_path, size_t heap_limit,
+               uint64_t fuel_limit);
+
+#endif // CLOX_SERVER_H_
@@ -0,0 +1,211 @@
+#include <math.h>
+
+#include "simd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+double simd_sum(const double* items, int count)
+{
+    int i = 0;
+    double sum = 0;
+
+#if defined(__SSE2__)
+    // Four accumulators keep as many additions in flight.
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    __m128d acc2 = _mm_setzero_pd();
+    __m128d acc3 = _mm_setzero_pd();
+
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(items + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(items + i + 2));
+        acc2 = _mm_add_pd(acc2, _mm_loadu_pd(items + i + 4));
+        acc3 = _mm_add_pd(acc3, _mm_loadu_pd(items + i + 6));
+    }
+
+    __m128d acc = _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < count; ++i) sum += items[i];
+    return sum;
+}
+
+double simd_dot(const double* a, const double* b, int count)
+{
+    int i = 0;
+    double sum = 0;
+
+#if defined(__SSE2__)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    __m128d acc2 = _mm_setzero_pd();
+    __m128d acc3 = _mm_setzero_pd();
+
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = _mm_add_pd(
+            acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(
+            acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        acc2 = _mm_add_pd(
+            acc2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+        acc3 = _mm_add_pd(
+            acc3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+    }
+
+    __m128d acc = _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < count; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+void simd_scale(double* items, int count, double factor)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128d scale = _mm_set1_pd(factor);
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_pd(items + i, _mm_mul_pd(_mm_loadu_pd(items + i), scale));
+#endif
+
+    for (; i < count; ++i) items[i] *= factor;
+}
+
+void simd_axpy(double alpha, const double* x, double* y, int count)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128d scale = _mm_set1_pd(alpha);
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d product = _mm_mul_pd(_mm_loadu_pd(x + i), scale);
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), product));
+    }
+#endif
+
+    for (; i < count; ++i) y[i] += alpha * x[i];
+}
+
+double simd_min(const double* items, int count)
+{
+    int i = 0;
+    double min = items[0];
+
+#if defined(__SSE2__)
+    if (count >= 4)
+    {
+        __m128d acc0 = _mm_loadu_pd(items);
+        __m128d acc1 = _mm_loadu_pd(items + 2);
+
+        // _mm_min_pd drops a NaN in its first operand, so NaNs are tracked
+        // apart from the running min.
+        __m128d nan = _mm_cmpunord_pd(acc0, acc1);
+
+        for (i = 4; i + 4 <= count; i += 4)
+        {
+            __m128d next0 = _mm_loadu_pd(items + i);
+            __m128d next1 = _mm_loadu_pd(items + i + 2);
+            nan = _mm_or_pd(nan, _mm_cmpunord_pd(next0, next1));
+            acc0 = _mm_min_pd(acc0, next0);
+            acc1 = _mm_min_pd(acc1, next1);
+        }
+
+        if (_mm_movemask_pd(nan) != 0) return NAN;
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_min_pd(acc0, acc1));
+        min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if (items[i] != items[i]) return NAN;
+        if (items[i] < min) min = items[i];
+    }
+
+    return min;
+}
+
+double simd_max(const double* items, int count)
+{
+    int i = 0;
+    double max = items[0];
+
+#if defined(__SSE2__)
+    if (count >= 4)
+    {
+        __m128d acc0 = _mm_loadu_pd(items);
+        __m128d acc1 = _mm_loadu_pd(items + 2);
+
+        // _mm_max_pd drops a NaN in its first operand, so NaNs are tracked
+        // apart from the running max.
+        __m128d nan = _mm_cmpunord_pd(acc0, acc1);
+
+        for (i = 4; i + 4 <= count; i += 4)
+        {
+            __m128d next0 = _mm_loadu_pd(items + i);
+            __m128d next1 = _mm_loadu_pd(items + i + 2);
+            nan = _mm_or_pd(nan, _mm_cmpunord_pd(next0, next1));
+            acc0 = _mm_max_pd(acc0, next0);
+            acc1 = _mm_max_pd(acc1, next1);
+        }
+
+        if (_mm_movemask_pd(nan) != 0) return NAN;
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_max_pd(acc0, acc1));
+        max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if (items[i] != items[i]) return NAN;
+        if (items[i] > max) max = items[i];
+    }
+
+    return max;
+}
+
+int simd_find_u64(const uint64_t* items, int count, uint64_t needle)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    // SSE2 compares 32-bit halves, a word matches when both of its do.
+    __m128i target = _mm_set1_epi64x((long long)needle);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i low = _mm_cmpeq_epi32(
+            _mm_loadu_si128((const __m128i*)(items + i)), target);
+        __m128i high = _mm_cmpeq_epi32(
+            _mm_loadu_si128((const __m128i*)(items + i + 2)), target);
+
+        low = _mm_and_si128(low, _mm_shuffle_epi32(low, 0xb1));
+        high = _mm_and_si128(high, _mm_shuffle_epi32(high, 0xb1));
+
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(low)) |
+                   _mm_movemask_pd(_mm_castsi128_pd(high)) << 2;
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < count; ++i)
+        if (items[i] == needle) return i;
+
+    return -1;
+}
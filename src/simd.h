@@ -0,0 +1,24 @@
+#ifndef CLOX_SIMD_H_
+#define CLOX_SIMD_H_
+
+#include "general.h"
+
+// Kernels over contiguous doubles and 64-bit words, two lanes at a time with
+// SSE2 where the target has it and plain loops elsewhere. Sums run in several
+// independent lanes, so they may round differently than a loop adding left to
+// right.
+double simd_sum(const double* items, int count);
+double simd_dot(const double* a, const double* b, int count);
+void simd_scale(double* items, int count, double factor);
+
+// y += alpha * x
+void simd_axpy(double alpha, const double* x, double* y, int count);
+
+// Both need at least one item, and return NaN as soon as any item is NaN.
+double simd_min(const double* items, int count);
+double simd_max(const double* items, int count);
+
+// Index of the first item with exactly the bits of needle, -1 if none has.
+int simd_find_u64(const uint64_t* items, int count, uint64_t needle);
+
+#endif // CLOX_SIMD_H_
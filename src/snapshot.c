@@ -0,0 +1,1130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include "snapshot.h"
+#include "table.h"
+#include "value.h"
+
+#define SNAPSHOT_MAGIC "CLOXIMG"
+#define SNAPSHOT_VERSION 1
+
+// References are stored as object index + 1 so that 0 can stand for NULL.
+#define SNAPSHOT_NULL_REF 0
+
+typedef enum
+{
+    SNAP_NIL,
+    SNAP_FALSE,
+    SNAP_TRUE,
+    SNAP_NUMBER,
+    SNAP_OBJ,
+} SnapValueTag;
+
+///////////////////////////////////////////////////////////////////////////////////////
+// WRITING
+///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    Obj* object;
+    uint32_t id;
+} ObjIndex;
+
+typedef struct
+{
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+
+    Obj** objects;
+    ObjIndex* index;
+    uint32_t object_count;
+} Writer;
+
+static void write_bytes(Writer* writer, const void* bytes, size_t count)
+{
+    if (writer->count + count > writer->capacity)
+    {
+        size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (capacity < writer->count + count) capacity *= 2;
+
+        writer->bytes = (uint8_t*)realloc(writer->bytes, capacity);
+        if (writer->bytes == NULL) exit(1);
+        writer->capacity = capacity;
+    }
+
+    memcpy(writer->bytes + writer->count, bytes, count);
+    writer->count += count;
+}
+
+static void write_u8(Writer* writer, uint8_t value)
+{
+    write_bytes(writer, &value, sizeof(value));
+}
+
+static void write_u32(Writer* writer, uint32_t value)
+{
+    write_bytes(writer, &value, sizeof(value));
+}
+
+static void write_i32(Writer* writer, int32_t value)
+{
+    write_bytes(writer, &value, sizeof(value));
+}
+
+static int obj_index_compare(const void* a, const void* b)
+{
+    const Obj* left = ((const ObjIndex*)a)->object;
+    const Obj* right = ((const ObjIndex*)b)->object;
+
+    return left < right ? -1 : left > right;
+}
+
+static uint32_t obj_ref(Writer* writer, Obj* object)
+{
+    if (object == NULL) return SNAPSHOT_NULL_REF;
+
+    ObjIndex key = {object, 0};
+    ObjIndex* found =
+        (ObjIndex*)bsearch(&key, writer->index, writer->object_count,
+                           sizeof(ObjIndex), obj_index_compare);
+
+    // Every object reachable from a live one is live itself.
+    return found->id + 1;
+}
+
+static void write_ref(Writer* writer, Obj* object)
+{
+    write_u32(writer, obj_ref(writer, object));
+}
+
+static void write_value(Writer* writer, Value value)
+{
+    if (value_is_nil(value))
+    {
+        write_u8(writer, SNAP_NIL);
+    }
+    else if (value_is_bool(value))
+    {
+        write_u8(writer, value_as_bool(value) ? SNAP_TRUE : SNAP_FALSE);
+    }
+    else if (value_is_number(value))
+    {
+        double number = value_as_number(value);
+        write_u8(writer, SNAP_NUMBER);
+        write_bytes(writer, &number, sizeof(number));
+    }
+    else
+    {
+        write_u8(writer, SNAP_OBJ);
+        write_ref(writer, value_as_obj(value));
+    }
+}
+
+static void write_table(Writer* writer, Table* table)
+{
+    uint32_t count = 0;
+    for (int i = 0; i < table->capacity; ++i)
+        if (table->entries[i].key != NULL) count++;
+
+    write_u32(writer, count);
+
+    for (int i = 0; i < table->capacity; ++i)
+    {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+
+        write_ref(writer, (Obj*)entry->key);
+        write_value(writer, entry->value);
+    }
+}
+
+// Objects are emitted grouped by rank so that whatever a shell needs at
+// creation time (a closure's function) is created before it.
+static int obj_rank(ObjType type)
+{
+    switch (type)
+    {
+        case OBJ_STRING:
+            return 0;
+
+        case OBJ_NATIVE_FN:
+        case OBJ_FUNCTION:
+            return 1;
+
+        default:
+            return 2;
+    }
+}
+
+static bool native_name_find(VM* vm, ObjNativeFn* native, ObjString** out_name)
+{
+    Table* builtins = &vm->builtins;
+    for (int i = 0; i < builtins->capacity; ++i)
+    {
+        Entry* entry = &builtins->entries[i];
+        if (entry->key == NULL || !obj_is_native_fn(entry->value)) continue;
+
+        if (value_as_obj(entry->value) == (Obj*)native)
+        {
+            *out_name = entry->key;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool write_header(Writer* writer, VM* vm, Obj* object)
+{
+    write_u8(writer, (uint8_t)object->type);
+
+    switch (object->type)
+    {
+        case OBJ_STRING:
+        {
+            ObjString* string = (ObjString*)object;
+            write_u32(writer, (uint32_t)string->length);
+            write_bytes(writer, string->chars, string->length);
+            break;
+        }
+
+        case OBJ_NATIVE_FN:
+        {
+            ObjString* name;
+            if (!native_name_find(vm, (ObjNativeFn*)object, &name))
+            {
+                fprintf(vm->err, "Cannot snapshot an unregistered native.\n");
+                return false;
+            }
+
+            write_ref(writer, (Obj*)name);
+            break;
+        }
+
+        case OBJ_FUNCTION:
+            write_i32(writer, ((ObjFunction*)object)->upvalue_count);
+            break;
+
+        case OBJ_CLOSURE:
+            write_ref(writer, (Obj*)((ObjClosure*)object)->function);
+            break;
+
+        default:
+            break; // Created empty and filled in by the body.
+    }
+
+    return true;
+}
+
+static void write_body(Writer* writer, Obj* object)
+{
+    switch (object->type)
+    {
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            Chunk* chunk = &function->chunk;
+
+            write_i32(writer, function->arity);
+            write_ref(writer, (Obj*)function->name);
+            write_u32(writer, (uint32_t)chunk->count);
+            write_bytes(writer, chunk->code, chunk->count);
+            write_bytes(writer, chunk->lines, sizeof(int) * chunk->count);
+            write_u32(writer, (uint32_t)chunk->constants.count);
+
+            for (int i = 0; i < chunk->constants.count; ++i)
+                write_value(writer, chunk->constants.values[i]);
+
+            break;
+        }
+
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)object;
+            for (int i = 0; i < closure->upvalue_count; ++i)
+                write_ref(writer, (Obj*)closure->upvalues[i]);
+
+            break;
+        }
+
+        case OBJ_UPVALUE:
+            write_value(writer, ((ObjUpValue*)object)->closed);
+            break;
+
+        case OBJ_FIBER:
+        {
+            // Stack addresses are stored as offsets from the stack base.
+            ObjFiber* fiber = (ObjFiber*)object;
+            write_u8(writer, (uint8_t)fiber->state);
+            write_ref(writer, (Obj*)fiber->caller);
+
+            write_u32(writer, (uint32_t)(fiber->stack_top - fiber->stack));
+            for (Value* slot = fiber->stack; slot < fiber->stack_top; ++slot)
+                write_value(writer, *slot);
+
+            write_u32(writer, (uint32_t)fiber->frame_count);
+            for (int i = 0; i < fiber->frame_count; ++i)
+            {
+                CallFrame* frame = &fiber->frames[i];
+                uint8_t* code = frame->closure->function->chunk.code;
+                write_ref(writer, (Obj*)frame->closure);
+                write_u32(writer, (uint32_t)(frame->ip - code));
+                write_u32(writer, (uint32_t)(frame->slots - fiber->stack));
+            }
+
+            uint32_t upvalue_count = 0;
+            for (ObjUpValue* upvalue = fiber->open_upvalues; upvalue != NULL;
+                 upvalue = upvalue->next)
+                upvalue_count++;
+
+            write_u32(writer, upvalue_count);
+            for (ObjUpValue* upvalue = fiber->open_upvalues; upvalue != NULL;
+                 upvalue = upvalue->next)
+            {
+                write_ref(writer, (Obj*)upvalue);
+                write_u32(writer, (uint32_t)(upvalue->location - fiber->stack));
+            }
+
+            break;
+        }
+
+        case OBJ_CLASS:
+        {
+            ObjClass* cls = (ObjClass*)object;
+            write_ref(writer, (Obj*)cls->name);
+            write_table(writer, &cls->methods);
+            break;
+        }
+
+        case OBJ_INSTANCE:
+        {
+            ObjInstance* instance = (ObjInstance*)object;
+            write_ref(writer, (Obj*)instance->cls);
+            write_table(writer, &instance->fields);
+            break;
+        }
+
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            write_value(writer, bound->receiver);
+            write_ref(writer, (Obj*)bound->method);
+            break;
+        }
+
+        case OBJ_LIST:
+        {
+            ObjList* list = (ObjList*)object;
+            write_u32(writer, (uint32_t)list->count);
+            for (int i = 0; i < list->count; ++i)
+                write_value(writer, list->items[i]);
+
+            break;
+        }
+
+        case OBJ_FLOAT_ARRAY:
+        {
+            ObjFloatArray* array = (ObjFloatArray*)object;
+            write_u32(writer, (uint32_t)array->count);
+            if (array->count > 0)
+                write_bytes(writer, array->items,
+                            sizeof(double) * array->count);
+            break;
+        }
+
+        case OBJ_MAP:
+        {
+            ObjMap* map = (ObjMap*)object;
+            write_u32(writer, (uint32_t)map->count);
+            for (int i = 0; i < map->capacity; ++i)
+            {
+                MapEntry* entry = &map->entries[i];
+                if (entry->hash < MAP_HASH_MIN) continue;
+
+                write_value(writer, entry->key);
+                write_value(writer, entry->value);
+            }
+
+            break;
+        }
+
+        case OBJ_NATIVE_FN:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+static void writer_collect(Writer* writer, VM* vm)
+{
+    HeapIter iter;
+    uint32_t count = 0;
+
+    heap_iter_init(&iter, &vm->heap);
+    while (heap_iter_next(&iter) != NULL) count++;
+
+    writer->objects = (Obj**)malloc(sizeof(Obj*) * (count + 1));
+    writer->index = (ObjIndex*)malloc(sizeof(ObjIndex) * (count + 1));
+    if (writer->objects == NULL || writer->index == NULL) exit(1);
+
+    uint32_t id = 0;
+    for (int rank = 0; rank <= 2; ++rank)
+    {
+        heap_iter_init(&iter, &vm->heap);
+        for (Obj* object; (object = heap_iter_next(&iter)) != NULL;)
+        {
+            if (obj_rank(object->type) != rank) continue;
+
+            writer->objects[id] = object;
+            writer->index[id].object = object;
+            writer->index[id].id = id;
+            id++;
+        }
+    }
+
+    writer->object_count = count;
+    qsort(writer->index, count, sizeof(ObjIndex), obj_index_compare);
+}
+
+bool snapshot_save(VM* vm, const char* path)
+{
+    // Only keep what the prelude left reachable.
+    gc_perform(vm);
+    gc_sweep_finish(vm);
+
+    Writer writer = {0};
+    writer_collect(&writer, vm);
+
+    write_bytes(&writer, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+    write_u8(&writer, SNAPSHOT_VERSION);
+    write_u32(&writer, writer.object_count);
+
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < writer.object_count; ++i)
+        ok = write_header(&writer, vm, writer.objects[i]);
+
+    for (uint32_t i = 0; ok && i < writer.object_count; ++i)
+        write_body(&writer, writer.objects[i]);
+
+    if (ok) write_table(&writer, &vm->globals);
+
+    if (ok)
+    {
+        FILE* file = fopen(path, "wb");
+        if (file == NULL ||
+            fwrite(writer.bytes, 1, writer.count, file) != writer.count)
+        {
+            fprintf(vm->err, "Could not write image '%s'.\n", path);
+            ok = false;
+        }
+
+        if (file != NULL) fclose(file);
+    }
+
+    free(writer.bytes);
+    free(writer.objects);
+    free(writer.index);
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// READING
+///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    VM* vm;
+    const uint8_t* bytes;
+    size_t count;
+    size_t offset;
+    bool failed;
+
+    // Every restored object, kept reachable through the VM stack while the
+    // image is being relocated.
+    ObjList* objects;
+} Reader;
+
+static bool read_bytes(Reader* reader, void* out, size_t count)
+{
+    if (reader->failed || reader->count - reader->offset < count)
+    {
+        reader->failed = true;
+        memset(out, 0, count);
+        return false;
+    }
+
+    memcpy(out, reader->bytes + reader->offset, count);
+    reader->offset += count;
+    return true;
+}
+
+// Whether count more items of size bytes each are left in the image, which
+// bounds every count read from it before anything is allocated for them.
+static bool reader_has(Reader* reader, uint32_t count, size_t size)
+{
+    if (!reader->failed && count <= (reader->count - reader->offset) / size)
+        return true;
+
+    reader->failed = true;
+    return false;
+}
+
+static uint8_t read_u8(Reader* reader)
+{
+    uint8_t value;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t read_u32(Reader* reader)
+{
+    uint32_t value;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static int32_t read_i32(Reader* reader)
+{
+    int32_t value;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static Obj* read_ref(Reader* reader)
+{
+    uint32_t ref = read_u32(reader);
+    if (ref == SNAPSHOT_NULL_REF) return NULL;
+
+    if (ref > (uint32_t)reader->objects->count)
+    {
+        reader->failed = true;
+        return NULL;
+    }
+
+    return value_as_obj(reader->objects->items[ref - 1]);
+}
+
+static Obj* read_ref_of_type(Reader* reader, ObjType type)
+{
+    Obj* object = read_ref(reader);
+    if (object != NULL && object->type != type)
+    {
+        reader->failed = true;
+        return NULL;
+    }
+
+    return object;
+}
+
+static Value read_value(Reader* reader)
+{
+    switch (read_u8(reader))
+    {
+        case SNAP_NIL:
+            return value_make_nil();
+
+        case SNAP_FALSE:
+            return value_make_bool(false);
+
+        case SNAP_TRUE:
+            return value_make_bool(true);
+
+        case SNAP_NUMBER:
+        {
+            double number;
+            read_bytes(reader, &number, sizeof(number));
+            return value_make_number(number);
+        }
+
+        case SNAP_OBJ:
+        {
+            Obj* object = read_ref(reader);
+            if (object != NULL) return value_make_obj(object);
+        }
+        // Fallthrough.
+
+        default:
+            reader->failed = true;
+            return value_make_nil();
+    }
+}
+
+static void read_table(Reader* reader, Table* table)
+{
+    // A key reference and a value tag at least.
+    uint32_t count = read_u32(reader);
+    if (!reader_has(reader, count, sizeof(uint32_t) + 1)) return;
+
+    for (uint32_t i = 0; i < count && !reader->failed; ++i)
+    {
+        ObjString* key = (ObjString*)read_ref_of_type(reader, OBJ_STRING);
+        Value value = read_value(reader);
+
+        if (key == NULL) reader->failed = true;
+        if (reader->failed) return;
+
+        table_set(reader->vm, table, key, value);
+    }
+}
+
+static Obj* read_header(Reader* reader)
+{
+    VM* vm = reader->vm;
+
+    switch ((ObjType)read_u8(reader))
+    {
+        case OBJ_STRING:
+        {
+            uint32_t length = read_u32(reader);
+            if (length > INT32_MAX || !reader_has(reader, length, 1)) break;
+
+            const char* chars = (const char*)reader->bytes + reader->offset;
+            reader->offset += length;
+            return (Obj*)obj_string_cpy(vm, chars, (int)length);
+        }
+
+        case OBJ_NATIVE_FN:
+        {
+            ObjString* name = (ObjString*)read_ref_of_type(reader, OBJ_STRING);
+            Value native;
+
+            if (name == NULL || !table_get(&vm->builtins, name, &native))
+                break;
+
+            return value_as_obj(native);
+        }
+
+        case OBJ_FUNCTION:
+        {
+            // Closures of it are created with this many upvalues.
+            int32_t upvalue_count = read_i32(reader);
+            if (upvalue_count < 0 || upvalue_count > UINT8_COUNT) break;
+
+            ObjFunction* function = obj_function_new(vm);
+            function->upvalue_count = upvalue_count;
+            return (Obj*)function;
+        }
+
+        case OBJ_CLOSURE:
+        {
+            ObjFunction* function =
+                (ObjFunction*)read_ref_of_type(reader, OBJ_FUNCTION);
+
+            if (function == NULL) break;
+            return (Obj*)obj_closure_new(vm, function);
+        }
+
+        case OBJ_UPVALUE:
+        {
+            ObjUpValue* upvalue = obj_upvalue_new(vm, NULL);
+            upvalue->location = &upvalue->closed;
+            return (Obj*)upvalue;
+        }
+
+        case OBJ_FIBER:
+            return (Obj*)obj_fiber_new(vm, NULL);
+
+        case OBJ_CLASS:
+            return (Obj*)obj_class_new(vm, NULL);
+
+        case OBJ_INSTANCE:
+            return (Obj*)obj_instance_new(vm, NULL);
+
+        case OBJ_BOUND_METHOD:
+            return (Obj*)obj_bound_method_new(vm, value_make_nil(), NULL);
+
+        case OBJ_LIST:
+            return (Obj*)obj_list_new(vm);
+
+        case OBJ_FLOAT_ARRAY:
+            return (Obj*)obj_float_array_new(vm, 0);
+
+        case OBJ_MAP:
+            return (Obj*)obj_map_new(vm);
+    }
+
+    reader->failed = true;
+    return NULL;
+}
+
+static void read_fiber(Reader* reader, ObjFiber* fiber)
+{
+    VM* vm = reader->vm;
+
+    uint8_t state = read_u8(reader);
+    if (state > FIBER_DONE)
+    {
+        reader->failed = true;
+        return;
+    }
+
+    fiber->state = (FiberState)state;
+    fiber->caller = (ObjFiber*)read_ref_of_type(reader, OBJ_FIBER);
+
+    uint32_t stack_count = read_u32(reader);
+    if (!reader_has(reader, stack_count, 1) || stack_count >= INT32_MAX)
+        return;
+
+    // One spare slot keeps stack_top below the end, as pushes expect.
+    obj_fiber_stack_ensure(vm, fiber, (int)stack_count + 1);
+    for (uint32_t i = 0; i < stack_count; ++i)
+        *fiber->stack_top++ = read_value(reader);
+
+    uint32_t frame_count = read_u32(reader);
+    if (reader->failed || frame_count > FRAMES_MAX)
+    {
+        reader->failed = true;
+        return;
+    }
+
+    obj_fiber_frames_ensure(vm, fiber, (int)frame_count);
+    for (uint32_t i = 0; i < frame_count; ++i)
+    {
+        ObjClosure* closure =
+            (ObjClosure*)read_ref_of_type(reader, OBJ_CLOSURE);
+        uint32_t ip = read_u32(reader);
+        uint32_t slots = read_u32(reader);
+
+        // Functions come before fibers, so the code is there already.
+        if (closure == NULL || closure->function->chunk.count == 0 ||
+            ip > (uint32_t)closure->function->chunk.count ||
+            slots > stack_count)
+        {
+            reader->failed = true;
+            return;
+        }
+
+        CallFrame* frame = &fiber->frames[fiber->frame_count++];
+        frame->closure = closure;
+        frame->ip = closure->function->chunk.code + ip;
+        frame->slots = fiber->stack + slots;
+    }
+
+    ObjUpValue** tail = &fiber->open_upvalues;
+    uint32_t upvalue_count = read_u32(reader);
+    if (!reader_has(reader, upvalue_count, 2 * sizeof(uint32_t))) return;
+    for (uint32_t i = 0; i < upvalue_count && !reader->failed; ++i)
+    {
+        ObjUpValue* upvalue =
+            (ObjUpValue*)read_ref_of_type(reader, OBJ_UPVALUE);
+        uint32_t slot = read_u32(reader);
+
+        if (upvalue == NULL || slot >= stack_count)
+        {
+            reader->failed = true;
+            return;
+        }
+
+        upvalue->location = fiber->stack + slot;
+        upvalue->fiber = fiber;
+        upvalue->next = NULL;
+        *tail = upvalue;
+        tail = &upvalue->next;
+    }
+}
+
+// Length of the instruction at offset including its operands, or 0 when it
+// is no instruction or an operand indexes past the function's constants or
+// upvalues.
+static int instruction_check(ObjFunction* function, int offset)
+{
+    Chunk* chunk = &function->chunk;
+    uint8_t* code = chunk->code + offset;
+    int left = chunk->count - offset;
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CLASS:
+        case OP_METHOD:
+        {
+            if (left < 2 || code[1] >= chunk->constants.count) return 0;
+
+            Value constant = chunk->constants.values[code[1]];
+            if (code[0] != OP_CONSTANT && !obj_is_string(constant)) return 0;
+            return 2;
+        }
+
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            if (left < 3 || code[1] >= chunk->constants.count ||
+                !obj_is_string(chunk->constants.values[code[1]]))
+                return 0;
+
+            return 3;
+
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            return left >= 2 && code[1] < function->upvalue_count ? 2 : 0;
+
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_LIST_INIT:
+        case OP_RESUME:
+        case OP_MAP_INIT:
+            return left >= 2 ? 2 : 0;
+
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return left >= 3 ? 3 : 0;
+
+        case OP_ITER_NEXT:
+            return left >= 4 ? 4 : 0;
+
+        case OP_FOR_RANGE:
+            return left >= 5 ? 5 : 0;
+
+        case OP_CLOSURE:
+        {
+            if (left < 2 || code[1] >= chunk->constants.count) return 0;
+
+            Value constant = chunk->constants.values[code[1]];
+            if (!obj_is_function(constant)) return 0;
+
+            // An is_local and index pair per upvalue, those taken from the
+            // enclosing function's upvalues have to be there.
+            int upvalue_count = obj_as_function(constant)->upvalue_count;
+            if (left < 2 + 2 * upvalue_count) return 0;
+
+            for (int i = 0; i < upvalue_count; ++i)
+            {
+                uint8_t is_local = code[2 + 2 * i];
+                uint8_t index = code[3 + 2 * i];
+                if (is_local > 1) return 0;
+                if (!is_local && index >= function->upvalue_count) return 0;
+            }
+
+            return 2 + 2 * upvalue_count;
+        }
+
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_PRINTLN:
+        case OP_CLOSE_UPVALUE:
+        case OP_LIST_GETIDX:
+        case OP_LIST_SETIDX:
+        case OP_RETURN:
+        case OP_YIELD:
+        case OP_INHERIT:
+            return 1;
+    }
+
+    return 0;
+}
+
+// Where the jump at offset lands, or -1 for any other instruction.
+static int jump_target(Chunk* chunk, int offset, int length)
+{
+    uint8_t* code = chunk->code + offset;
+
+    switch (code[0])
+    {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return offset + length + ((code[1] << 8) | code[2]);
+
+        case OP_LOOP:
+        case OP_FOR_RANGE:
+        case OP_ITER_NEXT:
+            return offset + length -
+                   ((code[length - 2] << 8) | code[length - 1]);
+
+        default:
+            return -1;
+    }
+}
+
+// Walks the code of a restored function the way the interpreter will, so
+// that no operand reads past its constants or upvalues, every jump lands on
+// an instruction and the code cannot run off its end. Stack slot operands
+// are left to the compiler that wrote them.
+static bool code_check(ObjFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+    bool* starts = (bool*)calloc(chunk->count + 1, sizeof(bool));
+    if (starts == NULL) exit(1);
+
+    bool ok = true;
+    int last = 0;
+
+    for (int offset = 0; ok && offset < chunk->count;)
+    {
+        int length = instruction_check(function, offset);
+        starts[offset] = true;
+        last = offset;
+
+        ok = length > 0;
+        offset += length;
+    }
+
+    ok = ok && chunk->code[last] == OP_RETURN;
+
+    for (int offset = 0; ok && offset < chunk->count;)
+    {
+        int length = instruction_check(function, offset);
+        int target = jump_target(chunk, offset, length);
+
+        ok = target == -1 || (target >= 0 && target < chunk->count &&
+                              starts[target]);
+        offset += length;
+    }
+
+    free(starts);
+    return ok;
+}
+
+static void read_body(Reader* reader, Obj* object)
+{
+    VM* vm = reader->vm;
+
+    switch (object->type)
+    {
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            Chunk* chunk = &function->chunk;
+
+            function->arity = read_i32(reader);
+            function->name = (ObjString*)read_ref_of_type(reader, OBJ_STRING);
+
+            uint32_t count = read_u32(reader);
+            if (function->arity < 0 || function->arity > UINT8_MAX ||
+                count == 0 ||
+                !reader_has(reader, count, 1 + sizeof(int)))
+            {
+                reader->failed = true;
+                return;
+            }
+
+            chunk->code = mem_alloc(vm, uint8_t, count);
+            chunk->lines = mem_alloc(vm, int, count);
+            chunk->capacity = (int)count;
+            chunk->count = (int)count;
+            read_bytes(reader, chunk->code, count);
+            read_bytes(reader, chunk->lines, sizeof(int) * count);
+
+            uint32_t constant_count = read_u32(reader);
+            if (!reader_has(reader, constant_count, 1)) return;
+
+            for (uint32_t i = 0; i < constant_count && !reader->failed; ++i)
+            {
+                Value constant = read_value(reader);
+                value_array_write(vm, &chunk->constants, constant);
+            }
+
+            if (!reader->failed && !code_check(function)) reader->failed = true;
+            break;
+        }
+
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)object;
+            for (int i = 0; i < closure->upvalue_count; ++i)
+            {
+                closure->upvalues[i] =
+                    (ObjUpValue*)read_ref_of_type(reader, OBJ_UPVALUE);
+                if (closure->upvalues[i] == NULL) reader->failed = true;
+            }
+
+            break;
+        }
+
+        case OBJ_UPVALUE:
+            ((ObjUpValue*)object)->closed = read_value(reader);
+            break;
+
+        case OBJ_FIBER:
+            read_fiber(reader, (ObjFiber*)object);
+            break;
+
+        case OBJ_CLASS:
+        {
+            ObjClass* cls = (ObjClass*)object;
+            cls->name = (ObjString*)read_ref_of_type(reader, OBJ_STRING);
+            if (cls->name == NULL) reader->failed = true;
+
+            read_table(reader, &cls->methods);
+            break;
+        }
+
+        case OBJ_INSTANCE:
+        {
+            ObjInstance* instance = (ObjInstance*)object;
+            instance->cls = (ObjClass*)read_ref_of_type(reader, OBJ_CLASS);
+            if (instance->cls == NULL) reader->failed = true;
+
+            read_table(reader, &instance->fields);
+            break;
+        }
+
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            bound->receiver = read_value(reader);
+            bound->method = (ObjClosure*)read_ref_of_type(reader, OBJ_CLOSURE);
+            if (bound->method == NULL) reader->failed = true;
+            break;
+        }
+
+        case OBJ_LIST:
+        {
+            ObjList* list = (ObjList*)object;
+            uint32_t count = read_u32(reader);
+            if (!reader_has(reader, count, 1)) return;
+
+            for (uint32_t i = 0; i < count && !reader->failed; ++i)
+            {
+                Value item = read_value(reader);
+                obj_list_append(vm, list, item);
+            }
+
+            break;
+        }
+
+        case OBJ_FLOAT_ARRAY:
+        {
+            ObjFloatArray* array = (ObjFloatArray*)object;
+            uint32_t count = read_u32(reader);
+            if (!reader_has(reader, count, sizeof(double))) return;
+
+            if (count == 0) break;
+
+            array->items = mem_alloc(vm, double, count);
+            array->count = (int)count;
+            read_bytes(reader, array->items, sizeof(double) * count);
+            break;
+        }
+
+        case OBJ_MAP:
+        {
+            // Keys hashed by address get hashed again for where they live now.
+            ObjMap* map = (ObjMap*)object;
+            uint32_t count = read_u32(reader);
+            if (!reader_has(reader, count, 2)) return;
+
+            for (uint32_t i = 0; i < count && !reader->failed; ++i)
+            {
+                Value key = read_value(reader);
+                Value value = read_value(reader);
+
+                // Maps never hold NaN keys, nothing would find them.
+                if (value_is_number(key) &&
+                    value_as_number(key) != value_as_number(key))
+                    reader->failed = true;
+
+                if (!reader->failed) map_set(vm, map, key, value);
+            }
+
+            break;
+        }
+
+        case OBJ_NATIVE_FN:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+static uint8_t* file_read_all(const char* path, size_t* out_count)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0l, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    uint8_t* bytes = size >= 0 ? (uint8_t*)malloc(size + 1) : NULL;
+    if (bytes != NULL && fread(bytes, 1, size, file) != (size_t)size)
+    {
+        free(bytes);
+        bytes = NULL;
+    }
+
+    fclose(file);
+    *out_count = (size_t)size;
+    return bytes;
+}
+
+bool snapshot_load(VM* vm, const char* path)
+{
+    Reader reader;
+    reader.vm = vm;
+    reader.offset = 0;
+    reader.failed = false;
+    reader.bytes = file_read_all(path, &reader.count);
+
+    if (reader.bytes == NULL)
+    {
+        fprintf(vm->err, "Could not read image '%s'.\n", path);
+        return false;
+    }
+
+    char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+    read_bytes(&reader, magic, sizeof(magic));
+    if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+        read_u8(&reader) != SNAPSHOT_VERSION)
+    {
+        fprintf(vm->err, "'%s' is not a clox image.\n", path);
+        free((void*)reader.bytes);
+        return false;
+    }
+
+    reader.objects = obj_list_new(vm);
+    vm_stack_push(vm, value_make_obj(reader.objects));
+
+    // First create every object as an empty shell, then relocate the
+    // references between them now that each index has an address.
+    uint32_t count = read_u32(&reader);
+    reader_has(&reader, count, 1);
+
+    for (uint32_t i = 0; i < count && !reader.failed; ++i)
+    {
+        Obj* object = read_header(&reader);
+        if (object == NULL) break;
+
+        vm_stack_push(vm, value_make_obj(object));
+        obj_list_append(vm, reader.objects, value_make_obj(object));
+        vm_stack_pop(vm);
+    }
+
+    for (uint32_t i = 0; i < count && !reader.failed; ++i)
+        read_body(&reader, value_as_obj(reader.objects->items[i]));
+
+    if (!reader.failed) read_table(&reader, &vm->globals);
+
+    vm_stack_pop(vm);
+    free((void*)reader.bytes);
+
+    if (reader.failed)
+    {
+        fprintf(vm->err, "Image '%s' is corrupted.\n", path);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef CLOX_SNAPSHOT_H_
+#define CLOX_SNAPSHOT_H_
+
+#include "general.h"
+#include "vm.h"
+
+// Writes every live object of an idle VM (typically right after running a
+// prelude script) plus its globals into a heap image at `path`.
+bool snapshot_save(VM* vm, const char* path);
+
+// Restores a heap image written by snapshot_save into a freshly initialized
+// VM, so the prelude's classes, functions and globals are available without
+// compiling or running it again. Images are only portable between builds of
+// the same clox binary.
+bool snapshot_load(VM* vm, const char* path);
+
+#endif // CLOX_SNAPSHOT_H_
@@ -15,9 +15,9 @@ void table_init(Table* table)
     table->entries = NULL;
 }
 
-void table_free(Table* table)
+void table_free(VM* vm, Table* table)
 {
-    array_free(Entry, table->entries, table->capacity);
+    array_free(vm, Entry, table->entries, table->capacity);
     table_init(table);
 }
 
@@ -64,9 +64,9 @@ bool table_get(Table* table, ObjString* key, Value* out_value)
     return true;
 }
 
-static void capacity_adjust(Table* table, int capacity)
+static void capacity_adjust(VM* vm, Table* table, int capacity)
 {
-    Entry* entries = mem_alloc(Entry, capacity);
+    Entry* entries = mem_alloc(vm, Entry, capacity);
 
     for (int i = 0; i < capacity; ++i)
     {
@@ -87,18 +87,18 @@ static void capacity_adjust(Table* table, int capacity)
         table->count++;
     }
 
-    array_free(Entry, table->entries, table->capacity);
+    array_free(vm, Entry, table->entries, table->capacity);
 
     table->entries = entries;
     table->capacity = capacity;
 }
 
-bool table_set(Table* table, ObjString* key, Value value)
+bool table_set(VM* vm, Table* table, ObjString* key, Value value)
 {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
     {
         int capacity = capacity_grow(table->capacity);
-        capacity_adjust(table, capacity);
+        capacity_adjust(vm, table, capacity);
     }
 
     Entry* entry = entry_find(table->entries, table->capacity, key);
@@ -126,13 +126,13 @@ bool table_delete(Table* table, ObjString* key)
     return true;
 }
 
-void table_append(Table* from, Table* to)
+void table_append(VM* vm, Table* from, Table* to)
 {
     for (int i = 0; i < from->capacity; ++i)
     {
         Entry* entry = &from->entries[i];
 
-        if (entry->key != NULL) table_set(to, entry->key, entry->value);
+        if (entry->key != NULL) table_set(vm, to, entry->key, entry->value);
     }
 }
 
@@ -168,17 +168,17 @@ void gc_table_remove_white(Table* table)
     for (int i = 0; i < table->capacity; ++i)
     {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.is_marked)
+        if (entry->key != NULL && !heap_is_marked(&entry->key->obj))
             table_delete(table, entry->key);
     }
 }
 
-void gc_mark_table(Table* table)
+void gc_mark_table(VM* vm, Table* table)
 {
     for (int i = 0; i < table->capacity; ++i)
     {
         Entry* entry = &table->entries[i];
-        gc_mark_obj((Obj*)entry->key);
-        gc_mark_value(entry->value);
+        gc_mark_obj(vm, (Obj*)entry->key);
+        gc_mark_value(vm, entry->value);
     }
 }
@@ -18,15 +18,15 @@ typedef struct
 } Table;
 
 void table_init(Table* table);
-void table_free(Table* table);
+void table_free(VM* vm, Table* table);
 bool table_get(Table* table, ObjString* key, Value* out_value);
-bool table_set(Table* table, ObjString* key, Value value);
+bool table_set(VM* vm, Table* table, ObjString* key, Value value);
 bool table_delete(Table* table, ObjString* key);
-void table_append(Table* from, Table* to);
+void table_append(VM* vm, Table* from, Table* to);
 ObjString* table_find_string(Table* table, const char* chars, int length,
                              uint32_t hash);
 
 void gc_table_remove_white(Table* table);
-void gc_mark_table(Table* table);
+void gc_mark_table(VM* vm, Table* table);
 
 #endif // CLOX_TABLE_H_
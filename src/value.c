@@ -42,63 +42,63 @@ void value_array_init(ValueArray* array)
     array->count = 0;
 }
 
-void value_array_write(ValueArray* array, Value value)
+void value_array_write(VM* vm, ValueArray* array, Value value)
 {
     if (array->capacity < array->count + 1)
     {
         int old_capacity = array->capacity;
         array->capacity = capacity_grow(old_capacity);
         array->values =
-            array_grow(Value, array->values, old_capacity, array->capacity);
+            array_grow(vm, Value, array->values, old_capacity, array->capacity);
     }
 
     array->values[array->count] = value;
     array->count++;
 }
 
-void value_array_free(ValueArray* array)
+void value_array_free(VM* vm, ValueArray* array)
 {
-    array_free(Value, array->values, array->capacity);
+    array_free(vm, Value, array->values, array->capacity);
     value_array_init(array);
 }
 
-void value_print(Value value)
+void value_print(FILE* stream, Value value)
 {
 #ifdef NAN_BOXING
     if (value_is_bool(value))
     {
-        printf(value_as_bool(value) ? "true" : "false");
+        fprintf(stream, value_as_bool(value) ? "true" : "false");
     }
     else if (value_is_nil(value))
     {
-        printf("nil");
+        fprintf(stream, "nil");
     }
     else if (value_is_number(value))
     {
-        printf("%g", value_as_number(value));
+        fprintf(stream, "%g", value_as_number(value));
     }
     else if (value_is_obj(value))
     {
-        obj_print(value);
+        obj_print(stream, value);
     }
 #else
 
     switch (value.type)
     {
         case VAL_BOOL:
-            printf("%s", value_as_bool(value) ? "true" : "false");
+            fprintf(stream, "%s", value_as_bool(value) ? "true" : "false");
             break;
 
         case VAL_NIL:
-            printf("%s", "nil");
+            fprintf(stream, "%s", "nil");
             break;
 
         case VAL_NUMBER:
-            printf("%g", value_as_number(value));
+            fprintf(stream, "%g", value_as_number(value));
             break;
 
         case VAL_OBJ:
-            obj_print(value);
+            obj_print(stream, value);
             break;
     }
 #endif
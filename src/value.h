@@ -1,12 +1,14 @@
 #ifndef CLOX_VALUE_H_
 #define CLOX_VALUE_H_
 
+#include <stdio.h>
 #include <string.h>
 
 #include "general.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct VM VM;
 
 #ifdef NAN_BOXING
 
@@ -100,9 +102,9 @@ typedef struct
 bool value_check_equality(Value a, Value b);
 
 void value_array_init(ValueArray* array);
-void value_array_write(ValueArray* array, Value value);
-void value_array_free(ValueArray* array);
-void value_print(Value value);
+void value_array_write(VM* vm, ValueArray* array, Value value);
+void value_array_free(VM* vm, ValueArray* array);
+void value_print(FILE* stream, Value value);
 
 static inline bool value_is_falsy(Value value)
 {
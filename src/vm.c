@@ -5,120 +5,157 @@
 
 #include "compiler.h"
 #include "debug.h"
+#include "floats.h"
 #include "general.h"
+#include "lists.h"
+#include "loop.h"
+#include "map.h"
+#include "maps.h"
 #include "memory.h"
+#include "profile.h"
+#include "sampler.h"
 #include "vm.h"
 
-VM vm;
-
-static void vm_stack_reset()
+static void vm_stack_reset(VM* vm)
 {
-    vm.stack_top = vm.stack;
-    vm.frame_count = 0;
-    vm.open_upvalues = NULL;
+    // Every fiber but the main one is abandoned, whether it was running,
+    // queued or waiting on the loop.
+    ObjFiber* fiber = vm->fiber;
+    while (fiber != NULL && fiber != vm->main_fiber)
+    {
+        ObjFiber* caller = fiber->caller;
+        fiber->caller = NULL;
+        fiber->state = FIBER_DONE;
+        fiber = caller;
+    }
+
+    loop_reset(vm);
+
+    fiber = vm->main_fiber;
+    fiber->stack_top = fiber->stack;
+    fiber->frame_count = 0;
+    fiber->open_upvalues = NULL;
+    vm->fiber = fiber;
+    vm->callback_fiber = NULL;
 }
 
-static void raise_runtime_error(const char* format, ...)
+void vm_raise_runtime_error(VM* vm, const char* format, ...)
 {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    for (int i = vm.frame_count - 1; i >= 0; --i)
+    for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller)
     {
-        CallFrame* frame = &vm.frames[i];
-        ObjFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
-
-        if (function->name == NULL)
+        for (int i = fiber->frame_count - 1; i >= 0; --i)
         {
-            fprintf(stderr, "script\n");
-        }
-        else
-        {
-            fprintf(stderr, "%s()\n", function->name->chars);
+            CallFrame* frame = &fiber->frames[i];
+            ObjFunction* function = frame->closure->function;
+            size_t instruction = frame->ip - function->chunk.code - 1;
+            fprintf(vm->err, "[line %d] in ",
+                    function->chunk.lines[instruction]);
+
+            if (function->name == NULL)
+            {
+                fprintf(vm->err, "script\n");
+            }
+            else
+            {
+                fprintf(vm->err, "%s()\n", function->name->chars);
+            }
         }
     }
 
-    vm_stack_reset();
+    vm_stack_reset(vm);
 }
 
-void vm_define_native_fn(const char* name, NativeFn function)
+void vm_define_native_fn(VM* vm, const char* name, NativeFn function)
 {
-    vm_stack_push(value_make_obj(obj_string_cpy(name, (int)strlen(name))));
-    vm_stack_push(value_make_obj(obj_native_fn_new(function)));
-    table_set(&vm.globals, obj_as_string(vm.stack[0]), vm.stack[1]);
-    vm_stack_pop();
-    vm_stack_pop();
+    vm_stack_push(
+        vm, value_make_obj(obj_string_cpy(vm, name, (int)strlen(name))));
+    vm_stack_push(vm, value_make_obj(obj_native_fn_new(vm, function)));
+    Value* stack = vm->fiber->stack_top - 2;
+    table_set(vm, &vm->globals, obj_as_string(stack[0]), stack[1]);
+    table_set(vm, &vm->builtins, obj_as_string(stack[0]), stack[1]);
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
 }
 
-static Value native_fn_clock(int argc, Value* args)
+static bool native_fn_clock(VM* vm, int argc, Value* args)
 {
+    (void)vm;
     (void)argc;
-    (void)args;
 
-    return value_make_number((double)clock() / CLOCKS_PER_SEC);
+    native_return(value_make_number((double)clock() / CLOCKS_PER_SEC));
 }
 
-static Value native_fn_list_length(int argc, Value* args)
+static bool native_fn_list_length(VM* vm, int argc, Value* args)
 {
     if (argc != 1)
     {
-        raise_runtime_error("insufficient arguments, need 1 got=%d", argc);
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "insufficient arguments, need 1 got=%d",
+                               argc);
+        return false;
     }
 
+    if (obj_is_float_array(args[0]))
+        native_return(value_make_number(obj_as_float_array(args[0])->count));
+
+    if (obj_is_map(args[0]))
+        native_return(value_make_number(obj_as_map(args[0])->count));
+
     if (!obj_is_list(args[0]))
     {
-        raise_runtime_error("cannot get length of a non-list variable.");
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "cannot get length of a non-list variable.");
+        return false;
     }
 
     ObjList* list = obj_as_list(args[0]);
-    return value_make_number(list->count);
+    native_return(value_make_number(list->count));
 }
 
-static Value native_fn_list_append(int argc, Value* args)
+static bool native_fn_list_append(VM* vm, int argc, Value* args)
 {
     if (argc != 2)
     {
-        raise_runtime_error("insufficient arguments, need 2 got=%d", argc);
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "insufficient arguments, need 2 got=%d",
+                               argc);
+        return false;
     }
 
     if (!obj_is_list(args[0]))
     {
-        raise_runtime_error("cannot append item to non-list variable.");
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "cannot append item to non-list variable.");
+        return false;
     }
 
     ObjList* list = obj_as_list(args[0]);
     Value item = args[1];
-    obj_list_append(list, item);
-    return value_make_nil();
+    obj_list_append(vm, list, item);
+    native_return(value_make_nil());
 }
 
-static Value native_fn_list_delete(int argc, Value* args)
+static bool native_fn_list_delete(VM* vm, int argc, Value* args)
 {
     if (argc != 2)
     {
-        raise_runtime_error("insufficient arguments, need 2 got=%d", argc);
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "insufficient arguments, need 2 got=%d",
+                               argc);
+        return false;
     }
 
     if (!obj_is_list(args[0]))
     {
-        raise_runtime_error("cannot append item to non-list variable.");
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "cannot append item to non-list variable.");
+        return false;
     }
 
     if (!value_is_number(args[1]))
     {
-        raise_runtime_error("index cannot be a non-number value.");
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "index cannot be a non-number value.");
+        return false;
     }
 
     ObjList* list = obj_as_list(args[0]);
@@ -126,87 +163,255 @@ static Value native_fn_list_delete(int argc, Value* args)
 
     if (!obj_list_is_valid_index(list, index))
     {
-        raise_runtime_error("index out of range.");
-        return value_make_nil();
+        vm_raise_runtime_error(vm, "index out of range.");
+        return false;
     }
 
     obj_list_delete(list, index);
-    return value_make_nil();
+    native_return(value_make_nil());
+}
+
+static void stats_field_set(VM* vm, ObjInstance* instance, const char* name,
+                            double value)
+{
+    ObjString* key = obj_string_cpy(vm, name, (int)strlen(name));
+    vm_stack_push(vm, value_make_obj(key));
+    table_set(vm, &instance->fields, key, value_make_number(value));
+    vm_stack_pop(vm);
+}
+
+// Leaves the new instance on the stack.
+static ObjInstance* stats_instance_push(VM* vm, const char* class_name)
+{
+    ObjString* name = obj_string_cpy(vm, class_name, (int)strlen(class_name));
+    vm_stack_push(vm, value_make_obj(name));
+    ObjClass* cls = obj_class_new(vm, name);
+    vm_stack_push(vm, value_make_obj(cls));
+    ObjInstance* instance = obj_instance_new(vm, cls);
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+
+    vm_stack_push(vm, value_make_obj(instance));
+    return instance;
+}
+
+static bool native_fn_gc_stats(VM* vm, int argc, Value* args)
+{
+    if (argc != 0)
+    {
+        vm_raise_runtime_error(vm, "gcStats takes no arguments, got=%d", argc);
+        return false;
+    }
+
+    GcStats stats;
+    gc_stats(vm, &stats);
+
+    ObjInstance* result = stats_instance_push(vm, "GcStats");
+    stats_field_set(vm, result, "collections", (double)stats.collections);
+    stats_field_set(vm, result, "compactions", (double)stats.compactions);
+    stats_field_set(vm, result, "pauseTotal", stats.pause_total_ns / 1e6);
+    stats_field_set(vm, result, "pauseMax", stats.pause_max_ns / 1e6);
+    stats_field_set(vm, result, "bytesFreed", (double)stats.bytes_freed);
+    stats_field_set(vm, result, "liveBytes", (double)stats.live_bytes);
+    stats_field_set(vm, result, "heapBytes", (double)gc_bytes_allocated(vm));
+
+    ObjInstance* objects = stats_instance_push(vm, "GcObjects");
+    for (int i = 0; i < OBJ_TYPE_COUNT; ++i)
+    {
+        stats_field_set(vm, objects, obj_type_name((ObjType)i),
+                        (double)stats.objects[i]);
+    }
+
+    ObjString* key = obj_string_cpy(vm, "objects", 7);
+    vm_stack_push(vm, value_make_obj(key));
+    table_set(vm, &result->fields, key, value_make_obj(objects));
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+
+    native_return(value_make_obj(result));
 }
 
-void vm_init()
+static bool native_fn_fiber_new(VM* vm, int argc, Value* args)
 {
-    vm_stack_reset();
-    vm.objects = NULL;
+    if (argc != 1)
+    {
+        vm_raise_runtime_error(vm, "insufficient arguments, need 1 got=%d",
+                               argc);
+        return false;
+    }
 
-    vm.gray_count = 0;
-    vm.gray_capacity = 0;
-    vm.gray_stack = NULL;
-    vm.bytes_allocated = 0;
-    vm.next_gc = 1024 * 1024;
+    if (!obj_is_closure(args[0]) ||
+        obj_as_closure(args[0])->function->arity > 1)
+    {
+        vm_raise_runtime_error(
+            vm, "fiber needs a function taking at most one argument.");
+        return false;
+    }
 
-    table_init(&vm.globals);
-    table_init(&vm.strings);
+    native_return(
+        value_make_obj(obj_fiber_new(vm, obj_as_closure(args[0]))));
+}
 
-    vm.init_str = NULL;
-    vm.init_str = obj_string_cpy("init", 4);
+static bool native_fn_fiber_done(VM* vm, int argc, Value* args)
+{
+    if (argc != 1)
+    {
+        vm_raise_runtime_error(vm, "insufficient arguments, need 1 got=%d",
+                               argc);
+        return false;
+    }
+
+    if (!obj_is_fiber(args[0]))
+    {
+        vm_raise_runtime_error(vm,
+                               "cannot check state of a non-fiber variable.");
+        return false;
+    }
 
-    vm_define_native_fn("clock", native_fn_clock);
-    vm_define_native_fn("length", native_fn_list_length);
-    vm_define_native_fn("append", native_fn_list_append);
-    vm_define_native_fn("delete", native_fn_list_delete);
+    native_return(value_make_bool(obj_as_fiber(args[0])->state == FIBER_DONE));
+}
+
+void vm_init(VM* vm)
+{
+    vm->fiber = NULL;
+    vm->main_fiber = NULL;
+    vm->callback_fiber = NULL;
+    vm->callback_frames = 0;
+    heap_init(&vm->heap);
+    loop_init(vm);
+
+    vm->gray.items = NULL;
+    vm->gray.count = 0;
+    vm->gray.capacity = 0;
+    vm->gc_threads = gc_default_threads();
+    vm->gc_parallel_threshold = GC_PARALLEL_THRESHOLD;
+    vm->gc_compact = true;
+    vm->gc_compact_pending = false;
+    atomic_init(&vm->bytes_allocated, 0);
+    vm->sweep.running = false;
+    atomic_init(&vm->sweep.finished, false);
+    heap_init(&vm->sweep.heap);
+    vm->sweep.freed = 0;
+    vm->gc_grow_factor = GC_GROW_FACTOR;
+    vm->gc_heap_min = GC_HEAP_MIN;
+    vm->gc_heap_max = 0;
+    vm->next_gc = vm->gc_heap_min;
+    memset(&vm->gc_stats, 0, sizeof(vm->gc_stats));
+    vm->heap_limit = 0;
+    vm->out_of_memory = false;
+    vm->profile = NULL;
+    vm->allocs = NULL;
+    vm->fuel_limit = 0;
+    vm->fuel = 0;
+    atomic_init(&vm->interrupt, 0);
+    vm->sampler = NULL;
+
+    table_init(&vm->globals);
+    table_init(&vm->builtins);
+    table_init(&vm->strings);
+
+    vm->parser = NULL;
+    vm->out = stdout;
+    vm->err = stderr;
+    vm->init_str = NULL;
+
+    // The main fiber runs top-level code and is never resumed or finished.
+    vm->fiber = obj_fiber_new(vm, NULL);
+    vm->fiber->state = FIBER_RUNNING;
+    vm->main_fiber = vm->fiber;
+
+    vm->init_str = obj_string_cpy(vm, "init", 4);
+
+    vm_define_native_fn(vm, "clock", native_fn_clock);
+    vm_define_native_fn(vm, "length", native_fn_list_length);
+    vm_define_native_fn(vm, "append", native_fn_list_append);
+    vm_define_native_fn(vm, "delete", native_fn_list_delete);
+    vm_define_native_fn(vm, "Fiber", native_fn_fiber_new);
+    vm_define_native_fn(vm, "done", native_fn_fiber_done);
+    vm_define_native_fn(vm, "gcStats", native_fn_gc_stats);
+    loop_define_natives(vm);
+    lists_define_natives(vm);
+    floats_define_natives(vm);
+    maps_define_natives(vm);
 }
 
-void vm_free()
+void vm_free(VM* vm)
 {
-    table_free(&vm.globals);
-    table_free(&vm.strings);
+    table_free(vm, &vm->globals);
+    table_free(vm, &vm->builtins);
+    table_free(vm, &vm->strings);
 
-    vm.init_str = NULL;
+    vm->init_str = NULL;
+    vm->fiber = NULL;
+    vm->main_fiber = NULL;
 
-    objects_free();
+    loop_free(vm);
+
+    objects_free(vm);
+}
+
+void vm_reset(VM* vm)
+{
+    vm_stack_reset(vm);
+
+    // Drop everything the previous script defined, keep the natives.
+    table_free(vm, &vm->globals);
+    table_append(vm, &vm->builtins, &vm->globals);
 }
 
-void vm_stack_push(Value value)
+static void fiber_stack_push(VM* vm, ObjFiber* fiber, Value value)
 {
-    *vm.stack_top = value;
-    vm.stack_top++;
+    *fiber->stack_top++ = value;
+
+    // Grow once the stack is full rather than before writing, so the value
+    // is already rooted should growing trigger a collection.
+    if (fiber->stack_top == fiber->stack + fiber->stack_capacity)
+        obj_fiber_stack_ensure(vm, fiber, fiber->stack_capacity + 1);
 }
 
-Value vm_stack_pop()
+void vm_stack_push(VM* vm, Value value)
 {
-    vm.stack_top--;
-    return *vm.stack_top;
+    fiber_stack_push(vm, vm->fiber, value);
 }
 
-static Value vm_stack_peek(int distance)
+Value vm_stack_pop(VM* vm)
 {
-    return vm.stack_top[-1 - distance];
+    vm->fiber->stack_top--;
+    return *vm->fiber->stack_top;
 }
 
-static bool obj_func_call(ObjClosure* closure, int argc)
+static Value vm_stack_peek(VM* vm, int distance)
+{
+    return vm->fiber->stack_top[-1 - distance];
+}
+
+static bool obj_func_call(VM* vm, ObjClosure* closure, int argc)
 {
     if (argc != closure->function->arity)
     {
-        raise_runtime_error("Expected %d argument but got %d.",
-                            closure->function->arity, argc);
+        vm_raise_runtime_error(vm, "Expected %d argument but got %d.",
+                               closure->function->arity, argc);
         return false;
     }
 
-    if (vm.frame_count == FRAMES_MAX)
+    ObjFiber* fiber = vm->fiber;
+    if (fiber->frame_count == FRAMES_MAX)
     {
-        raise_runtime_error("Stack overflow.");
+        vm_raise_runtime_error(vm, "Stack overflow.");
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frame_count++];
+    obj_fiber_frames_ensure(vm, fiber, fiber->frame_count + 1);
+
+    CallFrame* frame = &fiber->frames[fiber->frame_count++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
-    frame->slots = vm.stack_top - argc - 1;
+    frame->slots = fiber->stack_top - argc - 1;
     return true;
 }
 
-static bool value_call(Value callee, int argc)
+static bool value_call(VM* vm, Value callee, int argc)
 {
     if (value_is_obj(callee))
     {
@@ -215,24 +420,26 @@ static bool value_call(Value callee, int argc)
             case OBJ_BOUND_METHOD:
             {
                 ObjBoundMethod* bound = obj_as_bound_method(callee);
-                vm.stack_top[-argc - 1] = bound->receiver;
-                return obj_func_call(bound->method, argc);
+                vm->fiber->stack_top[-argc - 1] = bound->receiver;
+                return obj_func_call(vm, bound->method, argc);
             }
 
             case OBJ_CLASS:
             {
                 ObjClass* cls = obj_as_class(callee);
-                vm.stack_top[-argc - 1] = value_make_obj(obj_instance_new(cls));
+                ObjInstance* instance = obj_instance_new(vm, cls);
+                vm->fiber->stack_top[-argc - 1] = value_make_obj(instance);
 
                 Value initializer;
-                if (table_get(&cls->methods, vm.init_str, &initializer))
+                if (table_get(&cls->methods, vm->init_str, &initializer))
                 {
-                    return obj_func_call(obj_as_closure(initializer), argc);
+                    return obj_func_call(vm, obj_as_closure(initializer), argc);
                 }
                 else if (argc != 0)
                 {
-                    raise_runtime_error("Expected 0 argument but got %d.",
-                                        argc);
+                    vm_raise_runtime_error(vm,
+                                           "Expected 0 argument but got %d.",
+                                           argc);
                     return false;
                 }
 
@@ -240,14 +447,26 @@ static bool value_call(Value callee, int argc)
             }
 
             case OBJ_CLOSURE:
-                return obj_func_call(obj_as_closure(callee), argc);
+                return obj_func_call(vm, obj_as_closure(callee), argc);
 
             case OBJ_NATIVE_FN:
             {
+                // Blocking natives may switch to another fiber before they
+                // return, the arguments belong to the calling one.
                 NativeFn native = obj_as_native_fn(callee);
-                Value result = native(argc, vm.stack_top - argc);
-                vm.stack_top -= argc + 1;
-                vm_stack_push(result);
+                ObjFiber* fiber = vm->fiber;
+
+                // Natives push the objects they build to keep them rooted,
+                // growing the stack then would move it under their args.
+                int depth = (int)(fiber->stack_top - fiber->stack);
+                obj_fiber_stack_ensure(vm, fiber, depth + NATIVE_STACK_SLACK);
+
+                Value* args = fiber->stack_top - argc;
+                if (!native(vm, argc, args)) return false;
+
+                // Offset based, a native calling back into Lox may have
+                // moved the stack.
+                fiber->stack_top = fiber->stack + depth - argc;
                 return true;
             }
 
@@ -256,29 +475,29 @@ static bool value_call(Value callee, int argc)
         }
     }
 
-    raise_runtime_error("Can only call functions and classes.");
+    vm_raise_runtime_error(vm, "Can only call functions and classes.");
     return false;
 }
 
-static bool invoke_from_class(ObjClass* cls, ObjString* name, int argc)
+static bool invoke_from_class(VM* vm, ObjClass* cls, ObjString* name, int argc)
 {
     Value method;
     if (!table_get(&cls->methods, name, &method))
     {
-        raise_runtime_error("Undefined property '%s'.", name->chars);
+        vm_raise_runtime_error(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
 
-    return obj_func_call(obj_as_closure(method), argc);
+    return obj_func_call(vm, obj_as_closure(method), argc);
 }
 
-static bool invoke(ObjString* name, int argc)
+static bool invoke(VM* vm, ObjString* name, int argc)
 {
-    Value receiver = vm_stack_peek(argc);
+    Value receiver = vm_stack_peek(vm, argc);
 
     if (!obj_is_instance(receiver))
     {
-        raise_runtime_error("Only instances have methods.");
+        vm_raise_runtime_error(vm, "Only instances have methods.");
         return false;
     }
 
@@ -287,17 +506,17 @@ static bool invoke(ObjString* name, int argc)
     Value value;
     if (table_get(&instance->fields, name, &value))
     {
-        vm.stack_top[-argc - 1] = value;
-        return value_call(value, argc);
+        vm->fiber->stack_top[-argc - 1] = value;
+        return value_call(vm, value, argc);
     }
 
-    return invoke_from_class(instance->cls, name, argc);
+    return invoke_from_class(vm, instance->cls, name, argc);
 }
 
-static ObjUpValue* upvalue_capture(Value* local)
+static ObjUpValue* upvalue_capture(VM* vm, Value* local)
 {
     ObjUpValue* prev_upvalue = NULL;
-    ObjUpValue* upvalue = vm.open_upvalues;
+    ObjUpValue* upvalue = vm->fiber->open_upvalues;
     while (upvalue != NULL && upvalue->location > local)
     {
         prev_upvalue = upvalue;
@@ -306,12 +525,13 @@ static ObjUpValue* upvalue_capture(Value* local)
 
     if (upvalue != NULL && upvalue->location == local) return upvalue;
 
-    ObjUpValue* created_upvalue = obj_upvalue_new(local);
+    ObjUpValue* created_upvalue = obj_upvalue_new(vm, local);
     created_upvalue->next = upvalue;
+    created_upvalue->fiber = vm->fiber;
 
     if (prev_upvalue == NULL)
     {
-        vm.open_upvalues = created_upvalue;
+        vm->fiber->open_upvalues = created_upvalue;
     }
     else
     {
@@ -321,64 +541,183 @@ static ObjUpValue* upvalue_capture(Value* local)
     return created_upvalue;
 }
 
-static void upvalue_close_until(Value* last)
+static void upvalue_close_until(VM* vm, Value* last)
 {
-    while (vm.open_upvalues != NULL && vm.open_upvalues->location >= last)
+    ObjFiber* fiber = vm->fiber;
+    while (fiber->open_upvalues != NULL &&
+           fiber->open_upvalues->location >= last)
     {
-        ObjUpValue* upvalue = vm.open_upvalues;
+        ObjUpValue* upvalue = fiber->open_upvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.open_upvalues = upvalue->next;
+        upvalue->fiber = NULL;
+        fiber->open_upvalues = upvalue->next;
     }
 }
 
-static void define_method(ObjString* name)
+static void define_method(VM* vm, ObjString* name)
 {
-    Value method = vm_stack_peek(0);
-    ObjClass* cls = obj_as_class(vm_stack_peek(1));
-    table_set(&cls->methods, name, method);
-    vm_stack_pop();
+    Value method = vm_stack_peek(vm, 0);
+    ObjClass* cls = obj_as_class(vm_stack_peek(vm, 1));
+    table_set(vm, &cls->methods, name, method);
+    vm_stack_pop(vm);
 }
 
-static bool bind_method(ObjClass* cls, ObjString* name)
+static bool bind_method(VM* vm, ObjClass* cls, ObjString* name)
 {
     Value method;
     if (!table_get(&cls->methods, name, &method))
     {
-        raise_runtime_error("Undefined property '%s'.", name->chars);
+        vm_raise_runtime_error(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
 
     ObjBoundMethod* bound =
-        obj_bound_method_new(vm_stack_peek(0), obj_as_closure(method));
+        obj_bound_method_new(vm, vm_stack_peek(vm, 0), obj_as_closure(method));
 
-    vm_stack_pop();
-    vm_stack_push(value_make_obj(bound));
+    vm_stack_pop(vm);
+    vm_stack_push(vm, value_make_obj(bound));
 
     return true;
 }
 
-static void string_concat()
+static void string_concat(VM* vm)
 {
-    ObjString* b = obj_as_string(vm_stack_peek(0));
-    ObjString* a = obj_as_string(vm_stack_peek(1));
+    ObjString* b = obj_as_string(vm_stack_peek(vm, 0));
+    ObjString* a = obj_as_string(vm_stack_peek(vm, 1));
 
     int length = a->length + b->length;
-    char* chars = mem_alloc(char, length + 1);
+    char* chars = mem_alloc(vm, char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = obj_string_take(chars, length);
-    vm_stack_pop();
-    vm_stack_pop();
+    ObjString* result = obj_string_take(vm, chars, length);
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+
+    vm_stack_push(vm, value_make_obj(result));
+}
+
+// Reached from a backward jump, call or return once the fuel ran out or
+// interrupt was set, the latter also by an allocation past the heap limit.
+// Nothing else checks, so a script overshoots the limit by what one
+// iteration or native allocates at most. Returns INTERPRET_OK when
+// the script goes on.
+static InterpretResult interrupt_take(VM* vm)
+{
+    unsigned int reasons =
+        atomic_exchange_explicit(&vm->interrupt, 0, memory_order_relaxed);
+
+    if ((reasons & VM_INTERRUPT_SAMPLE) && vm->sampler != NULL)
+        sampler_record(vm->sampler, vm);
+
+    if (vm->out_of_memory)
+    {
+        vm->out_of_memory = false;
+        vm_raise_runtime_error(vm, "Out of memory.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    if ((reasons & VM_INTERRUPT_STOP) || vm->fuel == 0)
+        return INTERPRET_INTERRUPTED;
 
-    vm_stack_push(value_make_obj(result));
+    return INTERPRET_OK;
 }
 
-static InterpretResult run()
+// Stores a map entry from Lox, where NaN keys are an error.
+static bool map_key_set(VM* vm, ObjMap* map, Value key, Value value)
 {
-    CallFrame* frame = &vm.frames[vm.frame_count - 1];
+    if (value_is_number(key) && value_as_number(key) != value_as_number(key))
+    {
+        vm_raise_runtime_error(vm, "Map key cannot be NaN.");
+        return false;
+    }
+
+    map_set(vm, map, key, value);
+    return true;
+}
+
+// Switches to fiber and hands it value, as the result of the yield it is
+// suspended at or as the argument of a fresh fiber's function taking one.
+static void fiber_enter(VM* vm, ObjFiber* fiber, Value value)
+{
+    if (fiber->state == FIBER_SUSPENDED ||
+        fiber->frames[0].closure->function->arity == 1)
+    {
+        fiber_stack_push(vm, fiber, value);
+    }
+
+    fiber->caller = vm->fiber;
+    fiber->state = FIBER_RUNNING;
+    vm->fiber = fiber;
+}
+
+typedef enum
+{
+    ITER_ITEM,
+    ITER_END,
+    ITER_ERROR,
+} IterStep;
+
+// Steps the [iterable, cursor, item] locals of a for-in loop over anything
+// but a fiber, which OP_ITER_NEXT resumes itself. A map is swapped for a
+// list of its keys on the first step, so neither the body changing it nor a
+// compaction rehashing it makes the loop skip or repeat a key.
+static IterStep iterator_next(VM* vm, Value* iterator)
+{
+    if (obj_is_map(iterator[0]))
+    {
+        ObjMap* map = obj_as_map(iterator[0]);
+
+        // The item slot roots the list while it grows.
+        ObjList* keys = obj_list_new(vm);
+        iterator[2] = value_make_obj(keys);
+        obj_list_reserve(vm, keys, map->count);
+
+        keys->count = map_entries_copy(map, keys->items, true);
+        iterator[0] = iterator[2];
+    }
+
+    int index = (int)value_as_number(iterator[1]);
+
+    if (obj_is_list(iterator[0]))
+    {
+        ObjList* list = obj_as_list(iterator[0]);
+        if (index >= list->count) return ITER_END;
+
+        iterator[2] = list->items[index];
+    }
+    else if (obj_is_string(iterator[0]))
+    {
+        ObjString* string = obj_as_string(iterator[0]);
+        if (index >= string->length) return ITER_END;
+
+        ObjString* character = obj_string_cpy(vm, string->chars + index, 1);
+        iterator[2] = value_make_obj(character);
+    }
+    else
+    {
+        vm_raise_runtime_error(
+            vm, "Can only iterate over lists, maps, strings and fibers.");
+        return ITER_ERROR;
+    }
+
+    iterator[1] = value_make_number(index + 1);
+    return ITER_ITEM;
+}
+
+static void fuel_fill(VM* vm)
+{
+    vm->fuel = vm->fuel_limit > 0 ? vm->fuel_limit : UINT64_MAX;
+}
+
+static InterpretResult run(VM* vm)
+{
+    CallFrame* frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+
+    // Kept in a local, the hosts set it before running anything.
+    Profile* profile = vm->profile;
 
 #define byte_read() (*frame->ip++)
 #define byte_read_constant()                                                   \
@@ -388,28 +727,48 @@ static InterpretResult run()
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 
 #define byte_read_string() (obj_as_string(byte_read_constant()))
+
+// Checked before the operands are read, so resuming runs the instruction
+// again.
+#define safe_point_if(condition)                                               \
+    do                                                                         \
+    {                                                                          \
+        if (condition)                                                         \
+        {                                                                      \
+            InterpretResult result = interrupt_take(vm);                       \
+            if (result == INTERPRET_INTERRUPTED) frame->ip--;                  \
+            if (result != INTERPRET_OK) return result;                         \
+        }                                                                      \
+    } while (false)
+
+#define interrupt_pending()                                                    \
+    (atomic_load_explicit(&vm->interrupt, memory_order_relaxed) != 0)
+
+#define safe_point() safe_point_if(--vm->fuel == 0 || interrupt_pending())
+
 #define binary_op(value_type, op)                                              \
     do                                                                         \
     {                                                                          \
-        if (!value_is_number(vm_stack_peek(0)) ||                              \
-            !value_is_number(vm_stack_peek(1)))                                \
+        if (!value_is_number(vm_stack_peek(vm, 0)) ||                          \
+            !value_is_number(vm_stack_peek(vm, 1)))                            \
         {                                                                      \
-            raise_runtime_error("Operand must be numbers.");                   \
+            vm_raise_runtime_error(vm, "Operand must be numbers.");            \
             return INTERPRET_RUNTIME_ERROR;                                    \
         }                                                                      \
-        double b = value_as_number(vm_stack_pop());                            \
-        double a = value_as_number(vm_stack_pop());                            \
-        vm_stack_push(value_make_##value_type(a op b));                        \
+        double b = value_as_number(vm_stack_pop(vm));                          \
+        double a = value_as_number(vm_stack_pop(vm));                          \
+        vm_stack_push(vm, value_make_##value_type(a op b));                    \
     } while (false)
 
     while (true)
     {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("%s", "          ");
-        for (Value* slot = vm.stack; slot < vm.stack_top; ++slot)
+        for (Value* slot = vm->fiber->stack; slot < vm->fiber->stack_top;
+             ++slot)
         {
             printf("%s", "[ ");
-            value_print(*slot);
+            value_print(stdout, *slot);
             printf("%s", " ]");
         }
 
@@ -419,43 +778,46 @@ static InterpretResult run()
             &frame->closure->function->chunk,
             (int)(frame->ip - frame->closure->function->chunk.code));
 #endif
+        if (profile != NULL)
+            profile_step(profile, frame->closure->function, frame->ip);
+
         uint8_t instruction;
         switch (instruction = byte_read())
         {
             case OP_CONSTANT:
             {
                 Value constant = byte_read_constant();
-                vm_stack_push(constant);
+                vm_stack_push(vm, constant);
                 break;
             }
 
             case OP_NIL:
-                vm_stack_push(value_make_nil());
+                vm_stack_push(vm, value_make_nil());
                 break;
 
             case OP_TRUE:
-                vm_stack_push(value_make_bool(true));
+                vm_stack_push(vm, value_make_bool(true));
                 break;
 
             case OP_FALSE:
-                vm_stack_push(value_make_bool(false));
+                vm_stack_push(vm, value_make_bool(false));
                 break;
 
             case OP_POP:
-                vm_stack_pop();
+                vm_stack_pop(vm);
                 break;
 
             case OP_GET_LOCAL:
             {
                 uint8_t slot = byte_read();
-                vm_stack_push(frame->slots[slot]);
+                vm_stack_push(vm, frame->slots[slot]);
                 break;
             }
 
             case OP_SET_LOCAL:
             {
                 uint8_t slot = byte_read();
-                frame->slots[slot] = vm_stack_peek(0);
+                frame->slots[slot] = vm_stack_peek(vm, 0);
                 break;
             }
 
@@ -464,22 +826,23 @@ static InterpretResult run()
                 ObjString* name = byte_read_string();
                 Value value;
 
-                if (!table_get(&vm.globals, name, &value))
+                if (!table_get(&vm->globals, name, &value))
                 {
-                    raise_runtime_error("Undefined symbol '%s'.", name->chars);
+                    vm_raise_runtime_error(vm, "Undefined symbol '%s'.",
+                                           name->chars);
 
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                vm_stack_push(value);
+                vm_stack_push(vm, value);
                 break;
             }
 
             case OP_DEFINE_GLOBAL:
             {
                 ObjString* name = byte_read_string();
-                table_set(&vm.globals, name, vm_stack_peek(0));
-                vm_stack_pop();
+                table_set(vm, &vm->globals, name, vm_stack_peek(vm, 0));
+                vm_stack_pop(vm);
                 break;
             }
 
@@ -487,11 +850,11 @@ static InterpretResult run()
             {
                 ObjString* name = byte_read_string();
 
-                if (table_set(&vm.globals, name, vm_stack_peek(0)))
+                if (table_set(vm, &vm->globals, name, vm_stack_peek(vm, 0)))
                 {
-                    table_delete(&vm.globals, name);
-                    raise_runtime_error("Undefined variable '%s'.",
-                                        name->chars);
+                    table_delete(&vm->globals, name);
+                    vm_raise_runtime_error(vm, "Undefined variable '%s'.",
+                                           name->chars);
 
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -502,37 +865,39 @@ static InterpretResult run()
             case OP_GET_UPVALUE:
             {
                 uint8_t slot = byte_read();
-                vm_stack_push(*frame->closure->upvalues[slot]->location);
+                vm_stack_push(vm, *frame->closure->upvalues[slot]->location);
                 break;
             }
 
             case OP_SET_UPVALUE:
             {
                 uint8_t slot = byte_read();
-                *frame->closure->upvalues[slot]->location = vm_stack_peek(0);
+                *frame->closure->upvalues[slot]->location = vm_stack_peek(vm,
+                                                                          0);
                 break;
             }
 
             case OP_GET_PROPERTY:
             {
-                if (!obj_is_instance(vm_stack_peek(0)))
+                if (!obj_is_instance(vm_stack_peek(vm, 0)))
                 {
-                    raise_runtime_error("Only instances have properties.");
+                    vm_raise_runtime_error(vm,
+                                           "Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjInstance* instance = obj_as_instance(vm_stack_peek(0));
+                ObjInstance* instance = obj_as_instance(vm_stack_peek(vm, 0));
                 ObjString* name = byte_read_string();
 
                 Value value;
                 if (table_get(&instance->fields, name, &value))
                 {
-                    vm_stack_pop(); // Instance
-                    vm_stack_push(value);
+                    vm_stack_pop(vm); // Instance
+                    vm_stack_push(vm, value);
                     break;
                 }
 
-                if (!bind_method(instance->cls, name))
+                if (!bind_method(vm, instance->cls, name))
                 {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -542,28 +907,28 @@ static InterpretResult run()
 
             case OP_SET_PROPERTY:
             {
-                if (!obj_is_instance(vm_stack_peek(1)))
+                if (!obj_is_instance(vm_stack_peek(vm, 1)))
                 {
-                    raise_runtime_error("Only instances have fields.");
+                    vm_raise_runtime_error(vm, "Only instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjInstance* instance = obj_as_instance(vm_stack_peek(1));
-                table_set(&instance->fields, byte_read_string(),
-                          vm_stack_peek(0));
+                ObjInstance* instance = obj_as_instance(vm_stack_peek(vm, 1));
+                table_set(vm, &instance->fields, byte_read_string(),
+                          vm_stack_peek(vm, 0));
 
-                Value value = vm_stack_pop();
-                vm_stack_pop();
-                vm_stack_push(value);
+                Value value = vm_stack_pop(vm);
+                vm_stack_pop(vm);
+                vm_stack_push(vm, value);
                 break;
             }
 
             case OP_GET_SUPER:
             {
                 ObjString* name = byte_read_string();
-                ObjClass* superclass = obj_as_class(vm_stack_pop());
+                ObjClass* superclass = obj_as_class(vm_stack_pop(vm));
 
-                if (!bind_method(superclass, name))
+                if (!bind_method(vm, superclass, name))
                 {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -573,10 +938,10 @@ static InterpretResult run()
 
             case OP_EQUAL:
             {
-                Value b = vm_stack_pop();
-                Value a = vm_stack_pop();
+                Value b = vm_stack_pop(vm);
+                Value a = vm_stack_pop(vm);
 
-                vm_stack_push(value_make_bool(value_check_equality(a, b)));
+                vm_stack_push(vm, value_make_bool(value_check_equality(a, b)));
                 break;
             }
 
@@ -590,23 +955,23 @@ static InterpretResult run()
 
             case OP_ADD:
             {
-                if (obj_is_string(vm_stack_peek(0)) &&
-                    obj_is_string(vm_stack_peek(1)))
+                if (obj_is_string(vm_stack_peek(vm, 0)) &&
+                    obj_is_string(vm_stack_peek(vm, 1)))
                 {
-                    string_concat();
+                    string_concat(vm);
                 }
-                else if (value_is_number(vm_stack_peek(0)) &&
-                         value_is_number(vm_stack_peek(1)))
+                else if (value_is_number(vm_stack_peek(vm, 0)) &&
+                         value_is_number(vm_stack_peek(vm, 1)))
                 {
-                    double b = value_as_number(vm_stack_pop());
-                    double a = value_as_number(vm_stack_pop());
+                    double b = value_as_number(vm_stack_pop(vm));
+                    double a = value_as_number(vm_stack_pop(vm));
 
-                    vm_stack_push(value_make_number(a + b));
+                    vm_stack_push(vm, value_make_number(a + b));
                 }
                 else
                 {
-                    raise_runtime_error(
-                        "Operands must be two numbers or two strings.");
+                    vm_raise_runtime_error(
+                        vm, "Operands must be two numbers or two strings.");
 
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -627,27 +992,28 @@ static InterpretResult run()
                 break;
 
             case OP_NOT:
-                vm_stack_push(value_make_bool(value_is_falsy(vm_stack_pop())));
+                vm_stack_push(
+                    vm, value_make_bool(value_is_falsy(vm_stack_pop(vm))));
                 break;
 
             case OP_NEGATE:
-                if (value_is_number(vm_stack_peek(0)))
+                if (value_is_number(vm_stack_peek(vm, 0)))
                 {
-                    raise_runtime_error("Operand must be a number");
+                    vm_raise_runtime_error(vm, "Operand must be a number");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 vm_stack_push(
-                    value_make_number(-value_as_number(vm_stack_pop())));
+                    vm, value_make_number(-value_as_number(vm_stack_pop(vm))));
                 break;
 
             case OP_PRINT:
-                value_print(vm_stack_pop());
+                value_print(vm->out, vm_stack_pop(vm));
                 break;
 
             case OP_PRINTLN:
-                value_print(vm_stack_pop());
-                puts("");
+                value_print(vm->out, vm_stack_pop(vm));
+                fputc('\n', vm->out);
                 break;
 
             case OP_JUMP:
@@ -661,56 +1027,166 @@ static InterpretResult run()
             case OP_JUMP_IF_FALSE:
             {
                 uint16_t offset = byte_read_short();
-                if (value_is_falsy(vm_stack_peek(0))) frame->ip += offset;
+                if (value_is_falsy(vm_stack_peek(vm, 0))) frame->ip += offset;
 
                 break;
             }
 
             case OP_LOOP:
             {
+                safe_point();
+
                 uint16_t offset = byte_read_short();
                 frame->ip -= offset;
+
+                // Nothing outside the roots refers to an object here, and
+                // frame lives in the fiber's frame array which never moves.
+                // Natives waiting on a callback hold objects in C locals.
+                if (vm->gc_compact_pending && vm->callback_fiber == NULL)
+                    gc_compact(vm);
+                break;
+            }
+
+            case OP_FOR_RANGE:
+            {
+                safe_point();
+
+                uint8_t counter = byte_read();
+                uint8_t limit = byte_read();
+                uint16_t offset = byte_read_short();
+
+                // Fails like the OP_ADD and OP_LESS it stands in for.
+                Value* slot = &frame->slots[counter];
+                if (!value_is_number(*slot))
+                {
+                    vm_raise_runtime_error(
+                        vm, "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                double next = value_as_number(*slot) + 1;
+                *slot = value_make_number(next);
+
+                if (!value_is_number(frame->slots[limit]))
+                {
+                    vm_raise_runtime_error(vm, "Operand must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (next < value_as_number(frame->slots[limit]))
+                {
+                    frame->ip -= offset;
+
+                    // The same safe spot as OP_LOOP.
+                    if (vm->gc_compact_pending && vm->callback_fiber == NULL)
+                        gc_compact(vm);
+                }
+                break;
+            }
+
+            case OP_ITER_NEXT:
+            {
+                safe_point();
+
+                uint8_t slot = byte_read();
+                uint16_t offset = byte_read_short();
+                Value* iterator = &frame->slots[slot];
+
+                if (obj_is_fiber(iterator[0]))
+                {
+                    ObjFiber* fiber = obj_as_fiber(iterator[0]);
+
+                    // A cursor of 1 means the fiber was resumed from here and
+                    // what it yielded or returned is on the stack.
+                    if (value_as_number(iterator[1]) == 1)
+                    {
+                        iterator[1] = value_make_number(0);
+                        Value value = vm_stack_pop(vm);
+
+                        // The value a fiber returns is not one of its items.
+                        if (fiber->state == FIBER_DONE) break;
+                        iterator[2] = value;
+                    }
+                    else
+                    {
+                        if (fiber->state == FIBER_DONE) break;
+
+                        if (fiber->state == FIBER_RUNNING)
+                        {
+                            vm_raise_runtime_error(vm,
+                                                   "Fiber is already running.");
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+
+                        // Runs this instruction again once the fiber yields or
+                        // returns.
+                        iterator[1] = value_make_number(1);
+                        frame->ip -= 4;
+
+                        fiber_enter(vm, fiber, value_make_nil());
+                        frame = &fiber->frames[fiber->frame_count - 1];
+                        break;
+                    }
+                }
+                else
+                {
+                    IterStep step = iterator_next(vm, iterator);
+                    if (step == ITER_ERROR) return INTERPRET_RUNTIME_ERROR;
+                    if (step == ITER_END) break;
+                }
+
+                frame->ip -= offset;
+
+                // The same safe spot as OP_LOOP.
+                if (vm->gc_compact_pending && vm->callback_fiber == NULL)
+                    gc_compact(vm);
                 break;
             }
 
             case OP_CALL:
             {
+                safe_point();
+
                 int argc = byte_read();
-                if (!value_call(vm_stack_peek(argc), argc))
+                if (!value_call(vm, vm_stack_peek(vm, argc), argc))
                     return INTERPRET_RUNTIME_ERROR;
 
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
                 break;
             }
 
             case OP_INVOKE:
             {
+                safe_point();
+
                 ObjString* method = byte_read_string();
                 int argc = byte_read();
 
-                if (!invoke(method, argc)) return INTERPRET_RUNTIME_ERROR;
+                if (!invoke(vm, method, argc)) return INTERPRET_RUNTIME_ERROR;
 
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
                 break;
             }
 
             case OP_SUPER_INVOKE:
             {
+                safe_point();
+
                 ObjString* method = byte_read_string();
                 int argc = byte_read();
-                ObjClass* superclass = obj_as_class(vm_stack_pop());
-                if (!invoke_from_class(superclass, method, argc))
+                ObjClass* superclass = obj_as_class(vm_stack_pop(vm));
+                if (!invoke_from_class(vm, superclass, method, argc))
                     return INTERPRET_RUNTIME_ERROR;
 
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
                 break;
             }
 
             case OP_CLOSURE:
             {
                 ObjFunction* function = obj_as_function(byte_read_constant());
-                ObjClosure* closure = obj_closure_new(function);
-                vm_stack_push(value_make_obj(closure));
+                ObjClosure* closure = obj_closure_new(vm, function);
+                vm_stack_push(vm, value_make_obj(closure));
 
                 for (int i = 0; i < closure->upvalue_count; ++i)
                 {
@@ -720,7 +1196,7 @@ static InterpretResult run()
                     if (is_local)
                     {
                         closure->upvalues[i] =
-                            upvalue_capture(frame->slots + index);
+                            upvalue_capture(vm, frame->slots + index);
                     }
                     else
                     {
@@ -732,134 +1208,320 @@ static InterpretResult run()
             }
 
             case OP_CLOSE_UPVALUE:
-                upvalue_close_until(vm.stack_top - 1);
-                vm_stack_pop();
+                upvalue_close_until(vm, vm->fiber->stack_top - 1);
+                vm_stack_pop(vm);
                 break;
 
             case OP_LIST_INIT:
             {
                 // Stack before: [item1, item2, ..., itemN] and after: [list]
-                ObjList* list = obj_list_new();
+                ObjList* list = obj_list_new(vm);
                 uint8_t item_count = byte_read();
 
                 // So list isn't sweeped by GC in obj_list_append
-                vm_stack_push(value_make_obj(list));
+                vm_stack_push(vm, value_make_obj(list));
                 // Add items to list
                 for (int i = item_count; i > 0; --i)
-                    obj_list_append(list, vm_stack_peek(i));
+                    obj_list_append(vm, list, vm_stack_peek(vm, i));
 
-                vm_stack_pop();
+                vm_stack_pop(vm);
 
                 // Pop items from stack
-                while (item_count-- > 0) vm_stack_pop();
+                while (item_count-- > 0) vm_stack_pop(vm);
 
-                vm_stack_push(value_make_obj(list));
+                vm_stack_push(vm, value_make_obj(list));
+                break;
+            }
+
+            case OP_MAP_INIT:
+            {
+                // Stack before: [key1, value1, ..., keyN, valueN] and after:
+                // [map]
+                ObjMap* map = obj_map_new(vm);
+                uint8_t entry_count = byte_read();
+
+                vm_stack_push(vm, value_make_obj(map));
+                map_reserve(vm, map, entry_count);
+
+                for (int i = entry_count * 2; i > 0; i -= 2)
+                {
+                    if (!map_key_set(vm, map, vm_stack_peek(vm, i),
+                                     vm_stack_peek(vm, i - 1)))
+                        return INTERPRET_RUNTIME_ERROR;
+                }
+
+                vm->fiber->stack_top -= entry_count * 2 + 1;
+                vm_stack_push(vm, value_make_obj(map));
                 break;
             }
 
             case OP_LIST_GETIDX:
             {
                 // Stack before: [list, index] and after: [index(list, index)]
-                Value index = vm_stack_pop();
-                Value list = vm_stack_pop();
+                Value index = vm_stack_pop(vm);
+                Value list = vm_stack_pop(vm);
+                bool floats = obj_is_float_array(list);
+
+                if (obj_is_map(list))
+                {
+                    Value value;
+                    if (!map_get(obj_as_map(list), index, &value))
+                    {
+                        vm_raise_runtime_error(vm, "Key not found in map.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    vm_stack_push(vm, value);
+                    break;
+                }
 
-                if (!obj_as_list(list))
+                if (!floats && !obj_is_list(list))
                 {
-                    raise_runtime_error("Invalid type to index into.");
+                    vm_raise_runtime_error(vm, "Invalid type to index into.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 if (!value_is_number(index))
                 {
-                    raise_runtime_error("List index is not a number.");
+                    vm_raise_runtime_error(vm, "List index is not a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                if (floats)
+                {
+                    ObjFloatArray* array = obj_as_float_array(list);
+                    int position = value_as_number(index);
+                    if (position < 0 || position >= array->count)
+                    {
+                        vm_raise_runtime_error(vm, "List index out of range");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    vm_stack_push(vm,
+                                  value_make_number(array->items[position]));
+                    break;
+                }
+
                 if (!obj_list_is_valid_index(obj_as_list(list),
                                              value_as_number(index)))
                 {
-                    raise_runtime_error("List index out of range");
+                    vm_raise_runtime_error(vm, "List index out of range");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 Value result =
                     obj_list_get(obj_as_list(list), value_as_number(index));
-                vm_stack_push(result);
+                vm_stack_push(vm, result);
                 break;
             }
 
             case OP_LIST_SETIDX:
             {
                 // Stack before: [list, index, item] and after: [item]
-                Value item = vm_stack_pop();
-                Value index = vm_stack_pop();
-                Value list = vm_stack_pop();
+                if (obj_is_map(vm_stack_peek(vm, 2)))
+                {
+                    // Set while still on the stack, the map may grow.
+                    if (!map_key_set(vm, obj_as_map(vm_stack_peek(vm, 2)),
+                                     vm_stack_peek(vm, 1), vm_stack_peek(vm, 0)))
+                        return INTERPRET_RUNTIME_ERROR;
+
+                    Value item = vm_stack_pop(vm);
+                    vm->fiber->stack_top -= 2;
+                    vm_stack_push(vm, item);
+                    break;
+                }
+
+                Value item = vm_stack_pop(vm);
+                Value index = vm_stack_pop(vm);
+                Value list = vm_stack_pop(vm);
+                bool floats = obj_is_float_array(list);
 
-                if (!obj_as_list(list))
+                if (!floats && !obj_is_list(list))
                 {
-                    raise_runtime_error("Invalid type to index into.");
+                    vm_raise_runtime_error(vm, "Invalid type to index into.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 if (!value_is_number(index))
                 {
-                    raise_runtime_error("List index is not a number.");
+                    vm_raise_runtime_error(vm, "List index is not a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                if (floats)
+                {
+                    ObjFloatArray* array = obj_as_float_array(list);
+                    int position = value_as_number(index);
+                    if (position < 0 || position >= array->count)
+                    {
+                        vm_raise_runtime_error(vm, "List index out of range");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    if (!value_is_number(item))
+                    {
+                        vm_raise_runtime_error(
+                            vm, "FloatArray item is not a number.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    array->items[position] = value_as_number(item);
+                    vm_stack_push(vm, item);
+                    break;
+                }
+
                 if (!obj_list_is_valid_index(obj_as_list(list),
                                              value_as_number(index)))
                 {
-                    raise_runtime_error("List index out of range");
+                    vm_raise_runtime_error(vm, "List index out of range");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 obj_list_set(obj_as_list(list), value_as_number(index), item);
-                vm_stack_push(item);
+                vm_stack_push(vm, item);
                 break;
             }
 
             case OP_RETURN:
             {
-                Value result = vm_stack_pop();
-                upvalue_close_until(frame->slots);
-                vm.frame_count--;
-                if (vm.frame_count == 0)
+                // Returns take interrupts without burning fuel, so samples
+                // land in functions that neither loop nor call as well.
+                safe_point_if(interrupt_pending());
+
+                Value result = vm_stack_pop(vm);
+                upvalue_close_until(vm, frame->slots);
+
+                ObjFiber* fiber = vm->fiber;
+                fiber->frame_count--;
+                fiber->stack_top = frame->slots;
+
+                // Back at the native that called in, see vm_call.
+                if (fiber == vm->callback_fiber &&
+                    fiber->frame_count == vm->callback_frames)
                 {
-                    vm_stack_pop();
+                    vm_stack_push(vm, result);
                     return INTERPRET_OK;
                 }
 
-                vm.stack_top = frame->slots;
-                vm_stack_push(result);
-                frame = &vm.frames[vm.frame_count - 1];
+                if (fiber->frame_count == 0 && fiber->caller == NULL)
+                {
+                    // The main fiber and spawned ones have nobody to return
+                    // to, the loop decides what runs next.
+                    if (fiber != vm->main_fiber) fiber->state = FIBER_DONE;
+
+                    vm->fiber = loop_next(vm);
+                    if (vm->fiber == NULL)
+                    {
+                        vm->fiber = vm->main_fiber;
+                        return INTERPRET_OK;
+                    }
+
+                    frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+                    break;
+                }
+
+                if (fiber->frame_count == 0)
+                {
+                    // A finished fiber hands its result to its resumer.
+                    fiber->state = FIBER_DONE;
+                    vm->fiber = fiber->caller;
+                    fiber->caller = NULL;
+                }
+
+                vm_stack_push(vm, result);
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+                break;
+            }
+
+            case OP_YIELD:
+            {
+                ObjFiber* fiber = vm->fiber;
+                if (fiber->caller == NULL)
+                {
+                    vm_raise_runtime_error(
+                        vm, "Cannot yield from a fiber nobody resumed.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (fiber == vm->callback_fiber)
+                {
+                    vm_raise_runtime_error(vm,
+                                           "Cannot yield from a callback.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // The value lands on the resumer's stack as the result of its
+                // resume, and whatever the next resume passes in becomes the
+                // result of this yield.
+                Value value = vm_stack_pop(vm);
+                fiber->state = FIBER_SUSPENDED;
+                vm->fiber = fiber->caller;
+                fiber->caller = NULL;
+
+                vm_stack_push(vm, value);
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+                break;
+            }
+
+            case OP_RESUME:
+            {
+                // Stack before: [fiber, value?] and after: [yielded value]
+                int argc = byte_read();
+                Value value = argc == 2 ? vm_stack_peek(vm, 0)
+                                        : value_make_nil();
+                Value callee = vm_stack_peek(vm, argc - 1);
+
+                if (!obj_is_fiber(callee))
+                {
+                    vm_raise_runtime_error(vm, "Can only resume fibers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjFiber* fiber = obj_as_fiber(callee);
+                if (fiber->state == FIBER_DONE)
+                {
+                    vm_raise_runtime_error(vm,
+                                           "Cannot resume a finished fiber.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (fiber->state == FIBER_RUNNING)
+                {
+                    vm_raise_runtime_error(vm, "Fiber is already running.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                fiber_enter(vm, fiber, value);
+                fiber->caller->stack_top -= argc;
+
+                frame = &fiber->frames[fiber->frame_count - 1];
                 break;
             }
 
             case OP_CLASS:
                 vm_stack_push(
-                    value_make_obj(obj_class_new(byte_read_string())));
+                    vm, value_make_obj(obj_class_new(vm, byte_read_string())));
                 break;
 
             case OP_INHERIT:
             {
-                Value superclass = vm_stack_peek(1);
+                Value superclass = vm_stack_peek(vm, 1);
 
                 if (!obj_is_class(superclass))
                 {
-                    raise_runtime_error("Superclass must be a class.");
+                    vm_raise_runtime_error(vm, "Superclass must be a class.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjClass* subclass = obj_as_class(vm_stack_peek(0));
-                table_append(&obj_as_class(superclass)->methods,
+                ObjClass* subclass = obj_as_class(vm_stack_peek(vm, 0));
+                table_append(vm, &obj_as_class(superclass)->methods,
                              &subclass->methods);
-                vm_stack_pop(); // Subclass.
+                vm_stack_pop(vm); // Subclass.
                 break;
             }
 
             case OP_METHOD:
-                define_method(byte_read_string());
+                define_method(vm, byte_read_string());
                 break;
         }
     }
@@ -868,20 +1530,183 @@ static InterpretResult run()
 #undef byte_read_short
 #undef byte_read_constant
 #undef byte_read_string
+#undef safe_point_if
+#undef interrupt_pending
+#undef safe_point
 #undef binary_op
 }
 
-InterpretResult vm_interpret(const char* source)
+InterpretResult vm_interpret(VM* vm, const char* source)
 {
-    ObjFunction* function = compile(source);
+    // Whatever an interrupted script left behind is abandoned, and so is an
+    // interrupt meant for it.
+    if (vm->fiber != vm->main_fiber || vm->fiber->frame_count > 0)
+        vm_stack_reset(vm);
+    atomic_store_explicit(&vm->interrupt, 0, memory_order_relaxed);
+    vm->out_of_memory = false;
+
+    ObjFunction* function = compile(vm, source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
-    vm_stack_push(value_make_obj(function));
+    vm_stack_push(vm, value_make_obj(function));
+
+    ObjClosure* closure = obj_closure_new(vm, function);
+    vm_stack_pop(vm);
+    vm_stack_push(vm, value_make_obj(closure));
+    obj_func_call(vm, closure, 0);
 
-    ObjClosure* closure = obj_closure_new(function);
-    vm_stack_pop();
-    vm_stack_push(value_make_obj(closure));
-    obj_func_call(closure, 0);
+    fuel_fill(vm);
+    if (vm->profile != NULL) profile_begin(vm->profile);
+    return run(vm);
+}
+
+bool vm_call(VM* vm, int argc)
+{
+    ObjFiber* outer_fiber = vm->callback_fiber;
+    int outer_frames = vm->callback_frames;
+
+    ObjFiber* fiber = vm->fiber;
+    vm->callback_fiber = fiber;
+    vm->callback_frames = fiber->frame_count;
+
+    InterpretResult result = INTERPRET_OK;
+    if (!value_call(vm, vm_stack_peek(vm, argc), argc))
+    {
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    else if (fiber->frame_count > vm->callback_frames)
+    {
+        // Natives and classes without an initializer are done already.
+        result = run(vm);
+    }
+
+    vm->callback_fiber = outer_fiber;
+    vm->callback_frames = outer_frames;
+
+    // The native's C frame cannot be suspended, so neither can the callback.
+    if (result == INTERPRET_INTERRUPTED)
+    {
+        vm_raise_runtime_error(vm, "Callback interrupted.");
+        return false;
+    }
+
+    return result == INTERPRET_OK;
+}
+
+// Runs the fiber's frames above the native's until they return into it.
+static InterpretResult callback_run(VM* vm)
+{
+    ObjFiber* outer_fiber = vm->callback_fiber;
+    int outer_frames = vm->callback_frames;
+
+    ObjFiber* fiber = vm->fiber;
+    vm->callback_fiber = fiber;
+    vm->callback_frames = fiber->frame_count - 1;
+
+    InterpretResult result = run(vm);
+
+    vm->callback_fiber = outer_fiber;
+    vm->callback_frames = outer_frames;
+
+    // The native's C frame cannot be suspended, so neither can the callback.
+    if (result == INTERPRET_INTERRUPTED)
+    {
+        vm_raise_runtime_error(vm, "Callback interrupted.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return result;
+}
+
+bool vm_callback_begin(VM* vm, Callback* callback, Value callee, int argc)
+{
+    callback->callee = callee;
+    callback->receiver = callee;
+    callback->closure = NULL;
+    callback->argc = argc;
+
+    // The callee stays rooted below the frame, whose slot zero every
+    // return overwrites.
+    ObjFiber* fiber = vm->fiber;
+    vm_stack_push(vm, callee);
+    callback->base = (int)(fiber->stack_top - fiber->stack);
+
+    if (obj_is_closure(callee))
+    {
+        callback->closure = obj_as_closure(callee);
+    }
+    else if (obj_is_bound_method(callee))
+    {
+        ObjBoundMethod* bound = obj_as_bound_method(callee);
+        callback->receiver = bound->receiver;
+        callback->closure = bound->method;
+    }
+    else
+    {
+        return true;
+    }
+
+    ObjFunction* function = callback->closure->function;
+    if (argc != function->arity)
+    {
+        vm_raise_runtime_error(vm, "Expected %d argument but got %d.",
+                               function->arity, argc);
+        return false;
+    }
+
+    if (fiber->frame_count == FRAMES_MAX)
+    {
+        vm_raise_runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+
+    // Frames above the count are left alone until a call pushes one, so
+    // the closure set here outlasts every call.
+    obj_fiber_frames_ensure(vm, fiber, fiber->frame_count + 1);
+    fiber->frames[fiber->frame_count].closure = callback->closure;
+    return true;
+}
+
+bool vm_callback_call(VM* vm, Callback* callback, const Value* args,
+                      Value* out_result)
+{
+    ObjFiber* fiber = vm->fiber;
+    fiber->stack_top = fiber->stack + callback->base;
+
+    if (callback->closure == NULL)
+    {
+        vm_stack_push(vm, callback->callee);
+        for (int i = 0; i < callback->argc; ++i) vm_stack_push(vm, args[i]);
+        if (!vm_call(vm, callback->argc)) return false;
+
+        *out_result = vm_stack_pop(vm);
+        return true;
+    }
+
+    vm_stack_push(vm, callback->receiver);
+    for (int i = 0; i < callback->argc; ++i) vm_stack_push(vm, args[i]);
+
+    CallFrame* frame = &fiber->frames[fiber->frame_count++];
+    frame->ip = callback->closure->function->chunk.code;
+    frame->slots = fiber->stack + callback->base;
+
+    if (callback_run(vm) != INTERPRET_OK) return false;
+
+    *out_result = vm_stack_pop(vm);
+    return true;
+}
+
+void vm_interrupt(VM* vm)
+{
+    atomic_fetch_or_explicit(&vm->interrupt, VM_INTERRUPT_STOP,
+                             memory_order_relaxed);
+}
+
+InterpretResult vm_resume(VM* vm)
+{
+    if (vm->fiber->frame_count == 0) return INTERPRET_OK;
 
-    return run();
+    fuel_fill(vm);
+    if (vm->profile != NULL) profile_begin(vm->profile);
+    return run(vm);
 }
\ No newline at end of file
@@ -1,39 +1,98 @@
 #ifndef CLOX_VM_H_
 #define CLOX_VM_H_
 
+#include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
 #define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 
-typedef struct
-{
-    ObjClosure* closure;
-    uint8_t* ip;
-    Value* slots;
-} CallFrame;
+// Stack slots a native may push without the stack moving.
+#define NATIVE_STACK_SLACK 8
 
-typedef struct
+// Stop with INTERPRET_INTERRUPTED, or with a runtime error when the VM ran
+// out of memory.
+#define VM_INTERRUPT_STOP 1u
+
+// Let the sampler record the Lox stack, then carry on.
+#define VM_INTERRUPT_SAMPLE 2u
+
+#define native_return(value)                                                   \
+    do                                                                         \
+    {                                                                          \
+        args[-1] = (value);                                                    \
+        return true;                                                           \
+    } while (false)
+
+struct VM
 {
-    CallFrame frames[FRAMES_MAX];
-    int frame_count;
+    // Frames, value stack and open upvalues all live in the running fiber.
+    ObjFiber* fiber;
+    ObjFiber* main_fiber;
+    struct Loop* loop;
+
+    // Set while a native calls back into Lox through vm_call or a Callback:
+    // the fiber it runs on and the frame count the callback returns to.
+    ObjFiber* callback_fiber;
+    int callback_frames;
+
+    // Set by the host to profile every instruction, NULL otherwise.
+    struct Profile* profile;
+
+    // Set by the host to attribute allocations to Lox lines, NULL otherwise.
+    struct Allocs* allocs;
 
-    Value stack[STACK_MAX];
-    Value* stack_top;
     Table globals;
+    Table builtins;
     Table strings;
     ObjString* init_str;
-    ObjUpValue* open_upvalues;
 
-    size_t bytes_allocated;
+    // Also updated by the background sweep.
+    atomic_size_t bytes_allocated;
     size_t next_gc;
-    Obj* objects;
-    int gray_count;
-    int gray_capacity;
-    Obj** gray_stack;
-} VM;
+    Heap heap;
+    Sweep sweep;
+    GrayStack gray;
+
+    // Tracing fans out over gc_threads markers once a collection starts with
+    // at least gc_parallel_threshold bytes allocated.
+    int gc_threads;
+    size_t gc_parallel_threshold;
+
+    // Compaction, requested by a sweep leaving most slots empty.
+    bool gc_compact;
+    bool gc_compact_pending;
+
+    // The next collection starts once the heap grew by gc_grow_factor, but
+    // not before it reaches gc_heap_min and no later than at gc_heap_max
+    // unless that is zero.
+    double gc_grow_factor;
+    size_t gc_heap_min;
+    size_t gc_heap_max;
+    GcStats gc_stats;
+
+    // Hard ceiling on the heap, zero for none. Allocations past it after a
+    // full collection set out_of_memory, which the interpreter turns into a
+    // runtime error.
+    size_t heap_limit;
+    bool out_of_memory;
+
+    // Backward jumps and calls a run may take before it is interrupted,
+    // zero for no limit. fuel is what is left of it.
+    uint64_t fuel_limit;
+    uint64_t fuel;
+
+    // VM_INTERRUPT_* reasons for the interpreter to step aside at its next
+    // backward jump, call or return, set from any thread or a signal handler.
+    atomic_uint interrupt;
+    struct Sampler* sampler;
+
+    struct Parser* parser;
+
+    FILE* out;
+    FILE* err;
+};
 
 typedef enum
 {
@@ -41,14 +100,56 @@ typedef enum
     INTERPRET_COMPILE_OK,
     INTERPRET_COMPILE_ERROR,
     INTERPRET_RUNTIME_ERROR,
+    INTERPRET_INTERRUPTED,
 } InterpretResult;
 
-extern VM vm;
+void vm_init(VM* vm);
+void vm_free(VM* vm);
+void vm_reset(VM* vm);
+void vm_define_native_fn(VM* vm, const char* name, NativeFn function);
+void vm_raise_runtime_error(VM* vm, const char* format, ...);
+InterpretResult vm_interpret(VM* vm, const char* source);
+
+// Stops the running script with INTERPRET_INTERRUPTED, safe to call from
+// another thread or a signal handler. A script blocked on the event loop
+// only notices once it runs again.
+void vm_interrupt(VM* vm);
+
+// Continues an interrupted script with a full tank of fuel. Interpreting
+// another one abandons it instead.
+InterpretResult vm_resume(VM* vm);
+void vm_stack_push(VM* vm, Value value);
+Value vm_stack_pop(VM* vm);
+
+// Calls the callee below the argc arguments on top of the stack from inside
+// a native, leaving the result in its place like OP_CALL does. The callee
+// runs to completion: compaction waits meanwhile, and neither yielding nor
+// blocking on the event loop is allowed. The stack may move, natives find
+// their args again by offset. False after a runtime error, which already
+// reset the stack.
+bool vm_call(VM* vm, int argc);
+
+// A callee a native calls over and over with the same number of arguments,
+// a sort comparator say. Closures and bound methods get one frame that every
+// call rewinds rather than setting up anew, other callees go through vm_call.
+typedef struct
+{
+    Value callee;
+    Value receiver;
+    ObjClosure* closure;
+    int argc;
+
+    // Where the callee sits on the stack, an offset since the stack may move.
+    int base;
+} Callback;
+
+// Pushes callee and checks it takes argc arguments, false after a runtime
+// error. The pushed slots belong to the native until it returns.
+bool vm_callback_begin(VM* vm, Callback* callback, Value callee, int argc);
 
-void vm_init();
-void vm_free();
-InterpretResult vm_interpret(const char* source);
-void vm_stack_push(Value value);
-Value vm_stack_pop();
+// Calls the callee with argc args, which must not point into the stack, with
+// the same restrictions as vm_call. False after a runtime error.
+bool vm_callback_call(VM* vm, Callback* callback, const Value* args,
+                      Value* out_result);
 
 #endif // CLOX_VM_H_
@@ -0,0 +1,36 @@
+#ifndef CLOX_TESTS_BENCH_H_
+#define CLOX_TESTS_BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "vm.h"
+
+// Microbenchmark helpers shared by the bench_* suites. Numbers are only
+// worth comparing between optimized builds of the same machine.
+
+static inline uint64_t bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Prints what one of `ops` operations that took `ns` together cost.
+static inline void bench_report(const char* name, long ops, uint64_t ns)
+{
+    printf("bench: %-32s %10.1f ns/op  (%ld ops)\n", name, (double)ns / ops,
+           ops);
+}
+
+// A VM that only collects when told to, so a benchmark times the structure
+// it is about rather than whichever collection its allocations trigger.
+static inline void bench_vm_init(VM* vm)
+{
+    vm_init(vm);
+    vm->gc_compact = false;
+    vm->gc_heap_min = vm->next_gc = (size_t)1 << 40;
+}
+
+#endif // CLOX_TESTS_BENCH_H_
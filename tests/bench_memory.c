@@ -0,0 +1,100 @@
+#define CLOVE_SUITE_NAME MemoryBench
+#include "clove-unit/clove-unit.h"
+
+#include "bench.h"
+#include "memory.h"
+
+#define HEAP_LISTS 1000
+#define HEAP_LIST_LENGTH 100
+#define COLLECTIONS 10
+
+static VM vm;
+
+CLOVE_SUITE_SETUP()
+{
+    bench_vm_init(&vm);
+}
+
+CLOVE_SUITE_TEARDOWN()
+{
+    vm_free(&vm);
+}
+
+// Fills the heap with lists holding numbers, strings and instances, about
+// half of them reachable from a global when `live` is set.
+static size_t heap_build(bool live)
+{
+    ObjString* name = obj_string_cpy(&vm, "heap", 4);
+    vm_stack_push(&vm, value_make_obj(name));
+
+    ObjList* root = obj_list_new(&vm);
+    table_set(&vm, &vm.globals, name, value_make_obj(root));
+    vm_stack_pop(&vm);
+
+    ObjClass* cls = obj_class_new(&vm, name);
+    obj_list_append(&vm, root, value_make_obj(cls));
+
+    for (int i = 0; i < HEAP_LISTS; ++i)
+    {
+        ObjList* list = obj_list_new(&vm);
+        if (live && i % 2 == 0)
+            obj_list_append(&vm, root, value_make_obj(list));
+
+        for (int j = 0; j < HEAP_LIST_LENGTH; ++j)
+        {
+            Value item = value_make_number(j);
+            if (j % 4 == 1)
+            {
+                char chars[32];
+                int length = snprintf(chars, sizeof(chars), "item%d.%d", i, j);
+                item = value_make_obj(obj_string_cpy(&vm, chars, length));
+            }
+            else if (j % 4 == 2)
+            {
+                item = value_make_obj(obj_instance_new(&vm, cls));
+            }
+
+            obj_list_append(&vm, list, item);
+        }
+    }
+
+    return gc_bytes_allocated(&vm);
+}
+
+// Every round builds a fresh heap, dropping the previous one, and times the
+// collection finding it. Returns the bytes the first and last collection
+// started and ended with.
+static void gc_bench(const char* name, bool live, size_t* before,
+                     size_t* after)
+{
+    uint64_t elapsed = 0;
+
+    for (int i = 0; i < COLLECTIONS; ++i)
+    {
+        *before = heap_build(live);
+
+        uint64_t start = bench_now();
+        gc_perform(&vm);
+        gc_sweep_finish(&vm);
+        elapsed += bench_now() - start;
+
+        *after = gc_bytes_allocated(&vm);
+        vm.next_gc = vm.gc_heap_min;
+    }
+
+    bench_report(name, COLLECTIONS, elapsed);
+}
+
+CLOVE_TEST(CollectGarbageHeap)
+{
+    size_t before, after;
+    gc_bench("gc_perform garbage", false, &before, &after);
+    CLOVE_IS_TRUE(after * 2 < before);
+}
+
+CLOVE_TEST(CollectHalfLiveHeap)
+{
+    size_t before, after;
+    gc_bench("gc_perform half live", true, &before, &after);
+    CLOVE_IS_TRUE(after * 2 > before && after < before);
+}
@@ -0,0 +1,73 @@
+#define CLOVE_SUITE_NAME ObjectBench
+#include "clove-unit/clove-unit.h"
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "object.h"
+
+#define STRING_COUNT 100000
+#define STRING_LENGTH 12
+#define LIST_LENGTH 100000
+
+static VM vm;
+
+CLOVE_SUITE_SETUP()
+{
+    bench_vm_init(&vm);
+}
+
+CLOVE_SUITE_TEARDOWN()
+{
+    vm_free(&vm);
+}
+
+// Distinct strings are allocated and interned, copying them a second time
+// only finds them in the string table.
+CLOVE_TEST(StringCopyNewAndInterned)
+{
+    char* chars = (char*)malloc(STRING_COUNT * (STRING_LENGTH + 1));
+    CLOVE_NOT_NULL(chars);
+
+    for (int i = 0; i < STRING_COUNT; ++i)
+        snprintf(chars + i * (STRING_LENGTH + 1), STRING_LENGTH + 1,
+                 "string%06d", i);
+
+    ObjString* first = NULL;
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < STRING_COUNT; ++i)
+    {
+        ObjString* string =
+            obj_string_cpy(&vm, chars + i * (STRING_LENGTH + 1), STRING_LENGTH);
+        if (i == 0) first = string;
+    }
+
+    bench_report("obj_string_cpy new", STRING_COUNT, bench_now() - start);
+
+    ObjString* again = NULL;
+    start = bench_now();
+
+    for (int i = 0; i < STRING_COUNT; ++i)
+    {
+        ObjString* string =
+            obj_string_cpy(&vm, chars + i * (STRING_LENGTH + 1), STRING_LENGTH);
+        if (i == 0) again = string;
+    }
+
+    bench_report("obj_string_cpy interned", STRING_COUNT, bench_now() - start);
+    free(chars);
+    CLOVE_PTR_EQ(first, again);
+}
+
+CLOVE_TEST(ListAppend)
+{
+    ObjList* list = obj_list_new(&vm);
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < LIST_LENGTH; ++i)
+        obj_list_append(&vm, list, value_make_number(i));
+
+    bench_report("obj_list_append", LIST_LENGTH, bench_now() - start);
+    CLOVE_INT_EQ(LIST_LENGTH, list->count);
+}
@@ -0,0 +1,127 @@
+#define CLOVE_SUITE_NAME TableBench
+#include "clove-unit/clove-unit.h"
+
+#include "bench.h"
+#include "table.h"
+
+#define KEY_COUNT 1024
+#define OPS 200000
+
+static VM vm;
+static ObjString* keys[KEY_COUNT];
+
+CLOVE_SUITE_SETUP()
+{
+    bench_vm_init(&vm);
+
+    // Interned strings live as long as the VM does not collect.
+    for (int i = 0; i < KEY_COUNT; ++i)
+    {
+        char chars[16];
+        int length = snprintf(chars, sizeof(chars), "key%d", i);
+        keys[i] = obj_string_cpy(&vm, chars, length);
+    }
+}
+
+CLOVE_SUITE_TEARDOWN()
+{
+    vm_free(&vm);
+}
+
+CLOVE_TEST(SetIntoGrowingTable)
+{
+    long ops = 0;
+    uint64_t start = bench_now();
+
+    for (int round = 0; round < OPS / KEY_COUNT; ++round)
+    {
+        Table table;
+        table_init(&table);
+
+        for (int i = 0; i < KEY_COUNT; ++i, ++ops)
+            table_set(&vm, &table, keys[i], value_make_number(i));
+
+        table_free(&vm, &table);
+    }
+
+    bench_report("table_set growing", ops, bench_now() - start);
+    CLOVE_PASS();
+}
+
+CLOVE_TEST(GetHits)
+{
+    Table table;
+    table_init(&table);
+    for (int i = 0; i < KEY_COUNT; ++i)
+        table_set(&vm, &table, keys[i], value_make_number(i));
+
+    Value value;
+    bool found = true;
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < OPS; ++i)
+        found &= table_get(&table, keys[i % KEY_COUNT], &value);
+
+    bench_report("table_get hit", OPS, bench_now() - start);
+    table_free(&vm, &table);
+    CLOVE_IS_TRUE(found);
+}
+
+// Sets, deletes and looks up keys of a half full table, so probes keep
+// running into tombstones left by earlier deletes.
+CLOVE_TEST(SetGetDeleteChurn)
+{
+    Table table;
+    table_init(&table);
+    for (int i = 0; i < KEY_COUNT / 2; ++i)
+        table_set(&vm, &table, keys[i], value_make_number(i));
+
+    Value value;
+    int hits = 0;
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < OPS; ++i)
+    {
+        table_set(&vm, &table, keys[(i + KEY_COUNT / 2) % KEY_COUNT],
+                  value_make_number(i));
+        table_delete(&table, keys[i % KEY_COUNT]);
+        hits += table_get(&table, keys[(i + KEY_COUNT / 4) % KEY_COUNT],
+                          &value);
+    }
+
+    bench_report("table_set/delete/get churn", OPS * 3L, bench_now() - start);
+    table_free(&vm, &table);
+    CLOVE_INT_EQ(OPS, hits);
+}
+
+CLOVE_TEST(FindStringHitsAndMisses)
+{
+    long ops = 0;
+    int found = 0;
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < OPS; ++i, ++ops)
+    {
+        ObjString* key = keys[i % KEY_COUNT];
+        found += table_find_string(&vm.strings, key->chars, key->length,
+                                   key->hash) == key;
+    }
+
+    bench_report("table_find_string hit", ops, bench_now() - start);
+
+    // The same characters with a hash no key has make every lookup miss.
+    ops = 0;
+    int missed = 0;
+    start = bench_now();
+
+    for (int i = 0; i < OPS; ++i, ++ops)
+    {
+        ObjString* key = keys[i % KEY_COUNT];
+        missed += table_find_string(&vm.strings, key->chars, key->length - 1,
+                                    key->hash + 1) == NULL;
+    }
+
+    bench_report("table_find_string miss", ops, bench_now() - start);
+    CLOVE_INT_EQ(OPS, found);
+    CLOVE_INT_EQ(OPS, missed);
+}
@@ -0,0 +1,100 @@
+#define CLOVE_SUITE_NAME LoopTest
+#include "clove-unit/clove-unit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vm.h"
+
+// Runs source in a fresh VM and compares what it printed with expected.
+static bool script_prints(const char* source, const char* expected)
+{
+    VM vm;
+    vm_init(&vm);
+    vm.out = tmpfile();
+
+    InterpretResult result = vm_interpret(&vm, source);
+
+    char output[256] = {0};
+    rewind(vm.out);
+    size_t count = fread(output, 1, sizeof(output) - 1, vm.out);
+    output[count] = '\0';
+
+    fclose(vm.out);
+    vm.out = stdout;
+    vm_free(&vm);
+
+    if (result == INTERPRET_OK && strcmp(output, expected) == 0) return true;
+
+    printf("expected:\n%sgot:\n%s\n", expected, output);
+    return false;
+}
+
+// Both readers park on the same end of the pipe, each write wakes the one
+// that waited longest.
+CLOVE_TEST(ReadersShareAPipe)
+{
+    const char* source =
+        "var p = pipe();\n"
+        "var got = [];\n"
+        "fun reader() { append(got, read(p[0])); }\n"
+        "spawn(reader);\n"
+        "spawn(reader);\n"
+        "sleep(1);\n"
+        "write(p[1], \"a\");\n"
+        "sleep(1);\n"
+        "write(p[1], \"b\");\n"
+        "while (length(got) < 2) sleep(1);\n"
+        "println got;\n";
+
+    CLOVE_IS_TRUE(script_prints(source, "[a, b]\n"));
+}
+
+// Writing to a pipe nobody reads any more fails with nil instead of taking
+// the process down.
+CLOVE_TEST(WriteToClosedPipeReturnsNil)
+{
+    const char* source =
+        "var p = pipe();\n"
+        "close(p[0]);\n"
+        "println write(p[1], \"x\");\n"
+        "close(p[1]);\n";
+
+    CLOVE_IS_TRUE(script_prints(source, "nil\n"));
+}
+
+// One fiber reads a socket while another is parked writing more than its
+// buffer takes, both on the same descriptor.
+CLOVE_TEST(ReaderAndWriterShareASocket)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/clox_test_loop_%d.sock", (int)getpid());
+
+    char source[2048];
+    snprintf(source, sizeof(source),
+             "var server = listen(\"%s\");\n"
+             "var client = connect(\"%s\");\n"
+             "var peer = accept(server);\n"
+             "var big = \"x\";\n"
+             "for (i in 0..20) big = big + big;\n"
+             "var log = [];\n"
+             "fun reader() { append(log, \"read \" + read(client)); }\n"
+             "fun writer() { write(client, big); append(log, \"wrote\"); }\n"
+             "spawn(reader);\n"
+             "spawn(writer);\n"
+             "sleep(10);\n"
+             "while (!contains(log, \"wrote\")) read(peer, 65536);\n"
+             "write(peer, \"hi\");\n"
+             "while (length(log) < 2) sleep(1);\n"
+             "println log;\n"
+             "close(peer);\n"
+             "close(client);\n"
+             "close(server);\n",
+             path, path);
+
+    bool ok = script_prints(source, "[wrote, read hi]\n");
+    unlink(path);
+    CLOVE_IS_TRUE(ok);
+}
@@ -0,0 +1,173 @@
+#define CLOVE_SUITE_NAME SnapshotTest
+#include "clove-unit/clove-unit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "vm.h"
+
+// Touches every kind of object an image holds: strings, functions and
+// closures with upvalues, classes, instances and bound methods, lists, maps,
+// float arrays and a fiber suspended in the middle of a loop.
+static const char* prelude =
+    "fun counter() { var n = 0; fun next() { n = n + 1; return n; } "
+    "return next; }\n"
+    "class Point { init(x) { this.x = x; } get() { return this.x; } }\n"
+    "var p = Point(3);\n"
+    "var bound = p.get;\n"
+    "var next = counter();\n"
+    "next();\n"
+    "var items = [1, \"two\", nil, true, next];\n"
+    "var table = {1: \"one\", \"p\": p};\n"
+    "var floats = FloatArray(4);\n"
+    "fun gen() { for (x in [1, 2, 3]) yield x; }\n"
+    "var fiber = Fiber(gen);\n"
+    "resume(fiber);\n";
+
+static char image_path[] = "/tmp/clox_test_image_XXXXXX";
+static char broken_path[] = "/tmp/clox_test_broken_XXXXXX";
+static uint8_t* image;
+static long image_size;
+static FILE* quiet;
+
+static bool image_load(const char* path)
+{
+    VM vm;
+    vm_init(&vm);
+    vm.out = quiet;
+    vm.err = quiet;
+
+    bool ok = snapshot_load(&vm, path);
+
+    vm_free(&vm);
+    return ok;
+}
+
+// Loads the image into a fresh VM and runs source against what it restored,
+// comparing what that printed with expected.
+static bool image_runs(const char* path, const char* source,
+                       const char* expected)
+{
+    VM vm;
+    vm_init(&vm);
+    vm.out = tmpfile();
+
+    bool ok = snapshot_load(&vm, path) &&
+              vm_interpret(&vm, source) == INTERPRET_OK;
+
+    char output[256] = {0};
+    rewind(vm.out);
+    size_t count = fread(output, 1, sizeof(output) - 1, vm.out);
+    output[count] = '\0';
+
+    fclose(vm.out);
+    vm.out = stdout;
+    vm_free(&vm);
+
+    if (ok && strcmp(output, expected) == 0) return true;
+
+    printf("expected:\n%sgot:\n%s\n", expected, output);
+    return false;
+}
+
+static void broken_write(const uint8_t* bytes, long size)
+{
+    FILE* file = fopen(broken_path, "wb");
+    fwrite(bytes, 1, size, file);
+    fclose(file);
+}
+
+CLOVE_SUITE_SETUP()
+{
+    quiet = fopen("/dev/null", "w");
+    close(mkstemp(image_path));
+    close(mkstemp(broken_path));
+
+    VM vm;
+    vm_init(&vm);
+    vm_interpret(&vm, prelude);
+    snapshot_save(&vm, image_path);
+    vm_free(&vm);
+
+    FILE* file = fopen(image_path, "rb");
+    fseek(file, 0, SEEK_END);
+    image_size = ftell(file);
+    rewind(file);
+
+    image = (uint8_t*)malloc(image_size);
+    if (fread(image, 1, image_size, file) != (size_t)image_size) image_size = 0;
+    fclose(file);
+}
+
+CLOVE_SUITE_TEARDOWN()
+{
+    free(image);
+    remove(image_path);
+    remove(broken_path);
+    fclose(quiet);
+}
+
+CLOVE_TEST(IntactImageLoads)
+{
+    CLOVE_IS_TRUE(image_size > 0);
+    CLOVE_IS_TRUE(image_load(image_path));
+}
+
+// The restored heap carries on where the saved one stopped: the counter and
+// the list share one closure and its upvalue, and the fiber resumes inside
+// its loop.
+CLOVE_TEST(IntactImageRestoresState)
+{
+    const char* source =
+        "println next();\n"
+        "println items[4]();\n"
+        "println bound();\n"
+        "println items[1];\n"
+        "println table[1];\n"
+        "println table[\"p\"].x;\n"
+        "println length(floats);\n"
+        "println resume(fiber);\n"
+        "println resume(fiber);\n";
+
+    CLOVE_IS_TRUE(image_runs(image_path, source,
+                             "2\n3\n3\ntwo\none\n3\n4\n2\n3\n"));
+}
+
+CLOVE_TEST(TruncatedImagesAreRejected)
+{
+    for (long size = 0; size < image_size; ++size)
+    {
+        broken_write(image, size);
+        if (image_load(broken_path)) CLOVE_FAIL();
+    }
+
+    CLOVE_PASS();
+}
+
+// Flipped bytes may still make up a valid image, a number changing say, but
+// loading one must never read or write out of bounds.
+CLOVE_TEST(CorruptedImagesLoadOrFailCleanly)
+{
+    uint8_t* bytes = (uint8_t*)malloc(image_size);
+    CLOVE_NOT_NULL(bytes);
+
+    static const uint8_t flips[] = {0x01, 0x80, 0xFF};
+
+    for (long i = 0; i < image_size; ++i)
+    {
+        for (size_t flip = 0; flip < sizeof(flips); ++flip)
+        {
+            memcpy(bytes, image, image_size);
+            bytes[i] ^= flips[flip];
+
+            broken_write(bytes, image_size);
+            image_load(broken_path);
+        }
+    }
+
+    free(bytes);
+    CLOVE_PASS();
+}